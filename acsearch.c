@@ -0,0 +1,360 @@
+/*
+ * acsearch.c
+ *
+ * This file implements the multi-pattern searcher described in
+ * acsearch.h.
+ *
+ * acsearch_compile() builds the automaton in three passes: first
+ * it assigns the byte classes, then it builds the trie of the
+ * patterns, and then it visits the trie breadth first, computing
+ * each state's "failure" state (the state for the longest proper
+ * suffix of its string that is also in the trie) and filling in
+ * its missing transitions from its failure state's, which has
+ * always been visited already. Each state's outputs are its own
+ * patterns plus those of its failure state, so they're copied into
+ * one flat array as the states are visited.
+ */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "errors.h"
+#include "acsearch.h"
+
+/*
+ * Initialize a searcher, with no patterns.
+ */
+int acsearch_init (acsearch_t *search)
+{
+    memset (search, 0, sizeof (acsearch_t));
+    search->valid = ACSEARCH_VALID;
+    return 0;
+}
+
+/*
+ * Destroy a searcher, and free its patterns and automaton.
+ */
+int acsearch_destroy (acsearch_t *search)
+{
+    int index;
+
+    if (search->valid != ACSEARCH_VALID)
+        return EINVAL;
+
+    search->valid = 0;
+    for (index = 0; index < search->count; index++)
+        free (search->pattern[index]);
+    free (search->pattern);
+    free (search->length);
+    free (search->delta);
+    free (search->out_first);
+    free (search->out_count);
+    free (search->out);
+    return 0;
+}
+
+/*
+ * Add a pattern (which is copied) to a searcher that hasn't been
+ * compiled yet. Patterns are numbered from 0, in the order added.
+ */
+int acsearch_add (acsearch_t *search, const char *pattern, size_t length)
+{
+    char **new_pattern;
+    size_t *new_length;
+    int allocated;
+
+    if (search->valid != ACSEARCH_VALID || search->compiled)
+        return EINVAL;
+    if (length == 0)
+        return EINVAL;
+
+    if (search->count == search->allocated) {
+        allocated = search->allocated == 0 ? 16 : search->allocated * 2;
+        new_pattern = (char**)realloc (
+            search->pattern, allocated * sizeof (char*));
+        if (new_pattern == NULL)
+            return ENOMEM;
+        search->pattern = new_pattern;
+        new_length = (size_t*)realloc (
+            search->length, allocated * sizeof (size_t));
+        if (new_length == NULL)
+            return ENOMEM;
+        search->length = new_length;
+        search->allocated = allocated;
+    }
+    search->pattern[search->count] = (char*)malloc (length);
+    if (search->pattern[search->count] == NULL)
+        return ENOMEM;
+    memcpy (search->pattern[search->count], pattern, length);
+    search->length[search->count] = length;
+    search->count++;
+    return 0;
+}
+
+/*
+ * Build the automaton for the patterns added so far. After this,
+ * no more patterns may be added.
+ */
+int acsearch_compile (acsearch_t *search)
+{
+    unsigned int *delta = NULL, *fail = NULL, *queue = NULL, *shrunk;
+    unsigned int *out_first = NULL, *out_count = NULL;
+    int *own = NULL, *link = NULL, *out = NULL, *new_out;
+    size_t total = 0, offset, max_states;
+    unsigned int state, target, head, tail;
+    int index, classes, class, states, outputs = 0, allocated = 0;
+    int status = ENOMEM;
+
+    if (search->valid != ACSEARCH_VALID || search->compiled)
+        return EINVAL;
+
+    /*
+     * Give each distinct pattern byte a class; all other bytes are
+     * class 0.
+     */
+    memset (search->class, 0, sizeof (search->class));
+    classes = 1;
+    for (index = 0; index < search->count; index++) {
+        total += search->length[index];
+        for (offset = 0; offset < search->length[index]; offset++) {
+            class = (unsigned char)search->pattern[index][offset];
+            if (search->class[class] == 0)
+                search->class[class] = classes++;
+        }
+    }
+    max_states = total + 1;
+    if (max_states * classes > ~ACSEARCH_OUTPUT)
+        return E2BIG;
+
+    /*
+     * Build the trie. While building, transitions hold state
+     * numbers, and 0 (the root, which is no state's child) means
+     * there's no transition yet.
+     */
+    delta = (unsigned int*)calloc (
+        max_states * classes, sizeof (unsigned int));
+    own = (int*)malloc (max_states * sizeof (int));
+    link = (int*)malloc ((search->count + 1) * sizeof (int));
+    if (delta == NULL || own == NULL || link == NULL)
+        goto done;
+    for (offset = 0; offset < max_states; offset++)
+        own[offset] = -1;
+    states = 1;
+    for (index = 0; index < search->count; index++) {
+        state = 0;
+        for (offset = 0; offset < search->length[index]; offset++) {
+            class = search->class[
+                (unsigned char)search->pattern[index][offset]];
+            if (delta[state * classes + class] == 0)
+                delta[state * classes + class] = states++;
+            state = delta[state * classes + class];
+        }
+        link[index] = own[state];       /* patterns ending here */
+        own[state] = index;
+    }
+
+    /*
+     * Visit the states breadth first, filling in failure states,
+     * missing transitions, and outputs.
+     */
+    fail = (unsigned int*)calloc (states, sizeof (unsigned int));
+    queue = (unsigned int*)malloc (states * sizeof (unsigned int));
+    out_first = (unsigned int*)calloc (states, sizeof (unsigned int));
+    out_count = (unsigned int*)calloc (states, sizeof (unsigned int));
+    if (fail == NULL || queue == NULL
+        || out_first == NULL || out_count == NULL)
+        goto done;
+    head = tail = 0;
+    for (class = 0; class < classes; class++) {
+        if (delta[class] != 0)
+            queue[tail++] = delta[class];   /* fail to the root */
+    }
+    while (head < tail) {
+        state = queue[head++];
+
+        /*
+         * This state's outputs: its own patterns, and then its
+         * failure state's.
+         */
+        out_first[state] = outputs;
+        for (index = own[state]; index >= 0; index = link[index]) {
+            if (outputs == allocated) {
+                allocated = allocated == 0 ? 64 : allocated * 2;
+                new_out = (int*)realloc (out, allocated * sizeof (int));
+                if (new_out == NULL)
+                    goto done;
+                out = new_out;
+            }
+            out[outputs++] = index;
+        }
+        for (index = 0; index < (int)out_count[fail[state]]; index++) {
+            if (outputs == allocated) {
+                allocated = allocated == 0 ? 64 : allocated * 2;
+                new_out = (int*)realloc (out, allocated * sizeof (int));
+                if (new_out == NULL)
+                    goto done;
+                out = new_out;
+            }
+            out[outputs++] = out[out_first[fail[state]] + index];
+        }
+        out_count[state] = outputs - out_first[state];
+
+        for (class = 0; class < classes; class++) {
+            target = delta[state * classes + class];
+            if (target != 0) {
+                fail[target] = delta[fail[state] * classes + class];
+                queue[tail++] = target;
+            } else
+                delta[state * classes + class]
+                    = delta[fail[state] * classes + class];
+        }
+    }
+
+    /*
+     * Turn the state numbers into row offsets, marking the
+     * transitions into output states.
+     */
+    for (offset = 0; offset < (size_t)states * classes; offset++) {
+        target = delta[offset];
+        delta[offset] = target * classes
+            | (out_count[target] != 0 ? ACSEARCH_OUTPUT : 0);
+    }
+    shrunk = (unsigned int*)realloc (
+        delta, (size_t)states * classes * sizeof (unsigned int));
+    search->delta = shrunk != NULL ? shrunk : delta;
+    delta = NULL;
+    search->classes = classes;
+    search->states = states;
+    search->out_first = out_first;
+    search->out_count = out_count;
+    search->out = out;
+    out_first = out_count = NULL;
+    out = NULL;
+    search->compiled = 1;
+    status = 0;
+
+  done:
+    free (delta);
+    free (own);
+    free (link);
+    free (fail);
+    free (queue);
+    free (out_first);
+    free (out_count);
+    free (out);
+    return status;
+}
+
+/*
+ * Initialize the record of a search, with no patterns matched.
+ */
+int acsearch_match_init (const acsearch_t *search, acsearch_match_t *match)
+{
+    if (search->valid != ACSEARCH_VALID || !search->compiled)
+        return EINVAL;
+
+    match->matched = (unsigned char*)calloc (
+        search->count > 0 ? search->count : 1, 1);
+    if (match->matched == NULL)
+        return ENOMEM;
+    match->state = 0;
+    match->remaining = search->count;
+    return 0;
+}
+
+/*
+ * Start a new search.
+ */
+void acsearch_match_reset (const acsearch_t *search, acsearch_match_t *match)
+{
+    memset (match->matched, 0, search->count);
+    match->state = 0;
+    match->remaining = search->count;
+}
+
+void acsearch_match_destroy (acsearch_match_t *match)
+{
+    free (match->matched);
+    match->matched = NULL;
+}
+
+/*
+ * Continue a search through "size" more bytes of text. Return the
+ * number of patterns that haven't matched yet; once they all have,
+ * the rest of the text isn't read.
+ */
+int acsearch_scan (const acsearch_t *search,
+    acsearch_match_t *match, const char *buffer, size_t size)
+{
+    const unsigned int *delta = search->delta;
+    const unsigned char *text = (const unsigned char*)buffer;
+    unsigned int state = match->state, first, count;
+    size_t offset;
+    int pattern;
+
+    if (match->remaining == 0)
+        return 0;
+    for (offset = 0; offset < size; offset++) {
+        state = delta[state + search->class[text[offset]]];
+        if (state & ACSEARCH_OUTPUT) {
+            state &= ~ACSEARCH_OUTPUT;
+            first = search->out_first[state / search->classes];
+            count = search->out_count[state / search->classes];
+            while (count-- > 0) {
+                pattern = search->out[first++];
+                if (!match->matched[pattern]) {
+                    match->matched[pattern] = 1;
+                    match->remaining--;
+                }
+            }
+            if (match->remaining == 0)
+                break;
+        }
+    }
+    match->state = state;
+    return match->remaining;
+}
+
+/*
+ * Search the file open on "fd" (which must be positioned at its
+ * start): map a regular file, or read it in blocks. The automaton's
+ * state carries across blocks, so they needn't overlap. Return 0,
+ * or an error number if the file can't be read.
+ */
+int acsearch_fd (const acsearch_t *search, acsearch_match_t *match, int fd)
+{
+    struct stat filestat;
+    char *buffer;
+    ssize_t bytes;
+    int status;
+
+    if (fstat (fd, &filestat) == 0 && S_ISREG (filestat.st_mode)
+        && filestat.st_size > 0) {
+        buffer = (char*)mmap (
+            NULL, filestat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buffer != MAP_FAILED) {
+            madvise (buffer, filestat.st_size, MADV_SEQUENTIAL);
+            acsearch_scan (search, match, buffer, filestat.st_size);
+            munmap (buffer, filestat.st_size);
+            return 0;
+        }
+    }
+
+    buffer = (char*)malloc (ACSEARCH_BLOCK);
+    if (buffer == NULL)
+        return errno;
+    while (match->remaining > 0) {
+        bytes = read (fd, buffer, ACSEARCH_BLOCK);
+        if (bytes < 0) {
+            if (errno == EINTR)
+                continue;
+            status = errno;
+            free (buffer);
+            return status;
+        }
+        if (bytes == 0)
+            break;
+        acsearch_scan (search, match, buffer, bytes);
+    }
+    free (buffer);
+    return 0;
+}
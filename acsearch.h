@@ -0,0 +1,85 @@
+/*
+ * acsearch.h
+ *
+ * This header file describes a multi-pattern searcher, based on
+ * the Aho-Corasick automaton, used by the crew program to search
+ * files for many strings in one pass.
+ *
+ * Patterns are added to an acsearch_t with acsearch_add(), and
+ * acsearch_compile() then builds the automaton: a deterministic
+ * state machine that reads the text one byte at a time and enters
+ * a state marked as "output" wherever one or more of the patterns
+ * ends. Once compiled, the automaton isn't changed by searching,
+ * so any number of threads may share it.
+ *
+ * The transition table is kept small: the bytes that appear in no
+ * pattern all behave alike, so the 256 byte values are mapped to
+ * "classes" (one for each distinct pattern byte, and one for all
+ * the rest), and each state has a row of transitions by class
+ * rather than by byte. States are stored as the offset of their
+ * row, so that a step is one table load with no multiply, and the
+ * output mark is kept in the transition itself, so that the inner
+ * loop touches nothing but the table.
+ *
+ * Each search keeps its own acsearch_match_t, recording the
+ * automaton's state and which patterns have matched. Since the
+ * state carries from one call of acsearch_scan() to the next, a
+ * text can be scanned in pieces of any size without missing a
+ * match that spans two of them.
+ */
+#ifndef __acsearch_h
+#define __acsearch_h
+#include <sys/types.h>
+
+#define ACSEARCH_OUTPUT 0x80000000U     /* transition to output state */
+#define ACSEARCH_BLOCK  (1024 * 1024)   /* bytes per read */
+
+/*
+ * Structure describing a multi-pattern searcher.
+ */
+typedef struct acsearch_tag {
+    int                 valid;          /* set when valid */
+    int                 compiled;       /* automaton built */
+    int                 count;          /* number of patterns */
+    int                 allocated;      /* size of pattern arrays */
+    char                **pattern;      /* copies of the patterns */
+    size_t              *length;
+    unsigned short      class[256];     /* byte to class */
+    int                 classes;        /* size of each row */
+    int                 states;
+    unsigned int        *delta;         /* states x classes */
+    unsigned int        *out_first;     /* state's outputs in out[] */
+    unsigned int        *out_count;
+    int                 *out;           /* pattern numbers */
+} acsearch_t;
+
+#define ACSEARCH_VALID  0xac5ea7
+
+/*
+ * The progress of one search.
+ */
+typedef struct acsearch_match_tag {
+    unsigned int        state;          /* current state (row offset) */
+    int                 remaining;      /* patterns not yet matched */
+    unsigned char       *matched;       /* one flag per pattern */
+} acsearch_match_t;
+
+/*
+ * Define multi-pattern searcher functions
+ */
+extern int acsearch_init (acsearch_t *search);
+extern int acsearch_destroy (acsearch_t *search);
+extern int acsearch_add (
+    acsearch_t *search, const char *pattern, size_t length);
+extern int acsearch_compile (acsearch_t *search);
+extern int acsearch_match_init (
+    const acsearch_t *search, acsearch_match_t *match);
+extern void acsearch_match_reset (
+    const acsearch_t *search, acsearch_match_t *match);
+extern void acsearch_match_destroy (acsearch_match_t *match);
+extern int acsearch_scan (const acsearch_t *search,
+    acsearch_match_t *match, const char *buffer, size_t size);
+extern int acsearch_fd (
+    const acsearch_t *search, acsearch_match_t *match, int fd);
+
+#endif
@@ -5,8 +5,8 @@
  *
  * A barrier causes threads to wait until a set of threads has
  * all "reached" the barrier. The number of threads required is
- * set when the barrier is initialized, and cannot be changed
- * except by reinitializing.
+ * set when the barrier is initialized, but threads may join or
+ * leave later (see the phaser functions below).
  *
  * The barrier_init() and barrier_destroy() functions,
  * respectively, allow you to initialize and destroy the
@@ -19,11 +19,233 @@
  * status makes it easy for the calling code to cause one thread
  * to do something in a serial region before entering another
  * parallel section of code.
+ *
+ * barrier_wait_reduce() is barrier_wait() with a reduction:
+ * each thread contributes a value, which is combined (under the
+ * mutex, as the thread arrives) with those of the threads before
+ * it, and every thread gets the combined result when the barrier
+ * completes. barrier_op_sum(), barrier_op_min(), and
+ * barrier_op_max() are predefined operations; any associative and
+ * commutative function of two doubles will do.
+ *
+ * barrier_timedwait() is barrier_wait() with an absolute timeout,
+ * measured against CLOCK_MONOTONIC. A thread whose wait times out
+ * "breaks" the barrier, and returns ETIMEDOUT; barrier_break() does
+ * the same on demand (when a participant has failed, for example).
+ * Breaking the barrier releases every thread waiting on it with
+ * the status ECANCELED, and while it stays broken, every wait or
+ * arrival fails at once with ECANCELED, so that a computation
+ * whose threads would otherwise wait forever for a lost partner
+ * can fail quickly instead. barrier_reset() repairs the barrier
+ * for a new start (breaking it first, if threads are waiting).
+ *
+ * When compiled with -DBARRIER_STATS, the arrival and wait paths
+ * record arrival statistics (see barrier.h), which
+ * barrier_stats_dump() prints. Participants are told apart by
+ * pthread_self(); the first BARRIER_STATS_THREADS threads to
+ * arrive are tracked individually. barrier_arrive() notes the
+ * time and phase of its arrival in the party's slot (and the slot
+ * in its token), and whichever of barrier_await() and
+ * barrier_await_phase() finds the phase ended charges the wait,
+ * so that barrier_await() still needn't take the mutex when the
+ * phase has already ended. Without BARRIER_STATS the hooks below
+ * expand to nothing.
+ *
+ * The phaser functions treat each cycle of the barrier as a
+ * "phase", numbered by the barrier's cycle count:
+ *
+ * barrier_register() adds a party to the barrier. The new party
+ * takes part in the current phase, whose number it returns.
+ *
+ * barrier_arrive() records the calling party's arrival at the
+ * current phase without waiting for the others, and fills in a
+ * token (the phase number, and whether this arrival ended the
+ * phase). The party is free to do local work, then calls
+ * barrier_await() with the token, which blocks only if the phase
+ * hasn't ended yet; this "split-phase" wait lets a thread overlap
+ * its own work with the wait for stragglers. The party must
+ * await a phase before it arrives at a later one.
+ *
+ * barrier_arrive_and_deregister() arrives, and removes the
+ * calling party from the barrier. Later phases wait for one
+ * fewer party.
+ *
+ * barrier_await_phase() waits until the given phase has ended
+ * (and returns at once if it already has).
+ *
+ * Arrival functions return -1 to the party whose arrival ends a
+ * phase, like barrier_wait(), and so does barrier_await() when
+ * given that party's token.
  */
+#define _GNU_SOURCE                     /* for pthread_cond_clockwait */
 #include <pthread.h>
 #include "errors.h"
 #include "barrier.h"
 
+#ifdef BARRIER_STATS
+static unsigned long long barrier_stats_now (void)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * Find the calling thread's participant slot, or return
+ * stats->participants if it has none. Called with the mutex
+ * locked.
+ */
+static int barrier_stats_slot (barrier_t *barrier)
+{
+    barrier_stats_t *stats = &barrier->stats;
+    pthread_t self = pthread_self ();
+    int slot;
+
+    for (slot = 0; slot < stats->participants; slot++) {
+        if (pthread_equal (stats->participant[slot].thread, self))
+            break;
+    }
+    return slot;
+}
+
+/*
+ * Record an arrival, and return the arriving thread's participant
+ * slot (or -1, if the table is full). The arrival time is returned
+ * in "now". Called with the mutex locked.
+ */
+static int barrier_stats_arrive (barrier_t *barrier, unsigned long long *now)
+{
+    barrier_stats_t *stats = &barrier->stats;
+    int slot;
+
+    *now = barrier_stats_now ();
+    if (stats->arrived++ == 0)
+        stats->first_ns = *now;
+    slot = barrier_stats_slot (barrier);
+    if (slot == stats->participants) {
+        if (slot == BARRIER_STATS_THREADS)
+            return -1;
+        stats->participant[slot].thread = pthread_self ();
+        stats->participants++;
+    }
+    stats->participant[slot].arrivals++;
+    return slot;
+}
+
+/*
+ * Record the end of a cycle, on the arrival of participant "slot"
+ * at "now". Called with the mutex locked, before the cycle count
+ * advances.
+ */
+static void barrier_stats_complete (
+    barrier_t *barrier, int slot, unsigned long long now)
+{
+    barrier_stats_t *stats = &barrier->stats;
+    barrier_cycle_t *entry;
+    unsigned long long spread = now - stats->first_ns;
+
+    entry = &stats->ring[stats->cycles % BARRIER_STATS_RING];
+    entry->cycle = barrier->cycle;
+    entry->spread_ns = spread;
+    entry->last = slot;
+    stats->end_ns = now;
+    stats->cycles++;
+    stats->spread_total += spread;
+    if (spread > stats->spread_max)
+        stats->spread_max = spread;
+    if (slot >= 0)
+        stats->participant[slot].last++;
+    stats->arrived = 0;
+}
+
+/*
+ * Charge participant "slot" a wait that began at "start" and
+ * ended at "end". Only the participant's own thread charges it,
+ * but barrier_await() does so without the mutex, so the totals
+ * are updated (and read by barrier_stats_dump()) atomically.
+ */
+static void barrier_stats_charge (barrier_t *barrier,
+    int slot, unsigned long long start, unsigned long long end)
+{
+    barrier_participant_t *participant;
+
+    if (slot < 0)
+        return;
+    participant = &barrier->stats.participant[slot];
+    __atomic_fetch_add (&participant->waits, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add (&participant->wait_ns,
+        end > start ? end - start : 0, __ATOMIC_RELAXED);
+}
+
+/*
+ * Record the end of a wait that began at "start". Called with the
+ * mutex locked.
+ */
+static void barrier_stats_waited (
+    barrier_t *barrier, int slot, unsigned long long start)
+{
+    barrier_stats_charge (barrier, slot, start, barrier_stats_now ());
+}
+
+/*
+ * Note a split-phase arrival at "phase", to be charged when it's
+ * awaited. Called with the mutex locked.
+ */
+static void barrier_stats_pending (barrier_t *barrier,
+    int slot, unsigned long long start, unsigned long phase)
+{
+    if (slot < 0)
+        return;
+    barrier->stats.participant[slot].arrived_ns = start;
+    barrier->stats.participant[slot].arrived_phase = phase;
+}
+
+/*
+ * Charge the wait for participant "slot"'s arrival at "phase", if
+ * it's still pending: to the end of the phase if it "ended", or
+ * else (the barrier was broken) to now. Called by the participant,
+ * either with the mutex locked or after seeing that the phase
+ * ended; either way, stats->end_ns is that phase's end, since the
+ * next can't end until the participant arrives again.
+ */
+static void barrier_stats_awaited (barrier_t *barrier,
+    int slot, unsigned long phase, int ended)
+{
+    barrier_participant_t *participant;
+    unsigned long long start;
+
+    if (slot < 0 || slot >= BARRIER_STATS_THREADS)
+        return;
+    participant = &barrier->stats.participant[slot];
+    start = participant->arrived_ns;
+    if (start == 0 || participant->arrived_phase != phase)
+        return;
+    participant->arrived_ns = 0;
+    barrier_stats_charge (barrier, slot, start,
+        ended ? barrier->stats.end_ns : barrier_stats_now ());
+}
+
+# define STATS_DECL(slot, start)        int slot; unsigned long long start
+# define STATS_ARRIVE(b, slot, start) \
+    (slot) = barrier_stats_arrive (b, &(start))
+# define STATS_COMPLETE(b, slot, start) barrier_stats_complete (b, slot, start)
+# define STATS_WAITED(b, slot, start)   barrier_stats_waited (b, slot, start)
+# define STATS_PENDING(b, slot, start, phase) \
+    barrier_stats_pending (b, slot, start, phase)
+# define STATS_AWAITED(b, slot, phase, ended) \
+    barrier_stats_awaited (b, slot, phase, ended)
+# define STATS_BROKEN(b)                ((b)->stats.arrived = 0)
+#else
+# define STATS_DECL(slot, start)
+# define STATS_ARRIVE(b, slot, start)
+# define STATS_COMPLETE(b, slot, start)
+# define STATS_WAITED(b, slot, start)
+# define STATS_PENDING(b, slot, start, phase)
+# define STATS_AWAITED(b, slot, phase, ended)
+# define STATS_BROKEN(b)
+#endif
+
 /*
  * Initialize a barrier for use.
  */
@@ -33,6 +255,13 @@ int barrier_init (barrier_t *barrier, int count)
 
     barrier->threshold = barrier->counter = count;
     barrier->cycle = 0;
+    barrier->reduced = 0;
+    barrier->accum = barrier->result = 0.0;
+    barrier->broken = 0;
+    barrier->broken_cycle = ~0UL;
+#ifdef BARRIER_STATS
+    memset (&barrier->stats, 0, sizeof (barrier->stats));
+#endif
     status = pthread_mutex_init (&barrier->mutex, NULL);
     if (status != 0)
         return status;
@@ -83,13 +312,52 @@ int barrier_destroy (barrier_t *barrier)
 }
 
 /*
- * Wait for all members of a barrier to reach the barrier. When
- * the count (of remaining members) reaches 0, broadcast to wake
- * all threads waiting.
+ * End the current phase: start the next, and wake any threads
+ * waiting. Call with the mutex locked. The cycle count is stored
+ * atomically because barrier_await() reads it without the mutex.
  */
-int barrier_wait (barrier_t *barrier)
+static int barrier_advance (barrier_t *barrier)
+{
+    __atomic_store_n (&barrier->cycle, barrier->cycle + 1, __ATOMIC_RELEASE);
+    barrier->counter = barrier->threshold;
+    barrier->result = barrier->accum;
+    barrier->reduced = 0;
+    return pthread_cond_broadcast (&barrier->cv);
+}
+
+/*
+ * Break the barrier: release the current cycle's waiters, which
+ * will see that their cycle was broken, and fail any later waits
+ * until the barrier is reset. Call with the mutex locked.
+ */
+static int barrier_break_locked (barrier_t *barrier)
+{
+    if (barrier->broken)
+        return 0;
+    barrier->broken = 1;
+    __atomic_store_n (&barrier->broken_cycle, barrier->cycle, __ATOMIC_RELAXED);
+    __atomic_store_n (&barrier->cycle, barrier->cycle + 1, __ATOMIC_RELEASE);
+    barrier->counter = barrier->threshold;
+    barrier->reduced = 0;
+    STATS_BROKEN (barrier);
+    return pthread_cond_broadcast (&barrier->cv);
+}
+
+/*
+ * Wait for all members of a barrier to reach the barrier,
+ * combining "value" into the reduction (unless "op" is NULL), and
+ * giving up at "abstime" (unless NULL). When the count (of
+ * remaining members) reaches 0, broadcast to wake all threads
+ * waiting; each then gets the reduction in "result" (if not
+ * NULL).
+ */
+static int barrier_wait_common (
+    barrier_t *barrier, const struct timespec *abstime,
+    double value, barrier_op_t op, double *result)
 {
-    int status, cancel, tmp, cycle;
+    unsigned long cycle;
+    int status, cancel, tmp;
+    STATS_DECL (slot, start);
 
     if (barrier->valid != BARRIER_VALID)
         return EINVAL;
@@ -98,12 +366,23 @@ int barrier_wait (barrier_t *barrier)
     if (status != 0)
         return status;
 
+    if (barrier->broken) {
+        pthread_mutex_unlock (&barrier->mutex);
+        return ECANCELED;
+    }
+
     cycle = barrier->cycle;   /* Remember which cycle we're on */
+    STATS_ARRIVE (barrier, slot, start);
+
+    if (op != NULL) {
+        barrier->accum = barrier->reduced++ == 0
+            ? value : op (barrier->accum, value);
+    }
 
     if (--barrier->counter == 0) {
-        barrier->cycle++;
-        barrier->counter = barrier->threshold;
-        status = pthread_cond_broadcast (&barrier->cv);
+        STATS_COMPLETE (barrier, slot, start);
+        STATS_WAITED (barrier, slot, start);
+        status = barrier_advance (barrier);
         /*
          * The last thread into the barrier will return status
          * -1 rather than 0, so that it can be used to perform
@@ -120,17 +399,46 @@ int barrier_wait (barrier_t *barrier)
 
         /*
          * Wait until the barrier's cycle changes, which means
-         * that it has been broadcast, and we don't want to wait
-         * anymore.
+         * that it has been broadcast (or broken), and we don't
+         * want to wait anymore.
          */
         while (cycle == barrier->cycle) {
-            status = pthread_cond_wait (
-                    &barrier->cv, &barrier->mutex);
+            if (abstime == NULL)
+                status = pthread_cond_wait (
+                        &barrier->cv, &barrier->mutex);
+            else
+                status = pthread_cond_clockwait (
+                        &barrier->cv, &barrier->mutex,
+                        CLOCK_MONOTONIC, abstime);
             if (status != 0) break;
         }
 
+        /*
+         * If we timed out, and the cycle still hasn't completed,
+         * break the barrier so that the other threads don't wait
+         * forever either. (If the cycle completed as we timed
+         * out, the wait succeeded after all.)
+         */
+        if (status == ETIMEDOUT) {
+            if (cycle == barrier->cycle)
+                barrier_break_locked (barrier);
+            else
+                status = 0;
+        }
+        if (status == 0 && barrier->broken_cycle == cycle)
+            status = ECANCELED;
+        STATS_WAITED (barrier, slot, start);
+
         pthread_setcancelstate (cancel, &tmp);
     }
+
+    /*
+     * The result can't change until this thread arrives at the
+     * next cycle, so it's safe to read once awakened.
+     */
+    if (result != NULL && status <= 0)
+        *result = barrier->result;
+
     /*
      * Ignore an error in unlocking. It shouldn't happen, and
      * reporting it here would be misleading -- the barrier wait
@@ -142,3 +450,323 @@ int barrier_wait (barrier_t *barrier)
     pthread_mutex_unlock (&barrier->mutex);
     return status;          /* error, -1 for waker, or 0 */
 }
+
+/*
+ * Wait for all members of a barrier to reach the barrier.
+ */
+int barrier_wait (barrier_t *barrier)
+{
+    return barrier_wait_common (barrier, NULL, 0.0, NULL, NULL);
+}
+
+/*
+ * Wait for all members of a barrier to reach the barrier, or
+ * until the absolute (CLOCK_MONOTONIC) time "abstime".
+ */
+int barrier_timedwait (barrier_t *barrier, const struct timespec *abstime)
+{
+    return barrier_wait_common (barrier, abstime, 0.0, NULL, NULL);
+}
+
+/*
+ * Wait for all members of a barrier to reach the barrier, with a
+ * reduction.
+ */
+int barrier_wait_reduce (
+    barrier_t *barrier, double value, barrier_op_t op, double *result)
+{
+    return barrier_wait_common (barrier, NULL, value, op, result);
+}
+
+/*
+ * Break the barrier.
+ */
+int barrier_break (barrier_t *barrier)
+{
+    int status, status2;
+
+    if (barrier->valid != BARRIER_VALID)
+        return EINVAL;
+
+    status = pthread_mutex_lock (&barrier->mutex);
+    if (status != 0)
+        return status;
+    status = barrier_break_locked (barrier);
+    status2 = pthread_mutex_unlock (&barrier->mutex);
+    return (status != 0 ? status : status2);
+}
+
+/*
+ * Repair a broken barrier, so that the next cycle starts afresh
+ * with all registered parties. Threads still waiting on an
+ * unbroken barrier are released with ECANCELED.
+ */
+int barrier_reset (barrier_t *barrier)
+{
+    int status, status2;
+
+    if (barrier->valid != BARRIER_VALID)
+        return EINVAL;
+
+    status = pthread_mutex_lock (&barrier->mutex);
+    if (status != 0)
+        return status;
+    if (barrier->counter != barrier->threshold)
+        status = barrier_break_locked (barrier);
+    barrier->broken = 0;
+    barrier->counter = barrier->threshold;
+    barrier->reduced = 0;
+    status2 = pthread_mutex_unlock (&barrier->mutex);
+    return (status != 0 ? status : status2);
+}
+
+/*
+ * Add a party to the barrier, which must arrive at the current
+ * phase before it can end.
+ */
+int barrier_register (barrier_t *barrier, unsigned long *phase)
+{
+    int status;
+
+    if (barrier->valid != BARRIER_VALID)
+        return EINVAL;
+
+    status = pthread_mutex_lock (&barrier->mutex);
+    if (status != 0)
+        return status;
+    barrier->threshold++;
+    barrier->counter++;
+    if (phase != NULL)
+        *phase = barrier->cycle;
+    return pthread_mutex_unlock (&barrier->mutex);
+}
+
+/*
+ * Arrive at the current phase, without waiting for the other
+ * parties. The token (if not NULL) records the phase arrived at,
+ * for barrier_await().
+ */
+int barrier_arrive (barrier_t *barrier, barrier_token_t *token)
+{
+    int status, status2;
+    STATS_DECL (slot, start);
+
+    if (barrier->valid != BARRIER_VALID)
+        return EINVAL;
+
+    status = pthread_mutex_lock (&barrier->mutex);
+    if (status != 0)
+        return status;
+    if (barrier->broken) {
+        pthread_mutex_unlock (&barrier->mutex);
+        return ECANCELED;
+    }
+    if (token != NULL) {
+        token->phase = barrier->cycle;
+        token->serial = 0;
+    }
+    STATS_ARRIVE (barrier, slot, start);
+    STATS_PENDING (barrier, slot, start, barrier->cycle);
+#ifdef BARRIER_STATS
+    if (token != NULL)
+        token->slot = slot;
+#endif
+    if (--barrier->counter == 0) {
+        STATS_COMPLETE (barrier, slot, start);
+        status = barrier_advance (barrier);
+        if (status == 0) {
+            status = -1;
+            if (token != NULL)
+                token->serial = 1;
+        }
+    }
+    status2 = pthread_mutex_unlock (&barrier->mutex);
+    return (status != 0 ? status : status2);
+}
+
+/*
+ * Arrive at the current phase, and leave the barrier.
+ */
+int barrier_arrive_and_deregister (barrier_t *barrier)
+{
+    int status, status2;
+    STATS_DECL (slot, start);
+
+    if (barrier->valid != BARRIER_VALID)
+        return EINVAL;
+
+    status = pthread_mutex_lock (&barrier->mutex);
+    if (status != 0)
+        return status;
+    if (barrier->threshold < 1) {
+        pthread_mutex_unlock (&barrier->mutex);
+        return EINVAL;
+    }
+    barrier->threshold--;
+
+    /*
+     * Leaving a broken barrier needs no arrival; barrier_reset()
+     * starts the next cycle with the remaining parties.
+     */
+    if (barrier->broken)
+        status = 0;
+    else {
+        STATS_ARRIVE (barrier, slot, start);
+        if (--barrier->counter == 0) {
+            /*
+             * If that was the last party, the next phase has none,
+             * and can't end until someone registers.
+             */
+            STATS_COMPLETE (barrier, slot, start);
+            status = barrier_advance (barrier);
+            if (status == 0)
+                status = -1;
+        }
+        STATS_WAITED (barrier, slot, start);
+    }
+    status2 = pthread_mutex_unlock (&barrier->mutex);
+    return (status != 0 ? status : status2);
+}
+
+/*
+ * Wait for the given phase to end. Phases are compared modulo the
+ * range of the cycle count, so that waits work across wraparound.
+ * If the phase was broken (or the barrier is broken while
+ * waiting), return ECANCELED.
+ */
+int barrier_await_phase (barrier_t *barrier, unsigned long phase)
+{
+    int status = 0, cancel, tmp;
+
+    if (barrier->valid != BARRIER_VALID)
+        return EINVAL;
+
+    status = pthread_mutex_lock (&barrier->mutex);
+    if (status != 0)
+        return status;
+
+    /*
+     * Wait with cancellation disabled, as in barrier_wait().
+     */
+    pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, &cancel);
+    while ((long)(barrier->cycle - phase) <= 0 && !barrier->broken) {
+        status = pthread_cond_wait (&barrier->cv, &barrier->mutex);
+        if (status != 0)
+            break;
+    }
+    if (status == 0
+        && ((long)(barrier->cycle - phase) <= 0
+            || barrier->broken_cycle == phase))
+        status = ECANCELED;
+    STATS_AWAITED (barrier, barrier_stats_slot (barrier), phase, status == 0);
+    pthread_setcancelstate (cancel, &tmp);
+    pthread_mutex_unlock (&barrier->mutex);
+    return status;
+}
+
+/*
+ * Complete a split-phase wait begun by barrier_arrive(). If the
+ * phase has already ended, as it has for the party that ended it,
+ * return without taking the mutex.
+ */
+int barrier_await (barrier_t *barrier, barrier_token_t *token)
+{
+    int status;
+
+    if (barrier->valid != BARRIER_VALID)
+        return EINVAL;
+
+    if ((long)(__atomic_load_n (&barrier->cycle, __ATOMIC_ACQUIRE)
+            - token->phase) <= 0) {
+        status = barrier_await_phase (barrier, token->phase);
+        if (status != 0)
+            return status;
+    } else if (__atomic_load_n (&barrier->broken_cycle, __ATOMIC_RELAXED)
+            == token->phase) {
+        STATS_AWAITED (barrier, token->slot, token->phase, 0);
+        return ECANCELED;
+    }
+    STATS_AWAITED (barrier, token->slot, token->phase, 1);
+    return token->serial ? -1 : 0;
+}
+
+/*
+ * Print the barrier's arrival statistics: the mean and maximum
+ * spread between the first and last arrivals of a cycle, each
+ * participant's arrivals, average wait, and how often it was
+ * last, and the spread of the most recent cycles. Without
+ * BARRIER_STATS, return ENOSYS.
+ */
+int barrier_stats_dump (barrier_t *barrier, FILE *out)
+{
+#ifdef BARRIER_STATS
+    barrier_stats_t *stats;
+    barrier_participant_t *participant;
+    barrier_cycle_t *entry;
+    unsigned long first, index, waits;
+    unsigned long long wait_ns;
+    int slot, status;
+
+    if (barrier->valid != BARRIER_VALID)
+        return EINVAL;
+
+    status = pthread_mutex_lock (&barrier->mutex);
+    if (status != 0)
+        return status;
+    stats = &barrier->stats;
+
+    fprintf (out, "%lu cycles, spread mean %.1f us, max %.1f us\n",
+        stats->cycles,
+        stats->cycles == 0 ? 0.0
+        : (double)stats->spread_total / stats->cycles / 1000.0,
+        (double)stats->spread_max / 1000.0);
+    for (slot = 0; slot < stats->participants; slot++) {
+        participant = &stats->participant[slot];
+        waits = __atomic_load_n (&participant->waits, __ATOMIC_RELAXED);
+        wait_ns = __atomic_load_n (&participant->wait_ns, __ATOMIC_RELAXED);
+        fprintf (out,
+            "  [%02d] thread %#lx: %lu arrivals, wait %.1f us avg, "
+            "last %lu times\n",
+            slot, (unsigned long)participant->thread,
+            participant->arrivals,
+            waits == 0 ? 0.0 : (double)wait_ns / waits / 1000.0,
+            participant->last);
+    }
+
+    first = stats->cycles > BARRIER_STATS_RING
+        ? stats->cycles - BARRIER_STATS_RING : 0;
+    if (first < stats->cycles)
+        fprintf (out, "  recent cycles:\n");
+    for (index = first; index < stats->cycles; index++) {
+        entry = &stats->ring[index % BARRIER_STATS_RING];
+        if (entry->last < 0)
+            fprintf (out, "    cycle %lu: spread %.1f us\n",
+                entry->cycle, (double)entry->spread_ns / 1000.0);
+        else
+            fprintf (out, "    cycle %lu: spread %.1f us, last [%02d]\n",
+                entry->cycle, (double)entry->spread_ns / 1000.0,
+                entry->last);
+    }
+    return pthread_mutex_unlock (&barrier->mutex);
+#else
+    return ENOSYS;
+#endif
+}
+
+/*
+ * Predefined reduction operations.
+ */
+double barrier_op_sum (double a, double b)
+{
+    return a + b;
+}
+
+double barrier_op_min (double a, double b)
+{
+    return a < b ? a : b;
+}
+
+double barrier_op_max (double a, double b)
+{
+    return a > b ? a : b;
+}
@@ -8,10 +8,85 @@
  *
  * A barrier causes threads to wait until a set of threads has
  * all "reached" the barrier. The number of threads required is
- * set when the barrier is initialized, and cannot be changed
- * except by reinitializing.
+ * set when the barrier is initialized.
+ *
+ * The barrier can also be used as a "phaser", whose set of
+ * threads (parties) changes while it is in use: threads join
+ * with barrier_register() and leave with
+ * barrier_arrive_and_deregister(). Each completed cycle ends a
+ * phase; the barrier's cycle count is the current phase number.
+ * barrier_arrive() records a party's arrival without waiting,
+ * returning a token that barrier_await() uses to finish the wait
+ * later (a "split-phase" barrier), and barrier_await_phase() waits
+ * for a given phase to end.
+ *
+ * barrier_wait_reduce() also combines a value from each thread,
+ * using a sum, min, max, or user-supplied operation, and gives
+ * every thread the result.
+ *
+ * A barrier can be "broken", by a barrier_timedwait() that times
+ * out or by a call to barrier_break(). All threads waiting on a
+ * broken barrier, and any that arrive later, return ECANCELED
+ * until the barrier is repaired with barrier_reset().
+ *
+ * When compiled with -DBARRIER_STATS, each barrier also records
+ * how its participants arrive: the spread between the first and
+ * last arrival of each cycle, and each thread's average wait and
+ * how often it was last (a straggler). Every arrival counts one
+ * wait, which for a split-phase wait runs from the arrival to the
+ * end of the phase, and is zero for the party that ends a cycle
+ * (or leaves the barrier). barrier_stats_dump()
+ * prints the totals and the most recent cycles. Without
+ * BARRIER_STATS, none of that code or data is compiled in.
  */
+#ifndef __barrier_h
+#define __barrier_h
 #include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifdef BARRIER_STATS
+#define BARRIER_STATS_THREADS   64      /* participants tracked */
+#define BARRIER_STATS_RING      16      /* recent cycles kept */
+
+/*
+ * Arrival statistics for one participating thread.
+ */
+typedef struct barrier_participant_tag {
+    pthread_t           thread;
+    unsigned long       arrivals;
+    unsigned long       waits;          /* waits completed */
+    unsigned long long  wait_ns;        /* total time waiting */
+    unsigned long       last;           /* times last to arrive */
+    unsigned long long  arrived_ns;     /* split-phase arrival, or 0 */
+    unsigned long       arrived_phase;  /* ... at this phase */
+} barrier_participant_t;
+
+/*
+ * Record of one completed cycle.
+ */
+typedef struct barrier_cycle_tag {
+    unsigned long       cycle;
+    unsigned long long  spread_ns;      /* first to last arrival */
+    int                 last;           /* participant last, or -1 */
+} barrier_cycle_t;
+
+typedef struct barrier_stats_tag {
+    unsigned long long  first_ns;       /* first arrival this cycle */
+    unsigned long long  end_ns;         /* when the last cycle ended */
+    int                 arrived;        /* arrivals this cycle */
+    int                 participants;   /* entries in participant[] */
+    unsigned long       cycles;         /* cycles completed */
+    unsigned long long  spread_total;
+    unsigned long long  spread_max;
+    barrier_participant_t participant[BARRIER_STATS_THREADS];
+    barrier_cycle_t     ring[BARRIER_STATS_RING]; /* recent cycles */
+} barrier_stats_t;
+
+# define BARRIER_STATS_INITIALIZER      , {0}
+#else
+# define BARRIER_STATS_INITIALIZER
+#endif
 
 /*
  * Structure describing a barrier.
@@ -23,16 +98,43 @@ typedef struct barrier_tag {
     int                 threshold;      /* number of threads required */
     int                 counter;        /* current number of threads */
     unsigned long       cycle;          /* count cycles */
+    int                 reduced;        /* values combined this cycle */
+    double              accum;          /* reduction in progress */
+    double              result;         /* last cycle's reduction */
+    int                 broken;         /* set by timeout or break */
+    unsigned long       broken_cycle;   /* last cycle broken */
+#ifdef BARRIER_STATS
+    barrier_stats_t     stats;          /* arrival statistics */
+#endif
 } barrier_t;
 
 #define BARRIER_VALID   0xdbcafe
 
+/*
+ * Token for a split-phase wait, from barrier_arrive().
+ */
+typedef struct barrier_token_tag {
+    unsigned long       phase;          /* phase arrived at */
+    int                 serial;         /* this arrival ended it */
+#ifdef BARRIER_STATS
+    int                 slot;           /* participant, or -1 */
+#endif
+} barrier_token_t;
+
+/*
+ * Reduction operation for barrier_wait_reduce(). It must be
+ * associative and commutative, since values are combined in
+ * whatever order the threads arrive.
+ */
+typedef double (*barrier_op_t)(double a, double b);
+
 /*
  * Support static initialization of barriers
  */
 #define BARRIER_INITIALIZER(cnt) \
     {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, \
-    BARRIER_VALID, cnt, cnt, 0}
+    BARRIER_VALID, cnt, cnt, 0, 0, 0.0, 0.0, 0, ~0UL \
+    BARRIER_STATS_INITIALIZER}
 
 /*
  * Define barrier functions
@@ -40,3 +142,20 @@ typedef struct barrier_tag {
 extern int barrier_init (barrier_t *barrier, int count);
 extern int barrier_destroy (barrier_t *barrier);
 extern int barrier_wait (barrier_t *barrier);
+extern int barrier_timedwait (
+    barrier_t *barrier, const struct timespec *abstime);
+extern int barrier_break (barrier_t *barrier);
+extern int barrier_reset (barrier_t *barrier);
+extern int barrier_register (barrier_t *barrier, unsigned long *phase);
+extern int barrier_arrive (barrier_t *barrier, barrier_token_t *token);
+extern int barrier_arrive_and_deregister (barrier_t *barrier);
+extern int barrier_await_phase (barrier_t *barrier, unsigned long phase);
+extern int barrier_await (barrier_t *barrier, barrier_token_t *token);
+extern int barrier_wait_reduce (
+    barrier_t *barrier, double value, barrier_op_t op, double *result);
+extern int barrier_stats_dump (barrier_t *barrier, FILE *out);
+extern double barrier_op_sum (double a, double b);
+extern double barrier_op_min (double a, double b);
+extern double barrier_op_max (double a, double b);
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * barrier_bench.c
+ *
+ * Measure how barrier latency scales with the number of threads,
+ * for the mutex barrier in barrier.c, the spin barrier in
+ * spin_barrier.c, and the tree barrier in tree_barrier.c.
+ *
+ * For thread counts from 1, doubling up to the maximum, the
+ * threads pass through CYCLES barrier cycles with no work in
+ * between, and the average time per cycle is reported.
+ *
+ * Usage: barrier_bench [max_threads [cycles]]
+ *
+ * The default maximum is twice the number of online processors.
+ * Beyond one thread per processor, waiting threads must park, so
+ * that part of the sweep measures the futex (or condition
+ * variable) path rather than spinning.
+ */
+#include <pthread.h>
+#include <time.h>
+#include "barrier.h"
+#include "spin_barrier.h"
+#include "tree_barrier.h"
+#include "errors.h"
+
+#define CYCLES          10000
+
+#define MUTEX           0
+#define SPIN            1
+#define TREE            2
+
+/*
+ * Keep track of each thread.
+ */
+typedef struct thread_tag {
+    pthread_t           thread_id;
+    int                 id;
+} thread_t;
+
+barrier_t barrier;
+spin_barrier_t spin_barrier;
+tree_barrier_t tree_barrier;
+int type;                               /* barrier for this run */
+int cycles = CYCLES;
+struct timespec start, end;
+
+static int wait_barrier (int id)
+{
+    switch (type) {
+    case SPIN:
+        return spin_barrier_wait (&spin_barrier);
+    case TREE:
+        return tree_barrier_wait (&tree_barrier, id);
+    default:
+        return barrier_wait (&barrier);
+    }
+}
+
+/*
+ * Thread start routine: pass through the barrier "cycles" times.
+ * Thread 0 times the run, starting after a first cycle that gets
+ * all the threads going.
+ */
+void *thread_routine (void *arg)
+{
+    thread_t *self = (thread_t*)arg;
+    int cycle, status;
+
+    status = wait_barrier (self->id);
+    if (status > 0)
+        err_abort (status, "Wait on barrier");
+    if (self->id == 0)
+        clock_gettime (CLOCK_MONOTONIC, &start);
+    for (cycle = 0; cycle < cycles; cycle++) {
+        status = wait_barrier (self->id);
+        if (status > 0)
+            err_abort (status, "Wait on barrier");
+    }
+    if (self->id == 0)
+        clock_gettime (CLOCK_MONOTONIC, &end);
+    return NULL;
+}
+
+/*
+ * Time one barrier type with "threads" threads, and return the
+ * nanoseconds per cycle.
+ */
+static double run (int threads)
+{
+    thread_t *thread;
+    int index, status;
+
+    switch (type) {
+    case SPIN:
+        status = spin_barrier_init (&spin_barrier, threads);
+        break;
+    case TREE:
+        status = tree_barrier_init (&tree_barrier, threads);
+        break;
+    default:
+        status = barrier_init (&barrier, threads);
+        break;
+    }
+    if (status != 0)
+        err_abort (status, "Init barrier");
+
+    thread = (thread_t*)calloc (threads, sizeof (thread_t));
+    if (thread == NULL)
+        errno_abort ("Allocate threads");
+    for (index = 0; index < threads; index++) {
+        thread[index].id = index;
+        status = pthread_create (&thread[index].thread_id,
+            NULL, thread_routine, (void*)&thread[index]);
+        if (status != 0)
+            err_abort (status, "Create thread");
+    }
+    for (index = 0; index < threads; index++) {
+        status = pthread_join (thread[index].thread_id, NULL);
+        if (status != 0)
+            err_abort (status, "Join thread");
+    }
+    free (thread);
+
+    switch (type) {
+    case SPIN:
+        status = spin_barrier_destroy (&spin_barrier);
+        break;
+    case TREE:
+        status = tree_barrier_destroy (&tree_barrier);
+        break;
+    default:
+        status = barrier_destroy (&barrier);
+        break;
+    }
+    if (status != 0)
+        err_abort (status, "Destroy barrier");
+
+    return ((end.tv_sec - start.tv_sec) * 1e9
+        + (end.tv_nsec - start.tv_nsec)) / cycles;
+}
+
+int main (int argc, char *argv[])
+{
+    int max_threads, threads;
+
+    max_threads = 2 * (int)sysconf (_SC_NPROCESSORS_ONLN);
+    if (argc > 1)
+        max_threads = atoi (argv[1]);
+    if (argc > 2)
+        cycles = atoi (argv[2]);
+    if (max_threads < 1 || cycles < 1) {
+        fprintf (stderr, "Usage: %s [max_threads [cycles]]\n", argv[0]);
+        return -1;
+    }
+
+    printf ("%ld processors, %d cycles per run, ns per cycle\n",
+        sysconf (_SC_NPROCESSORS_ONLN), cycles);
+    printf ("%7s %12s %12s %12s\n", "threads", "mutex", "spin", "tree");
+    for (threads = 1; ; threads *= 2) {
+        if (threads > max_threads)
+            threads = max_threads;
+        printf ("%7d", threads);
+        for (type = MUTEX; type <= TREE; type++)
+            printf (" %12.0f", run (threads));
+        printf ("\n");
+        fflush (stdout);
+        if (threads == max_threads)
+            break;
+    }
+    return 0;
+}
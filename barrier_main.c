@@ -2,16 +2,76 @@
  * barrier_main.c
  *
  * Demonstrate use of barriers, using the barrier implementation
- * in barrier.c.
+ * in barrier.c, in a phased computation: a Jacobi iteration over
+ * a shared grid.
+ *
+ * Each phase replaces every interior point of the grid with the
+ * average of its four neighbors in the previous phase's grid (the
+ * edges are held fixed: the top edge at 1.0, the others at 0.0).
+ * Each thread owns a band of consecutive rows. Rows are padded to
+ * a multiple of the cache line, so that no two bands share a
+ * line, and each thread first touches its own band, so that (on
+ * a NUMA system) the band's memory is local to the thread that
+ * updates it. Within its band, a thread sweeps the rows in
+ * column blocks of JACOBI_BLOCK points, so that the three rows a
+ * block reads stay in the L1 cache from one row to the next.
+ *
+ * The row kernel is chosen when the program starts: AVX2 if the
+ * processor supports it, SSE2 on other x86 processors, and
+ * scalar code elsewhere (or as requested with -k). All kernels
+ * add in the same order and don't fuse the multiply, so they
+ * produce the same grid to the last bit.
+ *
+ * A phase reads the rows on either side of a band, so a thread
+ * can't start a phase until its neighbors have finished the last
+ * one. With the mutex barrier, the barrier that ends each phase
+ * is split-phase: each thread arrives, computes the interior rows
+ * of its band for the next phase (which read only its own rows),
+ * and only then waits for the phase to end before computing its
+ * two edge rows.
+ *
+ * At the end, the threads combine the change made by the last
+ * phase (the residual) with a reducing barrier,
+ * barrier_wait_reduce(), which gives every thread the maximum
+ * without a serial pass over the thread array.
+ *
+ * Run with the argument "-s" to use the spin barrier in
+ * spin_barrier.c instead (without the split-phase overlap). The
+ * program reports the compute rate in GFLOP/s, and the average
+ * time per phase spent computing and in the barrier.
+ *
+ * Usage: barrier_main [-s] [-k scalar|sse2|avx2]
+ *                     [threads [size [phases]]]
+ *
+ * Built with -DBARRIER_STATS (the barrier_main_stats target), it
+ * also prints the mutex barrier's arrival statistics.
  */
 #include <pthread.h>
+#include <time.h>
 #include "barrier.h"
+#include "spin_barrier.h"
 #include "errors.h"
 
-#define THREADS 5
-#define ARRAY 6
-#define INLOOPS 1000
-#define OUTLOOPS 10
+#if defined (__i386__) || defined (__x86_64__)
+# include <immintrin.h>
+# define JACOBI_X86
+#endif
+
+#define THREADS         5
+#define SIZE            1024            /* interior points per side */
+#define PHASES          100
+#define JACOBI_BLOCK    512             /* columns per block */
+#define JACOBI_FLOPS    5               /* 3 adds, multiply, subtract */
+#define CACHELINE       64
+#define LINE_DOUBLES    (CACHELINE / (int)sizeof (double))
+
+/*
+ * A row kernel computes "count" points of a row into "out", from
+ * the rows above, at, and below it in the previous phase, and
+ * returns the largest change in a point.
+ */
+typedef double (*jacobi_kernel_t)(const double *up, const double *row,
+    const double *down, double *out, int count);
 
 /*
  * Keep track of each thread
@@ -19,12 +79,207 @@
 typedef struct thread_tag {
     pthread_t   thread_id;
     int         number;
-    int         increment;
-    int         array[ARRAY];
+    int         first, last;            /* rows of the band */
+    double      residual;               /* max over all threads */
+    double      compute_ns;             /* time spent computing */
+    double      barrier_ns;             /* time spent in barriers */
+    double      elapsed_ns;             /* time for all phases */
 } thread_t;
 
 barrier_t barrier;
-thread_t thread[THREADS];
+spin_barrier_t spin_barrier;
+int use_spin;                           /* -s */
+int threads = THREADS;
+int size = SIZE;
+int phases = PHASES;
+int stride;                             /* doubles per padded row */
+double *grid[2];
+jacobi_kernel_t kernel;
+const char *kernel_name;
+thread_t *thread;
+
+/*
+ * Compute a row with plain C.
+ */
+static double jacobi_scalar (const double *up, const double *row,
+    const double *down, double *out, int count)
+{
+    double max = 0.0, value, delta;
+    int col;
+
+    for (col = 0; col < count; col++) {
+        value = (((up[col] + down[col]) + row[col - 1]) + row[col + 1])
+            * 0.25;
+        delta = value - row[col];
+        if (delta < 0.0)
+            delta = -delta;
+        if (delta > max)
+            max = delta;
+        out[col] = value;
+    }
+    return max;
+}
+
+#ifdef JACOBI_X86
+/*
+ * Compute a row two points at a time, with SSE2.
+ */
+__attribute__ ((target ("sse2")))
+static double jacobi_sse2 (const double *up, const double *row,
+    const double *down, double *out, int count)
+{
+    const __m128d quarter = _mm_set1_pd (0.25);
+    const __m128d sign = _mm_set1_pd (-0.0);
+    __m128d max = _mm_setzero_pd (), value, delta;
+    double lanes[2];
+    int col;
+
+    for (col = 0; col + 2 <= count; col += 2) {
+        value = _mm_add_pd (_mm_loadu_pd (&up[col]),
+            _mm_loadu_pd (&down[col]));
+        value = _mm_add_pd (value, _mm_loadu_pd (&row[col - 1]));
+        value = _mm_add_pd (value, _mm_loadu_pd (&row[col + 1]));
+        value = _mm_mul_pd (value, quarter);
+        delta = _mm_andnot_pd (sign,
+            _mm_sub_pd (value, _mm_loadu_pd (&row[col])));
+        max = _mm_max_pd (max, delta);
+        _mm_storeu_pd (&out[col], value);
+    }
+    _mm_storeu_pd (lanes, max);
+    if (lanes[1] > lanes[0])
+        lanes[0] = lanes[1];
+    if (col < count) {
+        lanes[1] = jacobi_scalar (
+            &up[col], &row[col], &down[col], &out[col], count - col);
+        if (lanes[1] > lanes[0])
+            lanes[0] = lanes[1];
+    }
+    return lanes[0];
+}
+
+/*
+ * Compute a row four points at a time, with AVX2.
+ */
+__attribute__ ((target ("avx2")))
+static double jacobi_avx2 (const double *up, const double *row,
+    const double *down, double *out, int count)
+{
+    const __m256d quarter = _mm256_set1_pd (0.25);
+    const __m256d sign = _mm256_set1_pd (-0.0);
+    __m256d max = _mm256_setzero_pd (), value, delta;
+    double lanes[4];
+    int col, lane;
+
+    for (col = 0; col + 4 <= count; col += 4) {
+        value = _mm256_add_pd (_mm256_loadu_pd (&up[col]),
+            _mm256_loadu_pd (&down[col]));
+        value = _mm256_add_pd (value, _mm256_loadu_pd (&row[col - 1]));
+        value = _mm256_add_pd (value, _mm256_loadu_pd (&row[col + 1]));
+        value = _mm256_mul_pd (value, quarter);
+        delta = _mm256_andnot_pd (sign,
+            _mm256_sub_pd (value, _mm256_loadu_pd (&row[col])));
+        max = _mm256_max_pd (max, delta);
+        _mm256_storeu_pd (&out[col], value);
+    }
+    _mm256_storeu_pd (lanes, max);
+    for (lane = 1; lane < 4; lane++) {
+        if (lanes[lane] > lanes[0])
+            lanes[0] = lanes[lane];
+    }
+    if (col < count) {
+        lanes[1] = jacobi_scalar (
+            &up[col], &row[col], &down[col], &out[col], count - col);
+        if (lanes[1] > lanes[0])
+            lanes[0] = lanes[1];
+    }
+    return lanes[0];
+}
+#endif
+
+/*
+ * Choose the row kernel: the one named, or (if name is NULL) the
+ * best the processor supports. Return 0 if the named kernel isn't
+ * available.
+ */
+static int select_kernel (const char *name)
+{
+    kernel = jacobi_scalar;
+    kernel_name = "scalar";
+#ifdef JACOBI_X86
+    __builtin_cpu_init ();
+    if (name == NULL || strcmp (name, "avx2") == 0) {
+        if (__builtin_cpu_supports ("avx2")) {
+            kernel = jacobi_avx2;
+            kernel_name = "avx2";
+            return 1;
+        }
+        if (name != NULL)
+            return 0;
+    }
+    if (name == NULL || strcmp (name, "sse2") == 0) {
+        if (__builtin_cpu_supports ("sse2")) {
+            kernel = jacobi_sse2;
+            kernel_name = "sse2";
+            return 1;
+        }
+        if (name != NULL)
+            return 0;
+    }
+#endif
+    return name == NULL || strcmp (name, "scalar") == 0;
+}
+
+/*
+ * Compute rows "first" through "last" of "dst" from "src", one
+ * column block at a time, and return the largest change.
+ */
+static double sweep (const double *src, double *dst, int first, int last)
+{
+    double max = 0.0, delta;
+    int block, count, row;
+
+    for (block = 1; block <= size; block += JACOBI_BLOCK) {
+        count = size - block + 1 < JACOBI_BLOCK
+            ? size - block + 1 : JACOBI_BLOCK;
+        for (row = first; row <= last; row++) {
+            delta = kernel (&src[(row - 1) * stride + block],
+                &src[row * stride + block], &src[(row + 1) * stride + block],
+                &dst[row * stride + block], count);
+            if (delta > max)
+                max = delta;
+        }
+    }
+    return max;
+}
+
+static double now_ns (void)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/*
+ * Add the time since "*mark" to "*total", and move the mark.
+ */
+static void charge (double *total, double *mark)
+{
+    double now = now_ns ();
+
+    *total += now - *mark;
+    *mark = now;
+}
+
+/*
+ * Wait on whichever barrier is in use.
+ */
+static int wait_barrier (void)
+{
+    if (use_spin)
+        return spin_barrier_wait (&spin_barrier);
+    return barrier_wait (&barrier);
+}
 
 /*
  * Start routine for threads.
@@ -32,59 +287,162 @@ thread_t thread[THREADS];
 void *thread_routine (void *arg)
 {
     thread_t *self = (thread_t*)arg;    /* Thread's thread_t */
-    int in_loop, out_loop, count, status;
-    
+    barrier_token_t token;
+    double *src = grid[0], *dst = grid[1], *swap;
+    double residual = 0.0, delta, start, mark;
+    int phase, row, col, status;
+
     /*
-     * Loop through OUTLOOPS barrier cycles.
+     * Initialize our own band of both grids (and the fixed top or
+     * bottom edge, if it borders our band).
      */
-    for (out_loop = 0; out_loop < OUTLOOPS; out_loop++) {
-        status = barrier_wait (&barrier);
-        if (status > 0)
-            err_abort (status, "Wait on barrier");
-
-        /*
-         * This inner loop just adds a value to each element in
-         * the working array.
-         */
-        for (in_loop = 0; in_loop < INLOOPS; in_loop++)
-            for (count = 0; count < ARRAY; count++)
-                self->array[count] += self->increment;
-
-        status = barrier_wait (&barrier);
-        if (status > 0)
-            err_abort (status, "Wait on barrier");
-
-        /*
-         * The barrier causes one thread to return with the
-         * special return status -1. The thread receiving this
-         * value increments each element in the shared array.
-         */
-        if (status == -1) {
-            int thread_num;
-
-            for (thread_num = 0; thread_num < THREADS; thread_num++)
-                thread[thread_num].increment += 1;
+    for (row = self->first; row <= self->last; row++) {
+        for (col = 0; col < stride; col++)
+            src[row * stride + col] = dst[row * stride + col] = 0.0;
+    }
+    if (self->first == 1) {
+        for (col = 0; col < stride; col++)
+            src[col] = dst[col] = 1.0;
+    }
+    if (self->last == size) {
+        for (col = 0; col < stride; col++)
+            src[(size + 1) * stride + col]
+                = dst[(size + 1) * stride + col] = 0.0;
+    }
+    status = wait_barrier ();
+    if (status > 0)
+        err_abort (status, "Wait on barrier");
+
+    start = mark = now_ns ();
+    if (use_spin) {
+        for (phase = 0; phase < phases; phase++) {
+            residual = sweep (src, dst, self->first, self->last);
+            charge (&self->compute_ns, &mark);
+            status = spin_barrier_wait (&spin_barrier);
+            if (status > 0)
+                err_abort (status, "Wait on barrier");
+            charge (&self->barrier_ns, &mark);
+            swap = src; src = dst; dst = swap;
+        }
+    } else {
+        residual = sweep (src, dst, self->first, self->last);
+        charge (&self->compute_ns, &mark);
+        for (phase = 0; phase < phases; phase++) {
+            /*
+             * Arrive, compute our interior rows for the next phase
+             * while the other threads finish, and then wait for
+             * the phase to end (which may already have happened).
+             * Our interior rows are read by no one else, so they
+             * can be overwritten while our neighbors still read
+             * our edge rows.
+             */
+            status = barrier_arrive (&barrier, &token);
+            if (status > 0)
+                err_abort (status, "Arrive at barrier");
+            charge (&self->barrier_ns, &mark);
+            if (phase + 1 < phases)
+                residual = sweep (dst, src, self->first + 1, self->last - 1);
+            charge (&self->compute_ns, &mark);
+            status = barrier_await (&barrier, &token);
+            if (status > 0)
+                err_abort (status, "Await barrier");
+            charge (&self->barrier_ns, &mark);
+
+            /*
+             * Our neighbors' edge rows are now complete; finish
+             * the next phase with our own edge rows.
+             */
+            if (phase + 1 < phases) {
+                delta = sweep (dst, src, self->first, self->first);
+                if (delta > residual)
+                    residual = delta;
+                if (self->last > self->first) {
+                    delta = sweep (dst, src, self->last, self->last);
+                    if (delta > residual)
+                        residual = delta;
+                }
+                charge (&self->compute_ns, &mark);
+            }
+            swap = src; src = dst; dst = swap;
         }
     }
+
+    /*
+     * Find the largest change made by the last phase.
+     */
+    status = barrier_wait_reduce (
+        &barrier, residual, barrier_op_max, &self->residual);
+    if (status > 0)
+        err_abort (status, "Reduce at barrier");
+    self->elapsed_ns = now_ns () - start;
     return NULL;
 }
 
-int main (int arg, char *argv[])
+int main (int argc, char *argv[])
 {
-    int thread_count, array_count;
+    const char *name = NULL;
+    double checksum = 0.0, compute = 0.0, waiting = 0.0, elapsed = 0.0;
+    size_t bytes;
+    int thread_count, rows, row, col, arg;
     int status;
+#ifdef BARRIER_STATS
+    int slot;
+#endif
 
-    barrier_init (&barrier, THREADS);
+    for (arg = 1; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp (argv[arg], "-s") == 0)
+            use_spin = 1;
+        else if (strcmp (argv[arg], "-k") == 0 && arg + 1 < argc)
+            name = argv[++arg];
+        else
+            break;
+    }
+    if (arg < argc)
+        threads = atoi (argv[arg++]);
+    if (arg < argc)
+        size = atoi (argv[arg++]);
+    if (arg < argc)
+        phases = atoi (argv[arg++]);
+    if (arg < argc || threads < 1 || size < threads || phases < 1) {
+        fprintf (stderr, "Usage: %s [-s] [-k scalar|sse2|avx2] "
+            "[threads [size [phases]]]\n", argv[0]);
+        return -1;
+    }
+    if (!select_kernel (name)) {
+        fprintf (stderr, "Kernel %s isn't supported here\n", name);
+        return -1;
+    }
 
     /*
-     * Create a set of threads that will use the barrier.
+     * Pad each row (with its two edge points) to a whole number of
+     * cache lines.
      */
-    for (thread_count = 0; thread_count < THREADS; thread_count++) {
-        thread[thread_count].increment = thread_count;
-        thread[thread_count].number = thread_count;
+    stride = (size + 2 + LINE_DOUBLES - 1) / LINE_DOUBLES * LINE_DOUBLES;
+    bytes = (size_t)(size + 2) * stride * sizeof (double);
+    if (posix_memalign ((void**)&grid[0], CACHELINE, bytes) != 0
+        || posix_memalign ((void**)&grid[1], CACHELINE, bytes) != 0)
+        errno_abort ("Allocate grid");
+    thread = (thread_t*)calloc (threads, sizeof (thread_t));
+    if (thread == NULL)
+        errno_abort ("Allocate threads");
 
-        for (array_count = 0; array_count < ARRAY; array_count++)
-            thread[thread_count].array[array_count] = array_count + 1;
+    status = barrier_init (&barrier, threads);
+    if (status != 0)
+        err_abort (status, "Init barrier");
+    status = spin_barrier_init (&spin_barrier, threads);
+    if (status != 0)
+        err_abort (status, "Init spin barrier");
+
+    /*
+     * Create a set of threads that will use the barrier, giving
+     * each a band of rows (as even as possible).
+     */
+    for (thread_count = 0, row = 1; thread_count < threads; thread_count++) {
+        rows = size / threads + (thread_count < size % threads);
+        thread[thread_count].number = thread_count;
+        thread[thread_count].first = row;
+        thread[thread_count].last = row + rows - 1;
+        row += rows;
 
         status = pthread_create (&thread[thread_count].thread_id,
             NULL, thread_routine, (void*)&thread[thread_count]);
@@ -95,21 +453,71 @@ int main (int arg, char *argv[])
     /*
      * Now join with each of the threads.
      */
-    for (thread_count = 0; thread_count < THREADS; thread_count++) {
+    for (thread_count = 0; thread_count < threads; thread_count++) {
         status = pthread_join (thread[thread_count].thread_id, NULL);
         if (status != 0)
             err_abort (status, "Join thread");
+        if (thread[thread_count].residual != thread[0].residual)
+            printf ("%02d: residual %g, expected %g\n", thread_count,
+                thread[thread_count].residual, thread[0].residual);
+        compute += thread[thread_count].compute_ns;
+        waiting += thread[thread_count].barrier_ns;
+        if (thread[thread_count].elapsed_ns > elapsed)
+            elapsed = thread[thread_count].elapsed_ns;
+    }
 
-        printf ("%02d: (%d) ", thread_count, thread[thread_count].increment);
+    /*
+     * Phase 0 writes grid[1], so after an odd number of phases the
+     * result is there.
+     */
+    for (row = 1; row <= size; row++)
+        for (col = 1; col <= size; col++)
+            checksum += grid[phases % 2][row * stride + col];
+    printf ("%d threads, %dx%d grid, %d phases, %s kernel\n",
+        threads, size, size, phases, kernel_name);
+    printf ("residual %.6e, checksum %.12e\n", thread[0].residual, checksum);
+    printf ("%s barrier: %.2f GFLOP/s, %.2f us per phase "
+        "(compute %.2f us, barrier %.2f us)\n",
+        use_spin ? "spin" : "mutex",
+        (double)size * size * phases * JACOBI_FLOPS / elapsed,
+        elapsed / phases / 1e3,
+        compute / threads / phases / 1e3,
+        waiting / threads / phases / 1e3);
 
-        for (array_count = 0; array_count < ARRAY; array_count++)
-            printf ("%010u ", thread[thread_count].array[array_count]);
-        printf ("\n");
+#ifdef BARRIER_STATS
+    /*
+     * Report how the threads arrived at the mutex barrier; the
+     * participants are listed by thread ID.
+     */
+    for (thread_count = 0; thread_count < threads; thread_count++)
+        printf ("%02d: thread %#lx\n", thread_count,
+            (unsigned long)thread[thread_count].thread_id);
+    status = barrier_stats_dump (&barrier, stdout);
+    if (status != 0)
+        err_abort (status, "Dump barrier statistics");
+
+    /*
+     * Every arrival, split-phase or not, should have been charged
+     * exactly one wait.
+     */
+    for (slot = 0; slot < barrier.stats.participants; slot++) {
+        if (barrier.stats.participant[slot].waits
+            != barrier.stats.participant[slot].arrivals) {
+            fprintf (stderr, "[%02d]: %lu waits for %lu arrivals\n", slot,
+                barrier.stats.participant[slot].waits,
+                barrier.stats.participant[slot].arrivals);
+            return -1;
+        }
     }
+#endif
 
     /*
-     * To be thorough, destroy the barrier.
+     * To be thorough, destroy the barriers.
      */
     barrier_destroy (&barrier);
+    spin_barrier_destroy (&spin_barrier);
+    free (thread);
+    free (grid[0]);
+    free (grid[1]);
     return 0;
 }
@@ -0,0 +1,132 @@
+/*
+ * barrier_timed_main.c
+ *
+ * Demonstrate timed barrier waits, and the "broken" barrier.
+ *
+ * The threads run through CYCLES barrier cycles, allowing each
+ * wait TIMEOUT_MSEC. In the first round, one thread stalls
+ * partway through, longer than the timeout. The first thread to
+ * time out breaks the barrier, and the others are released with
+ * ECANCELED rather than waiting for the stalled thread, which
+ * finds the barrier broken when it finally arrives. The main
+ * thread then resets the barrier, and a second round, with no
+ * stall, completes normally.
+ */
+#include <pthread.h>
+#include <time.h>
+#include "barrier.h"
+#include "errors.h"
+
+#define THREADS         5
+#define CYCLES          5
+#define STALL_CYCLE     2
+#define TIMEOUT_MSEC    200
+#define STALL_MSEC      (3 * TIMEOUT_MSEC)
+
+/*
+ * Keep track of each thread
+ */
+typedef struct thread_tag {
+    pthread_t   thread_id;
+    int         number;
+    int         cycles;                 /* cycles completed */
+    int         status;                 /* status of the failed wait */
+} thread_t;
+
+barrier_t barrier;
+thread_t thread[THREADS];
+int stall;                              /* thread 0 stalls this round */
+
+/*
+ * Compute an absolute CLOCK_MONOTONIC deadline "msec" milliseconds
+ * from now.
+ */
+static void deadline (struct timespec *abstime, long msec)
+{
+    clock_gettime (CLOCK_MONOTONIC, abstime);
+    abstime->tv_sec += msec / 1000;
+    abstime->tv_nsec += (msec % 1000) * 1000000;
+    if (abstime->tv_nsec >= 1000000000) {
+        abstime->tv_sec++;
+        abstime->tv_nsec -= 1000000000;
+    }
+}
+
+/*
+ * Start routine for threads.
+ */
+void *thread_routine (void *arg)
+{
+    thread_t *self = (thread_t*)arg;
+    struct timespec abstime, pause;
+    int cycle, status;
+
+    self->cycles = 0;
+    self->status = 0;
+    for (cycle = 0; cycle < CYCLES; cycle++) {
+        if (stall && self->number == 0 && cycle == STALL_CYCLE) {
+            pause.tv_sec = STALL_MSEC / 1000;
+            pause.tv_nsec = (STALL_MSEC % 1000) * 1000000;
+            nanosleep (&pause, NULL);
+        }
+        deadline (&abstime, TIMEOUT_MSEC);
+        status = barrier_timedwait (&barrier, &abstime);
+        if (status > 0) {
+            self->status = status;
+            break;
+        }
+        self->cycles++;
+    }
+    return NULL;
+}
+
+/*
+ * Run the threads through the barrier, and report how far each
+ * got.
+ */
+static void run (void)
+{
+    int count, status;
+
+    for (count = 0; count < THREADS; count++) {
+        thread[count].number = count;
+        status = pthread_create (&thread[count].thread_id,
+            NULL, thread_routine, (void*)&thread[count]);
+        if (status != 0)
+            err_abort (status, "Create thread");
+    }
+    for (count = 0; count < THREADS; count++) {
+        status = pthread_join (thread[count].thread_id, NULL);
+        if (status != 0)
+            err_abort (status, "Join thread");
+        printf ("%02d: %d cycles, %s\n", count, thread[count].cycles,
+            thread[count].status == 0
+            ? "complete" : strerror (thread[count].status));
+    }
+}
+
+int main (int argc, char *argv[])
+{
+    int status;
+
+    status = barrier_init (&barrier, THREADS);
+    if (status != 0)
+        err_abort (status, "Init barrier");
+
+    printf ("Round 1: thread 0 stalls in cycle %d\n", STALL_CYCLE);
+    stall = 1;
+    run ();
+
+    status = barrier_reset (&barrier);
+    if (status != 0)
+        err_abort (status, "Reset barrier");
+
+    printf ("Round 2: no stall\n");
+    stall = 0;
+    run ();
+
+    status = barrier_destroy (&barrier);
+    if (status != 0)
+        err_abort (status, "Destroy barrier");
+    return 0;
+}
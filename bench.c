@@ -0,0 +1,502 @@
+/*
+ * bench.c
+ *
+ * This file implements the common benchmark support.
+ *
+ * bench_parse() handles the options shared by the benchmark
+ * programs (each may add its own through "extra_opts" and the
+ * "extra" callback):
+ *
+ *      -t threads      worker threads
+ *      -k keys         size of the key space (data elements)
+ *      -r percent      reads per 100 operations
+ *      -c nsec         critical section length, in nanoseconds
+ *      -d dist         key distribution: seq, uniform, or zipf[:theta]
+ *      -n ops          operations per thread, or
+ *      -s seconds      run for a fixed time instead
+ *      -f format       report format: text, csv, or json
+ *
+ * A run looks like this:
+ *
+ *      bench_start (&config);
+ *      ...create threads, each of which calls bench_thread_init()
+ *         and loops until bench_done(), timing each operation with
+ *         bench_now() and bench_record()...
+ *      bench_wait (&config);
+ *      ...join threads...
+ *      bench_result_init (&result, config.threads);
+ *      ...bench_result_add() for each thread...
+ *      bench_report (&config, &result, label);
+ */
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+#include "errors.h"
+#include "bench.h"
+
+volatile int bench_stop;
+
+static bench_zipf_t bench_zipf;
+static double bench_loops_per_ns;       /* for bench_critical */
+static unsigned long long bench_started;
+static int bench_csv_header;            /* CSV header printed */
+
+/*
+ * Return the time in nanoseconds (CLOCK_MONOTONIC).
+ */
+unsigned long long bench_now (void)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * Spin for "loops" iterations, in a way the compiler can't remove.
+ */
+static void bench_spin (unsigned long loops)
+{
+    while (loops-- > 0)
+        __asm__ __volatile__ ("" ::: "memory");
+}
+
+/*
+ * Measure how many spin iterations make a nanosecond.
+ */
+static void bench_calibrate (void)
+{
+    unsigned long long start, elapsed;
+    unsigned long loops = 1000;
+
+    do {
+        loops *= 2;
+        start = bench_now ();
+        bench_spin (loops);
+        elapsed = bench_now () - start;
+    } while (elapsed < 10000000);       /* at least 10 ms */
+    bench_loops_per_ns = (double)loops / elapsed;
+}
+
+void bench_usage (bench_config_t *config, const char *extra)
+{
+    fprintf (stderr,
+        "Usage: %s [-t threads] [-k keys] [-r read%%] [-c cs_nsec]\n"
+        "    [-d seq|uniform|zipf[:theta]] [-n ops | -s seconds]\n"
+        "    [-f text|csv|json]%s%s\n",
+        config->name, extra != NULL ? " " : "", extra != NULL ? extra : "");
+}
+
+/*
+ * Parse the command line. Returns 0, or -1 if it is invalid.
+ * The caller sets the defaults in "config" beforehand.
+ */
+int bench_parse (
+    bench_config_t *config, int argc, char *argv[],
+    const char *extra_opts, int (*extra)(int opt, char *arg))
+{
+    char optstring[64];
+    int opt;
+
+    snprintf (optstring, sizeof (optstring), "t:k:r:c:d:n:s:f:%s",
+        extra_opts != NULL ? extra_opts : "");
+    while ((opt = getopt (argc, argv, optstring)) != -1) {
+        switch (opt) {
+        case 't':
+            config->threads = atoi (optarg);
+            break;
+        case 'k':
+            config->keys = strtoul (optarg, NULL, 0);
+            break;
+        case 'r':
+            config->read_percent = atoi (optarg);
+            break;
+        case 'c':
+            config->cs_ns = atol (optarg);
+            break;
+        case 'd':
+            if (strcmp (optarg, "seq") == 0)
+                config->dist = BENCH_SEQ;
+            else if (strcmp (optarg, "uniform") == 0)
+                config->dist = BENCH_UNIFORM;
+            else if (strncmp (optarg, "zipf", 4) == 0) {
+                config->dist = BENCH_ZIPF;
+                if (optarg[4] == ':')
+                    config->theta = atof (optarg + 5);
+            } else
+                return -1;
+            break;
+        case 'n':
+            config->ops = atol (optarg);
+            config->seconds = 0;
+            config->length_set = 1;
+            break;
+        case 's':
+            config->seconds = atof (optarg);
+            config->length_set = 1;
+            break;
+        case 'f':
+            if (strcmp (optarg, "text") == 0)
+                config->format = BENCH_TEXT;
+            else if (strcmp (optarg, "csv") == 0)
+                config->format = BENCH_CSV;
+            else if (strcmp (optarg, "json") == 0)
+                config->format = BENCH_JSON;
+            else
+                return -1;
+            break;
+        default:
+            if (extra == NULL || extra (opt, optarg) != 0)
+                return -1;
+            break;
+        }
+    }
+    if (optind != argc || config->threads < 1 || config->keys < 1
+        || config->read_percent < 0 || config->read_percent > 100
+        || config->cs_ns < 0 || (config->seconds <= 0 && config->ops < 1)
+        || (config->dist == BENCH_ZIPF
+            && (config->theta <= 0 || config->theta >= 1)))
+        return -1;
+    if (config->dist == BENCH_ZIPF)
+        bench_zipf_init (&bench_zipf, config->keys, config->theta);
+    if (config->cs_ns > 0)
+        bench_calibrate ();
+    return 0;
+}
+
+/*
+ * Initialize a thread's benchmark state.
+ */
+void bench_thread_init (
+    bench_config_t *config, bench_thread_t *thread, int index)
+{
+    memset (thread, 0, sizeof (bench_thread_t));
+    thread->seed = 0x9e3779b97f4a7c15ULL * (index + 1);
+    thread->next_key = index % config->keys;
+}
+
+/*
+ * xorshift64* -- cheap per-thread random numbers.
+ */
+unsigned long long bench_random (bench_thread_t *thread)
+{
+    thread->seed ^= thread->seed >> 12;
+    thread->seed ^= thread->seed << 25;
+    thread->seed ^= thread->seed >> 27;
+    return thread->seed * 2685821657736338717ULL;
+}
+
+void bench_zipf_init (bench_zipf_t *zipf, unsigned long n, double theta)
+{
+    double zeta2 = 0.0;
+    unsigned long i;
+
+    zipf->n = n;
+    zipf->theta = theta;
+    zipf->zetan = 0.0;
+    for (i = 1; i <= n; i++)
+        zipf->zetan += 1.0 / pow ((double)i, theta);
+    for (i = 1; i <= 2; i++)
+        zeta2 += 1.0 / pow ((double)i, theta);
+    zipf->alpha = 1.0 / (1.0 - theta);
+    zipf->eta = (1.0 - pow (2.0 / n, 1.0 - theta))
+        / (1.0 - zeta2 / zipf->zetan);
+}
+
+/*
+ * Map a uniform "u" in [0, 1) to a rank in [0, n), with rank 0
+ * the most popular.
+ */
+unsigned long bench_zipf_next (bench_zipf_t *zipf, double u)
+{
+    double uz = u * zipf->zetan;
+    unsigned long rank;
+
+    if (uz < 1.0)
+        return 0;
+    if (uz < 1.0 + pow (0.5, zipf->theta))
+        return 1;
+    rank = (unsigned long)(zipf->n
+        * pow (zipf->eta * u - zipf->eta + 1.0, zipf->alpha));
+    return rank < zipf->n ? rank : zipf->n - 1;
+}
+
+/*
+ * Choose the key for the next operation.
+ */
+unsigned long bench_key (bench_config_t *config, bench_thread_t *thread)
+{
+    unsigned long key;
+
+    switch (config->dist) {
+    case BENCH_UNIFORM:
+        return bench_random (thread) % config->keys;
+    case BENCH_ZIPF:
+        return bench_zipf_next (&bench_zipf,
+            (bench_random (thread) >> 11) * (1.0 / 9007199254740992.0));
+    default:
+        key = thread->next_key;
+        if (++thread->next_key >= config->keys)
+            thread->next_key = 0;
+        return key;
+    }
+}
+
+/*
+ * Decide whether the next operation is a read.
+ */
+int bench_is_read (bench_config_t *config, bench_thread_t *thread)
+{
+    return (int)(bench_random (thread) % 100) < config->read_percent;
+}
+
+/*
+ * Report whether a thread has done its share.
+ */
+int bench_done (bench_config_t *config, bench_thread_t *thread)
+{
+    if (config->seconds > 0)
+        return bench_stop;
+    return thread->ops >= (unsigned long)config->ops;
+}
+
+/*
+ * Simulate work inside the critical section.
+ */
+void bench_critical (bench_config_t *config)
+{
+    if (config->cs_ns > 0)
+        bench_spin ((unsigned long)(config->cs_ns * bench_loops_per_ns));
+}
+
+/*
+ * Count an operation, and record its latency.
+ */
+void bench_record (bench_thread_t *thread, unsigned long long ns)
+{
+    int msb = 0, bucket;
+
+    thread->ops++;
+    if (ns > thread->max_ns)
+        thread->max_ns = ns;
+    if (ns >= (1ULL << BENCH_SUB_BITS)) {
+        msb = 63 - __builtin_clzll (ns);
+        bucket = ((msb - BENCH_SUB_BITS + 1) << BENCH_SUB_BITS)
+            + (int)((ns >> (msb - BENCH_SUB_BITS)) & ((1 << BENCH_SUB_BITS) - 1));
+    } else
+        bucket = (int)ns;
+    if (bucket >= BENCH_BUCKETS)
+        bucket = BENCH_BUCKETS - 1;
+    thread->hist[bucket]++;
+}
+
+/*
+ * Return the lowest latency in a histogram bucket.
+ */
+static unsigned long long bench_bucket_ns (int bucket)
+{
+    int group = bucket >> BENCH_SUB_BITS;
+    int sub = bucket & ((1 << BENCH_SUB_BITS) - 1);
+
+    if (group == 0)
+        return sub;
+    return (unsigned long long)((1 << BENCH_SUB_BITS) + sub)
+        << (group - 1);
+}
+
+static unsigned long long bench_percentile (
+    bench_result_t *result, double fraction)
+{
+    unsigned long seen = 0, samples = 0;
+    int bucket;
+
+    /*
+     * Not every counted operation need be timed (a failed trylock,
+     * for example), so take the sample count from the histogram.
+     */
+    for (bucket = 0; bucket < BENCH_BUCKETS; bucket++)
+        samples += result->hist[bucket];
+    for (bucket = 0; bucket < BENCH_BUCKETS; bucket++) {
+        seen += result->hist[bucket];
+        if (seen > 0 && seen >= fraction * samples)
+            return bench_bucket_ns (bucket);
+    }
+    return result->max_ns;
+}
+
+/*
+ * Start the clock for a run.
+ */
+void bench_start (bench_config_t *config)
+{
+    bench_stop = 0;
+    bench_started = bench_now ();
+}
+
+/*
+ * For a timed run, let the threads run for the configured time,
+ * then tell them to stop.
+ */
+void bench_wait (bench_config_t *config)
+{
+    struct timespec duration;
+
+    if (config->seconds > 0) {
+        duration.tv_sec = (time_t)config->seconds;
+        duration.tv_nsec = (long)((config->seconds - duration.tv_sec) * 1e9);
+        while (nanosleep (&duration, &duration) != 0 && errno == EINTR)
+            ;
+    }
+    bench_stop = 1;
+}
+
+/*
+ * Initialize the totals for a run; call after joining the threads.
+ */
+int bench_result_init (bench_result_t *result, int threads)
+{
+    memset (result, 0, sizeof (bench_result_t));
+    result->elapsed = (bench_now () - bench_started) / 1e9;
+    result->threads = threads;
+    result->ops = (unsigned long*)calloc (threads, sizeof (unsigned long));
+    if (result->ops == NULL)
+        return ENOMEM;
+    return 0;
+}
+
+void bench_result_add (
+    bench_result_t *result, int index, bench_thread_t *thread)
+{
+    int bucket;
+
+    result->ops[index] = thread->ops;
+    result->total += thread->ops;
+    if (thread->max_ns > result->max_ns)
+        result->max_ns = thread->max_ns;
+    for (bucket = 0; bucket < BENCH_BUCKETS; bucket++)
+        result->hist[bucket] += thread->hist[bucket];
+}
+
+/*
+ * Attach a program-specific statistic to the report. CSV and JSON
+ * print it with all the digits a double has, so that it reads back
+ * exactly; the text report prints a whole number in full, and
+ * anything else (a ratio) to a few digits.
+ */
+void bench_result_extra (
+    bench_result_t *result, const char *name, double value)
+{
+    if (result->extras < BENCH_MAX_EXTRA) {
+        result->extra_name[result->extras] = name;
+        result->extra_value[result->extras++] = value;
+    }
+}
+
+void bench_result_free (bench_result_t *result)
+{
+    free (result->ops);
+    result->ops = NULL;
+}
+
+/*
+ * Print the report for a run. "label" distinguishes variants of
+ * a program (lock implementation, layout, and so on).
+ */
+void bench_report (
+    bench_config_t *config, bench_result_t *result, const char *label)
+{
+    static const char *dists[] = {"seq", "uniform", "zipf"};
+    double share, min_share = 1.0, max_share = 0.0;
+    double sum = 0.0, sum_sq = 0.0, jain, rate;
+    unsigned long long p50, p90, p99, p999;
+    int index;
+
+    /*
+     * Fairness: each thread's share of all operations, and Jain's
+     * index (1.0 when all threads did equal work, 1/threads when
+     * one thread did everything).
+     */
+    for (index = 0; index < result->threads; index++) {
+        share = result->total == 0
+            ? 0.0 : (double)result->ops[index] / result->total;
+        if (share < min_share)
+            min_share = share;
+        if (share > max_share)
+            max_share = share;
+        sum += result->ops[index];
+        sum_sq += (double)result->ops[index] * result->ops[index];
+    }
+    jain = sum_sq == 0.0 ? 1.0 : sum * sum / (result->threads * sum_sq);
+    rate = result->elapsed > 0 ? result->total / result->elapsed : 0.0;
+    p50 = bench_percentile (result, 0.50);
+    p90 = bench_percentile (result, 0.90);
+    p99 = bench_percentile (result, 0.99);
+    p999 = bench_percentile (result, 0.999);
+
+    switch (config->format) {
+    case BENCH_CSV:
+        if (!bench_csv_header) {
+            printf ("program,label,threads,keys,read_percent,cs_ns,dist,"
+                "elapsed,ops,ops_per_sec,p50_ns,p90_ns,p99_ns,p999_ns,"
+                "max_ns,min_share,max_share,jain");
+            for (index = 0; index < result->extras; index++)
+                printf (",%s", result->extra_name[index]);
+            printf ("\n");
+            bench_csv_header = 1;
+        }
+        printf ("%s,%s,%d,%lu,%d,%ld,%s,%.6f,%lu,%.0f,"
+            "%llu,%llu,%llu,%llu,%llu,%.6f,%.6f,%.6f",
+            config->name, label, config->threads, config->keys,
+            config->read_percent, config->cs_ns, dists[config->dist],
+            result->elapsed, result->total, rate,
+            p50, p90, p99, p999, result->max_ns,
+            min_share, max_share, jain);
+        for (index = 0; index < result->extras; index++)
+            printf (",%.17g", result->extra_value[index]);
+        printf ("\n");
+        break;
+    case BENCH_JSON:
+        printf ("{\"program\": \"%s\", \"label\": \"%s\", "
+            "\"threads\": %d, \"keys\": %lu, \"read_percent\": %d, "
+            "\"cs_ns\": %ld, \"dist\": \"%s\", \"elapsed\": %.6f, "
+            "\"ops\": %lu, \"ops_per_sec\": %.0f, "
+            "\"latency_ns\": {\"p50\": %llu, \"p90\": %llu, "
+            "\"p99\": %llu, \"p999\": %llu, \"max\": %llu}, "
+            "\"fairness\": {\"min_share\": %.6f, \"max_share\": %.6f, "
+            "\"jain\": %.6f}, \"thread_ops\": [",
+            config->name, label, config->threads, config->keys,
+            config->read_percent, config->cs_ns, dists[config->dist],
+            result->elapsed, result->total, rate,
+            p50, p90, p99, p999, result->max_ns,
+            min_share, max_share, jain);
+        for (index = 0; index < result->threads; index++)
+            printf ("%s%lu", index == 0 ? "" : ", ", result->ops[index]);
+        printf ("]");
+        for (index = 0; index < result->extras; index++)
+            printf (", \"%s\": %.17g",
+                result->extra_name[index], result->extra_value[index]);
+        printf ("}\n");
+        break;
+    default:
+        printf ("%s [%s]: %d threads, %lu keys, %d%% reads, "
+            "%ld ns critical section, %s keys\n",
+            config->name, label, config->threads, config->keys,
+            config->read_percent, config->cs_ns, dists[config->dist]);
+        printf ("  %lu ops in %.3f s: %.3f Mops/s\n",
+            result->total, result->elapsed, rate / 1e6);
+        printf ("  latency ns: p50 %llu, p90 %llu, p99 %llu, "
+            "p99.9 %llu, max %llu\n", p50, p90, p99, p999, result->max_ns);
+        printf ("  fairness: share min %.1f%%, max %.1f%% "
+            "(even %.1f%%), Jain index %.3f\n",
+            min_share * 100, max_share * 100,
+            100.0 / result->threads, jain);
+        for (index = 0; index < result->extras; index++)
+            printf (floor (result->extra_value[index])
+                    == result->extra_value[index]
+                    && fabs (result->extra_value[index]) < 1e15
+                ? "  %s: %.0f\n" : "  %s: %.4g\n",
+                result->extra_name[index], result->extra_value[index]);
+        break;
+    }
+    fflush (stdout);
+}
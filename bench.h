@@ -0,0 +1,134 @@
+/*
+ * bench.h
+ *
+ * This header file describes the common support for the
+ * benchmark programs: command line options, key distributions,
+ * critical sections of a given length, per-operation latency
+ * histograms, and reports in text, CSV, or JSON.
+ *
+ * Each worker thread owns a bench_thread_t, in which it counts
+ * its operations and records their latencies. When the run is
+ * over, the program adds each thread's record to a bench_result_t
+ * and calls bench_report(), which prints throughput, latency
+ * percentiles, and fairness (each thread's share of the
+ * operations).
+ */
+#ifndef __bench_h
+#define __bench_h
+#include <stdio.h>
+
+/*
+ * Key distributions
+ */
+#define BENCH_SEQ       0               /* each thread walks the keys */
+#define BENCH_UNIFORM   1
+#define BENCH_ZIPF      2
+
+/*
+ * Report formats
+ */
+#define BENCH_TEXT      0
+#define BENCH_CSV       1
+#define BENCH_JSON      2
+
+/*
+ * Latency histogram: 16 linear sub-buckets for each power of two
+ * nanoseconds, giving about 6% resolution up to 2^48 ns.
+ */
+#define BENCH_SUB_BITS  4
+#define BENCH_BUCKETS   (49 << BENCH_SUB_BITS)
+
+#define BENCH_MAX_EXTRA 8
+
+/*
+ * Run parameters, from the command line.
+ */
+typedef struct bench_config_tag {
+    const char          *name;          /* program name for reports */
+    int                 threads;        /* worker threads */
+    unsigned long       keys;           /* size of the key space */
+    int                 read_percent;   /* reads in 100 operations */
+    long                cs_ns;          /* critical section length */
+    int                 dist;           /* BENCH_SEQ, ... */
+    double              theta;          /* zipfian skew */
+    long                ops;            /* operations per thread */
+    double              seconds;        /* or duration, if nonzero */
+    int                 format;         /* BENCH_TEXT, ... */
+    int                 length_set;     /* set by bench_parse on -n, -s */
+} bench_config_t;
+
+/*
+ * Zipfian generator constants (Gray et al., "Quickly Generating
+ * Billion-Record Synthetic Databases").
+ */
+typedef struct bench_zipf_tag {
+    unsigned long       n;
+    double              theta;
+    double              alpha;
+    double              zetan;
+    double              eta;
+} bench_zipf_t;
+
+/*
+ * Per-thread state and statistics.
+ */
+typedef struct bench_thread_tag {
+    unsigned long long  seed;           /* xorshift state */
+    unsigned long       next_key;       /* for BENCH_SEQ */
+    unsigned long       ops;            /* operations completed */
+    unsigned long long  max_ns;         /* slowest operation */
+    unsigned long       hist[BENCH_BUCKETS];
+} bench_thread_t;
+
+/*
+ * Totals for a run.
+ */
+typedef struct bench_result_tag {
+    int                 threads;
+    double              elapsed;        /* seconds */
+    unsigned long       *ops;           /* per thread */
+    unsigned long       total;
+    unsigned long long  max_ns;
+    unsigned long       hist[BENCH_BUCKETS];
+    int                 extras;
+    const char          *extra_name[BENCH_MAX_EXTRA];
+    double              extra_value[BENCH_MAX_EXTRA];
+} bench_result_t;
+
+/*
+ * Set to stop a timed run.
+ */
+extern volatile int bench_stop;
+
+/*
+ * Define benchmark functions
+ */
+extern int bench_parse (
+    bench_config_t *config, int argc, char *argv[],
+    const char *extra_opts, int (*extra)(int opt, char *arg));
+extern void bench_usage (bench_config_t *config, const char *extra);
+extern void bench_thread_init (
+    bench_config_t *config, bench_thread_t *thread, int index);
+extern unsigned long bench_key (
+    bench_config_t *config, bench_thread_t *thread);
+extern int bench_is_read (bench_config_t *config, bench_thread_t *thread);
+extern int bench_done (bench_config_t *config, bench_thread_t *thread);
+extern void bench_critical (bench_config_t *config);
+extern unsigned long long bench_now (void);
+extern void bench_record (bench_thread_t *thread, unsigned long long ns);
+extern void bench_start (bench_config_t *config);
+extern void bench_wait (bench_config_t *config);
+extern int bench_result_init (bench_result_t *result, int threads);
+extern void bench_result_add (
+    bench_result_t *result, int index, bench_thread_t *thread);
+extern void bench_result_extra (
+    bench_result_t *result, const char *name, double value);
+extern void bench_result_free (bench_result_t *result);
+extern void bench_report (
+    bench_config_t *config, bench_result_t *result, const char *label);
+extern unsigned long long bench_random (bench_thread_t *thread);
+extern void bench_zipf_init (
+    bench_zipf_t *zipf, unsigned long n, double theta);
+extern unsigned long bench_zipf_next (bench_zipf_t *zipf, double u);
+
+#endif
@@ -1,100 +1,1199 @@
 /*
  * crew.c
  *
- * Demonstrate a work crew implementing a simple parallel search
- * through a directory tree.
+ * This file implements the "work crew" described in crew.h: a
+ * simple parallel search through a directory tree.
+ *
+ * Each file is searched with the scanner in scan.c, which maps
+ * the file (or reads it in large blocks) and uses vector
+ * instructions where the processor has them. If crew_start() is
+ * given a compiled Aho-Corasick automaton (acsearch.c), the crew
+ * searches for all of its patterns at once instead; the automaton
+ * is shared by all of the workers, and each file is read only once
+ * however many patterns there are.
+ *
+ * Each worker keeps its own deque of work items. Entries that a
+ * worker finds in a directory go onto its own deque, and it takes
+ * its next item from there, newest first (so that it works through
+ * a subtree while the subtree's directories are still in cache).
+ * A worker whose deque is empty steals the oldest item from
+ * another's. The crew knows it's done when an atomic count of
+ * outstanding items falls to zero; the crew mutex is used only
+ * for idle workers to wait for work, and for crew_start to wait
+ * for the end.
+ *
+ * Entries are reached relative to their directory's descriptor,
+ * so each work item is just a name and a link to its directory's
+ * item (see crew.h), and the search isn't limited to PATH_MAX.
+ * Full paths are built only to be printed.
+ *
+ * The I/O and CPU limits are counting semaphores, and a limit no
+ * smaller than the crew costs nothing, since the semaphore is then
+ * never used. A file is opened, and the kernel asked to start
+ * reading it ahead, while holding an I/O slot; the scan, which
+ * mostly finds the data already on its way, holds a CPU slot.
  *
  * Special notes: On a Solaris 2.5 uniprocessor, this test will
  * not produce interleaved output unless extra LWPs are created
  * by calling thr_setconcurrency(), because threads are not
  * timesliced.
  */
+#define _GNU_SOURCE                     /* for statx */
 #include <sys/types.h>
 #include <pthread.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <unistd.h>
+#ifdef __linux__
+# include <sys/syscall.h>
+# include "uring.h"
+#endif
 #include "errors.h"
+#include "crew.h"
 
-#define CREW_SIZE       4
+#define DEQUE_MIN       64              /* initial deque size */
+#define DT_CHUNK        255             /* type of a chunk's work item */
 
-/*
- * Queued items of work for the crew. One is queued by
- * crew_start, and each worker may queue additional items.
- */
-typedef struct work_tag {
-    struct work_tag     *next;          /* Next work item */
-    char                *path; /* Directory or file */
-    char                *string;        /* Search string */
-} work_t, *work_p;
+static void crew_split_done (crew_p crew, worker_p mine, work_p work);
 
 /*
- * One of these is initialized for each worker thread in the
- * crew. It contains the "identity" of each worker.
+ * Initialize an empty deque.
  */
-typedef struct worker_tag {
-    int                 index;          /* Thread's index */
-    pthread_t           thread;         /* Thread for stage */
-    struct crew_tag     *crew;          /* Pointer to crew */
-} worker_t, *worker_p;
+static int deque_init (deque_t *deque)
+{
+    int status;
+
+    deque->item = (work_p*)malloc (DEQUE_MIN * sizeof (work_p));
+    if (deque->item == NULL)
+        return ENOMEM;
+    deque->top = deque->bottom = 0;
+    deque->size = DEQUE_MIN;
+    status = pthread_mutex_init (&deque->mutex, NULL);
+    if (status != 0)
+        free (deque->item);
+    return status;
+}
 
 /*
- * The external "handle" for a work crew. Contains the
- * crew synchronization state and staging area.
+ * Push a work item on the bottom of a deque, doubling the array if
+ * it's full.
  */
-typedef struct crew_tag {
-    int                 crew_size;      /* Size of array */
-    worker_t            crew[CREW_SIZE];/* Crew members */
-    long                work_count;     /* Count of work items */
-    work_t              *first, *last;  /* First & last work item */
-    pthread_mutex_t     mutex;          /* Mutex for crew data */
-    pthread_cond_t      done;           /* Wait for crew done */
-    pthread_cond_t      go;             /* Wait for work */
-} crew_t, *crew_p;
+static void deque_push (deque_t *deque, work_p work)
+{
+    work_p *item;
+    unsigned long index;
+    int status;
 
-size_t  path_max;                       /* Filepath length */
-size_t  name_max;                       /* Name length */
+    status = pthread_mutex_lock (&deque->mutex);
+    if (status != 0)
+        err_abort (status, "Lock deque");
+    if (deque->bottom - deque->top == deque->size) {
+        item = (work_p*)malloc (deque->size * 2 * sizeof (work_p));
+        if (item == NULL)
+            errno_abort ("Grow deque");
+        for (index = deque->top; index != deque->bottom; index++)
+            item[index & (deque->size * 2 - 1)]
+                = deque->item[index & (deque->size - 1)];
+        free (deque->item);
+        deque->item = item;
+        deque->size *= 2;
+    }
+    deque->item[deque->bottom & (deque->size - 1)] = work;
+    __atomic_store_n (&deque->bottom, deque->bottom + 1, __ATOMIC_RELAXED);
+    status = pthread_mutex_unlock (&deque->mutex);
+    if (status != 0)
+        err_abort (status, "Unlock deque");
+}
 
 /*
- * The thread start routine for crew threads. Waits until "go"
- * command, processes work items until requested to shut down.
+ * Take a work item from the bottom of our own deque ("steal" == 0)
+ * or from the top of another's, or return NULL if it's empty.
  */
-void *worker_routine (void *arg)
+static work_p deque_take (deque_t *deque, int steal)
 {
-    worker_p mine = (worker_t*)arg;
-    crew_p crew = mine->crew;
-    work_p work, new_work;
-    struct stat filestat;
-    struct dirent *entry;
+    work_p work = NULL;
     int status;
 
     /*
-     * "struct dirent" is funny, because POSIX doesn't require
-     * the definition to be more than a header for a variable
-     * buffer. Thus, allocate a "big chunk" of memory, and use
-     * it as a buffer.
+     * Don't bother a deque that looks empty.
      */
-    entry = (struct dirent*)malloc (
-        sizeof (struct dirent) + name_max);
-    if (entry == NULL)
-        errno_abort ("Allocating dirent");
-    
-    status = pthread_mutex_lock (&crew->mutex);
+    if (__atomic_load_n (&deque->bottom, __ATOMIC_RELAXED)
+        == __atomic_load_n (&deque->top, __ATOMIC_RELAXED))
+        return NULL;
+
+    status = pthread_mutex_lock (&deque->mutex);
+    if (status != 0)
+        err_abort (status, "Lock deque");
+    if (deque->bottom != deque->top) {
+        if (steal) {
+            work = deque->item[deque->top & (deque->size - 1)];
+            __atomic_store_n (&deque->top, deque->top + 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_store_n (
+                &deque->bottom, deque->bottom - 1, __ATOMIC_RELAXED);
+            work = deque->item[deque->bottom & (deque->size - 1)];
+        }
+    }
+    status = pthread_mutex_unlock (&deque->mutex);
+    if (status != 0)
+        err_abort (status, "Unlock deque");
+    return work;
+}
+
+/*
+ * Allocate from an arena, starting a new chunk when the current
+ * one is full. The first word of each chunk links to the last.
+ */
+static void *arena_alloc (arena_t *arena, size_t size)
+{
+    char *chunk;
+    size_t chunk_size;
+    void *block;
+
+    size = (size + sizeof (void*) - 1) & ~(sizeof (void*) - 1);
+    if (arena->chunk == NULL || arena->used + size > arena->size) {
+        chunk_size = sizeof (char*) + size;
+        if (chunk_size < CREW_ARENA)
+            chunk_size = CREW_ARENA;
+        chunk = (char*)malloc (chunk_size);
+        if (chunk == NULL)
+            return NULL;
+        *(char**)chunk = arena->chunk;
+        arena->chunk = chunk;
+        arena->used = sizeof (char*);
+        arena->size = chunk_size;
+    }
+    block = arena->chunk + arena->used;
+    arena->used += size;
+    return block;
+}
+
+/*
+ * Free everything allocated from an arena.
+ */
+static void arena_free (arena_t *arena)
+{
+    char *next;
+
+    while (arena->chunk != NULL) {
+        next = *(char**)arena->chunk;
+        free (arena->chunk);
+        arena->chunk = next;
+    }
+    arena->used = arena->size = 0;
+}
+
+/*
+ * Make a work item for the entry "name" of directory "parent",
+ * which it holds open until the item is finished. "type" is the
+ * entry's type (a DT_ value) if the directory listed it, or
+ * DT_UNKNOWN.
+ */
+static work_p work_new (worker_p mine,
+    work_p parent, const char *name, size_t length, unsigned char type)
+{
+    work_p work;
+
+    work = (work_p)arena_alloc (&mine->arena, sizeof (work_t) + length + 1);
+    if (work == NULL)
+        errno_abort ("Unable to allocate work");
+    work->parent = parent;
+    work->refs = 1;
+    work->fd = -1;
+    work->type = type;
+    work->part.split = NULL;
+    memcpy (work->name, name, length);
+    work->name[length] = '\0';
+    if (parent != NULL)
+        __atomic_add_fetch (&parent->refs, 1, __ATOMIC_RELAXED);
+    return work;
+}
+
+/*
+ * Finish with a work item; when it and all of its entries are
+ * finished, close its directory (or, for a split file, report it)
+ * and finish with its parent.
+ */
+static void work_release (crew_p crew, worker_p mine, work_p work)
+{
+    while (work != NULL
+        && __atomic_sub_fetch (&work->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (work->type != DT_CHUNK && work->part.split != NULL)
+            crew_split_done (crew, mine, work);
+        else if (work->fd >= 0) {
+            close (work->fd);
+            __atomic_sub_fetch (&crew->dirs_open, 1, __ATOMIC_RELAXED);
+        }
+        work = work->parent;
+    }
+}
+
+/*
+ * Build the path of a work item, relative to its ancestor "top"
+ * (or in full, if "top" is NULL), in the worker's path buffer.
+ */
+static char *work_path (worker_p mine, work_p work, work_p top)
+{
+    work_p item;
+    size_t length = 0, name;
+    char *end;
+
+    for (item = work; item != top; item = item->parent)
+        length += strlen (item->name) + 1;
+    if (length > mine->path_size) {
+        free (mine->path);
+        mine->path_size = length * 2;
+        mine->path = (char*)malloc (mine->path_size);
+        if (mine->path == NULL)
+            errno_abort ("Unable to allocate path");
+    }
+    end = mine->path + length - 1;
+    *end = '\0';
+    for (item = work; item != top; item = item->parent) {
+        name = strlen (item->name);
+        end -= name;
+        memcpy (end, item->name, name);
+        if (item->parent != top)
+            *--end = '/';
+    }
+    return mine->path;
+}
+
+/*
+ * Find the descriptor, and the name relative to it, by which to
+ * reach a work item: normally its parent directory's descriptor
+ * and its own name. If the parent was closed early (see
+ * crew_create), use the nearest ancestor still open, and the path
+ * from there.
+ */
+static int work_at (worker_p mine, work_p work, const char **name)
+{
+    work_p top;
+
+    for (top = work->parent; top != NULL && top->fd < 0; top = top->parent)
+        ;
+    if (top == work->parent)
+        *name = work->name;
+    else
+        *name = work_path (mine, work, top);
+    return top == NULL ? AT_FDCWD : top->fd;
+}
+
+/*
+ * Queue a new work item on a worker's deque, and wake an idle
+ * worker (if there is one) to steal it. The item is counted as
+ * queued before it's pushed, so that an idle worker never sees
+ * the count at zero while there's an item to take. Called
+ * without the crew mutex.
+ */
+static void crew_push (crew_p crew, worker_p worker, work_p work)
+{
+    int status;
+
+    __atomic_add_fetch (&crew->outstanding, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&crew->queued, 1, __ATOMIC_SEQ_CST);
+    deque_push (&worker->deque, work);
+    if (__atomic_load_n (&crew->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        status = pthread_mutex_lock (&crew->mutex);
+        if (status != 0)
+            err_abort (status, "Lock crew mutex");
+        status = pthread_cond_signal (&crew->go);
+        if (status != 0)
+            err_abort (status, "Signal go");
+        status = pthread_mutex_unlock (&crew->mutex);
+        if (status != 0)
+            err_abort (status, "Unlock crew mutex");
+    }
+}
+
+/*
+ * Take the next work item: the newest on our own deque or, if
+ * that's empty, the oldest on someone else's. Return NULL if
+ * there's nothing to take.
+ */
+static work_p crew_take (crew_p crew, worker_p mine)
+{
+    work_p work;
+    int victim;
+
+    work = deque_take (&mine->deque, 0);
+    for (victim = 1; work == NULL && victim < crew->crew_size; victim++)
+        work = deque_take (
+            &crew->crew[(mine->index + victim) % crew->crew_size].deque, 1);
+    if (work != NULL)
+        __atomic_sub_fetch (&crew->queued, 1, __ATOMIC_SEQ_CST);
+    return work;
+}
+
+/*
+ * Wait for one of the I/O or CPU slots limited by a semaphore, or
+ * return at once if the limit doesn't bind.
+ */
+static void crew_acquire (crew_p crew, sem_t *slots, int limit)
+{
+    if (limit >= crew->crew_size)
+        return;
+    while (sem_wait (slots) == -1) {
+        if (errno != EINTR)
+            errno_abort ("Wait for slot");
+    }
+}
+
+static void crew_release (crew_p crew, sem_t *slots, int limit)
+{
+    if (limit >= crew->crew_size)
+        return;
+    if (sem_post (slots) == -1)
+        errno_abort ("Release slot");
+}
+
+/*
+ * Write to stdout, one writer at a time (so that a large write to a
+ * pipe isn't interleaved with another).
+ */
+static void crew_write (crew_p crew, const char *data, size_t size)
+{
+    ssize_t bytes;
+    int status;
+
+    status = pthread_mutex_lock (&crew->output);
     if (status != 0)
-        err_abort (status, "Lock crew mutex");
+        err_abort (status, "Lock output");
+    while (size > 0) {
+        bytes = write (STDOUT_FILENO, data, size);
+        if (bytes < 0) {
+            if (errno == EINTR)
+                continue;
+            errno_abort ("Write output");
+        }
+        data += bytes;
+        size -= bytes;
+    }
+    status = pthread_mutex_unlock (&crew->output);
+    if (status != 0)
+        err_abort (status, "Unlock output");
+}
+
+/*
+ * Append to a worker's output, growing the buffer as needed.
+ * (Everything appended includes its null byte, which is counted
+ * in "used" only if "keep_null" is set.)
+ */
+static void output_append (
+    output_t *output, int keep_null, const char *format, ...)
+{
+    va_list args;
+    size_t size;
+    int length;
+    char *buffer;
+
+    while (1) {
+        va_start (args, format);
+        length = vsnprintf (output->buffer + output->used,
+            output->size - output->used, format, args);
+        va_end (args);
+        if (length < 0)
+            errno_abort ("Format output");
+        if (output->used + length < output->size)
+            break;
+        size = output->size * 2;
+        if (size < output->used + length + 1)
+            size = output->used + length + 1;
+        if (size < CREW_OUTPUT * 2)
+            size = CREW_OUTPUT * 2;
+        buffer = (char*)realloc (output->buffer, size);
+        if (buffer == NULL)
+            errno_abort ("Grow output");
+        output->buffer = buffer;
+        output->size = size;
+    }
+    output->used += length + (keep_null ? 1 : 0);
+}
+
+/*
+ * Start a worker's report on a work item: in sorted mode, a new
+ * record, led by the item's path.
+ */
+static void crew_report (crew_p crew, worker_p mine, work_p work)
+{
+    output_t *output = &mine->output;
+    size_t *record;
+
+    work_path (mine, work, NULL);
+    if (!crew->sorted)
+        return;
+    if (output->records == output->allocated) {
+        output->allocated = output->allocated == 0
+            ? 64 : output->allocated * 2;
+        record = (size_t*)realloc (
+            output->record, output->allocated * sizeof (size_t));
+        if (record == NULL)
+            errno_abort ("Grow output records");
+        output->record = record;
+    }
+    output->record[output->records++] = output->used;
+    output_append (output, 1, "%s", mine->path);
+}
+
+/*
+ * End a worker's report: close the record, or write the buffer
+ * out if it's full enough.
+ */
+static void crew_report_end (crew_p crew, worker_p mine)
+{
+    output_t *output = &mine->output;
+
+    if (crew->sorted)
+        output->used++;                 /* keep the null */
+    else if (output->used >= CREW_OUTPUT) {
+        crew_write (crew, output->buffer, output->used);
+        output->used = 0;
+    }
+}
+
+static int record_compare (const void *a, const void *b)
+{
+    return strcmp (*(const char**)a, *(const char**)b);
+}
+
+/*
+ * Write out what's left of the workers' output once a search is
+ * done. In sorted mode, that's all of it, so gather the records,
+ * sort them by path, and write them out in order.
+ */
+static void crew_output (crew_p crew)
+{
+    output_t *output, staging;
+    const char **record;
+    size_t records = 0, index, length;
+    int crew_index;
+
+    if (!crew->sorted) {
+        for (crew_index = 0; crew_index < crew->crew_size; crew_index++) {
+            output = &crew->crew[crew_index].output;
+            if (output->used > 0)
+                crew_write (crew, output->buffer, output->used);
+            output->used = 0;
+        }
+        return;
+    }
+
+    for (crew_index = 0; crew_index < crew->crew_size; crew_index++)
+        records += crew->crew[crew_index].output.records;
+    if (records == 0)
+        return;
+    record = (const char**)malloc (records * sizeof (char*));
+    if (record == NULL)
+        errno_abort ("Allocate output records");
+    records = 0;
+    for (crew_index = 0; crew_index < crew->crew_size; crew_index++) {
+        output = &crew->crew[crew_index].output;
+        for (index = 0; index < output->records; index++)
+            record[records++] = output->buffer + output->record[index];
+    }
+    qsort (record, records, sizeof (char*), record_compare);
+
+    memset (&staging, 0, sizeof (staging));
+    for (index = 0; index < records; index++) {
+        length = strlen (record[index]);
+        output_append (&staging, 0, "%s", record[index] + length + 1);
+        if (staging.used >= CREW_OUTPUT) {
+            crew_write (crew, staging.buffer, staging.used);
+            staging.used = 0;
+        }
+    }
+    if (staging.used > 0)
+        crew_write (crew, staging.buffer, staging.used);
+    free (staging.buffer);
+    free (record);
+    for (crew_index = 0; crew_index < crew->crew_size; crew_index++) {
+        crew->crew[crew_index].output.used = 0;
+        crew->crew[crew_index].output.records = 0;
+    }
+}
+
+/*
+ * Report a file that matched: the search string if "match" is
+ * NULL, or else each of the patterns it records.
+ */
+static void crew_found (
+    crew_p crew, worker_p mine, work_p work, acsearch_match_t *match)
+{
+    char prefix[32] = "";
+    int pattern;
+
+    if (match == NULL)
+        __atomic_add_fetch (&crew->matches, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_add_fetch (&crew->matches,
+            crew->patterns->count - match->remaining, __ATOMIC_RELAXED);
+    if (crew->quiet)
+        return;
+    crew_report (crew, mine, work);
+    if (!crew->sorted)
+        snprintf (prefix, sizeof (prefix), "Thread %d ", mine->index);
+    if (match == NULL)
+        output_append (&mine->output, 0,
+            "%sfound \"%s\" in %s\n", prefix, crew->string, mine->path);
+    else {
+        for (pattern = 0; pattern < crew->patterns->count; pattern++) {
+            if (match->matched[pattern])
+                output_append (&mine->output, 0,
+                    "%sfound \"%.*s\" in %s\n",
+                    prefix,
+                    (int)crew->patterns->length[pattern],
+                    crew->patterns->pattern[pattern],
+                    mine->path);
+        }
+    }
+    crew_report_end (crew, mine);
+}
+
+/*
+ * Finish with a work item.
+ */
+static void crew_finish (crew_p crew, worker_p mine, work_p work)
+{
+    int status;
+
+    work_release (crew, mine, work);    /* We're done with this */
 
     /*
-     * There won't be any work when the crew is created, so wait
-     * until something's put on the queue.
+     * Decrement count of outstanding work items, and wake
+     * waiters (trying to collect results or start a new
+     * calculation) if the crew is now idle.
+     *
+     * It's important that the count be decremented AFTER
+     * processing the current work item (which counted any
+     * items it queued). That ensures the count won't go to 0
+     * until we're really done.
      */
-    while (crew->work_count == 0) {
-        status = pthread_cond_wait (&crew->go, &crew->mutex);
+    if (__atomic_sub_fetch (&crew->outstanding, 1, __ATOMIC_ACQ_REL) == 0) {
+        DPRINTF (("Crew thread %d done\n", mine->index));
+        status = pthread_mutex_lock (&crew->mutex);
+        if (status != 0)
+            err_abort (status, "Lock crew mutex");
+        status = pthread_cond_broadcast (&crew->done);
         if (status != 0)
-            err_abort (status, "Wait for go");
+            err_abort (status, "Wake waiters");
+        status = pthread_mutex_unlock (&crew->mutex);
+        if (status != 0)
+            err_abort (status, "Unlock mutex");
     }
+}
 
-    status = pthread_mutex_unlock (&crew->mutex);
+/*
+ * Split a large regular file, open on "fd", into chunks of
+ * CREW_CHUNK bytes, each queued as a work item of its own for
+ * idle workers to steal. The file's item keeps the descriptor
+ * until the last chunk is finished. The chunks are pushed last
+ * first, so that we take them from the start of the file.
+ */
+static void crew_split (
+    crew_p crew, worker_p mine, work_p work, int fd, off_t size)
+{
+    split_t *split;
+    work_p chunk;
+    off_t offset;
+
+    split = (split_t*)arena_alloc (&mine->arena, sizeof (split_t));
+    if (split == NULL)
+        errno_abort ("Unable to allocate split");
+    split->size = size;
+    split->found = 0;
+    split->remaining = 0;
+    split->matched = NULL;
+    if (crew->patterns != NULL) {
+        split->remaining = crew->patterns->count;
+        split->matched = (unsigned char*)arena_alloc (
+            &mine->arena, crew->patterns->count);
+        if (split->matched == NULL)
+            errno_abort ("Unable to allocate split");
+        memset (split->matched, 0, crew->patterns->count);
+    }
+    work->fd = fd;
+    work->part.split = split;
+    for (offset = (size - 1) / CREW_CHUNK * CREW_CHUNK;
+        offset >= 0; offset -= CREW_CHUNK) {
+        chunk = work_new (mine, work, "", 0, DT_CHUNK);
+        chunk->part.offset = offset;
+        crew_push (crew, mine, chunk);
+    }
+}
+
+/*
+ * Finish with a split file, once the last of its chunks is done:
+ * report what they found between them, and close it.
+ */
+static void crew_split_done (crew_p crew, worker_p mine, work_p work)
+{
+    split_t *split = work->part.split;
+    acsearch_match_t match;
+
+    if (crew->patterns != NULL) {
+        if (split->remaining < crew->patterns->count) {
+            match.state = 0;
+            match.remaining = split->remaining;
+            match.matched = split->matched;
+            crew_found (crew, mine, work, &match);
+        }
+    } else if (split->found)
+        crew_found (crew, mine, work, NULL);
+    close (work->fd);
+}
+
+/*
+ * Search one chunk of a split file, through the first bytes of the
+ * next (so that a match starting in this chunk is found whole),
+ * and merge what it finds into the file's split state. A chunk
+ * is skipped if the others have found everything already.
+ */
+static void crew_chunk (crew_p crew, worker_p mine, work_p work)
+{
+    work_p file = work->parent;
+    split_t *split = file->part.split;
+    acsearch_match_t *match = &mine->match;
+    off_t start = work->part.offset, end, base;
+    size_t size, skip, done;
+    ssize_t bytes;
+    char *buffer;
+    int mapped, pattern, status = 0;
+
+    if (crew->patterns != NULL
+        ? __atomic_load_n (&split->remaining, __ATOMIC_RELAXED) == 0
+        : __atomic_load_n (&split->found, __ATOMIC_RELAXED) != 0)
+        return;
+
+    end = start + CREW_CHUNK + crew->overlap;
+    if (end > split->size)
+        end = split->size;
+    base = start - start % sysconf (_SC_PAGESIZE);
+    skip = start - base;
+    size = end - base;
+    crew_acquire (crew, &crew->io, crew->io_limit);
+    posix_fadvise (file->fd, base, size, POSIX_FADV_WILLNEED);
+    crew_release (crew, &crew->io, crew->io_limit);
+
+    /*
+     * Map the chunk or, if the file can't be mapped, read it.
+     */
+    buffer = (char*)mmap (NULL, size, PROT_READ, MAP_PRIVATE, file->fd, base);
+    mapped = buffer != MAP_FAILED;
+    if (mapped)
+        madvise (buffer, size, MADV_SEQUENTIAL);
+    else {
+        buffer = (char*)malloc (size);
+        if (buffer == NULL)
+            errno_abort ("Allocate chunk buffer");
+        for (done = 0; done < size; done += bytes) {
+            bytes = pread (file->fd, buffer + done, size - done, base + done);
+            if (bytes < 0 && errno == EINTR)
+                bytes = 0;
+            else if (bytes <= 0) {
+                status = bytes < 0 ? errno : 0;
+                break;                  /* (or it shrank) */
+            }
+        }
+        size = done;
+    }
+
+    crew_acquire (crew, &crew->cpu, crew->cpu_limit);
+    if (size <= skip)
+        ;
+    else if (crew->patterns == NULL) {
+        if (scan_find (&crew->scan, buffer + skip, size - skip) != NULL)
+            __atomic_store_n (&split->found, 1, __ATOMIC_RELAXED);
+    } else {
+        /*
+         * Start with what the other chunks have found marked as
+         * found, so that the scan stops as soon as this chunk has
+         * found the rest.
+         */
+        acsearch_match_reset (crew->patterns, match);
+        for (pattern = 0; pattern < crew->patterns->count; pattern++) {
+            if (__atomic_load_n (&split->matched[pattern], __ATOMIC_RELAXED)) {
+                match->matched[pattern] = 1;
+                match->remaining--;
+            }
+        }
+        acsearch_scan (crew->patterns, match, buffer + skip, size - skip);
+        for (pattern = 0; pattern < crew->patterns->count; pattern++) {
+            if (match->matched[pattern]
+                && !__atomic_exchange_n (
+                    &split->matched[pattern], 1, __ATOMIC_RELAXED))
+                __atomic_sub_fetch (&split->remaining, 1, __ATOMIC_RELAXED);
+        }
+    }
+    crew_release (crew, &crew->cpu, crew->cpu_limit);
+
+    if (mapped)
+        munmap (buffer, size);
+    else
+        free (buffer);
     if (status != 0)
-        err_abort (status, "Unlock mutex");
+        fprintf (
+            stderr, "Unable to read %s: %d (%s)\n",
+            work_path (mine, file, NULL), status, strerror (status));
+}
+
+/*
+ * With an index, decide whether a regular file needs searching:
+ * not if the index has it, unchanged, and says it can't hold what
+ * we're searching for. If it does, find it again by "*at" and
+ * "*name", since its path may have been built in their place.
+ */
+static int crew_candidate (
+    crew_p crew, worker_p mine, work_p work, int *at, const char **name)
+{
+    struct stat filestat;
+    long file;
+
+    if (fstatat (*at, *name, &filestat, AT_SYMLINK_NOFOLLOW) == -1)
+        return 1;                       /* (the search will say why) */
+    file = trigram_lookup (
+        &crew->index, work_path (mine, work, NULL), &filestat);
+    if (file >= 0 && !crew->candidate[file])
+        return 0;
+    *at = work_at (mine, work, name);
+    return 1;
+}
+
+/*
+ * Record a regular file for crew_index: as unchanged, if the older
+ * index has it with the same size and modification time, or else
+ * with the trigrams read from it. Called holding an I/O slot,
+ * which it releases.
+ */
+static void crew_index_file (
+    crew_p crew, worker_p mine, work_p work, int at, const char *name)
+{
+    struct stat filestat;
+    trigram_record_t *indexed;
+    long old = -1;
+    int fd = -1, status = 0;
+
+    if (fstatat (at, name, &filestat, AT_SYMLINK_NOFOLLOW) == -1)
+        status = errno;
+    else if (crew->index.valid == TRIGRAM_VALID)
+        old = trigram_lookup (
+            &crew->index, work_path (mine, work, NULL), &filestat);
+    if (status == 0 && old < 0) {
+        at = work_at (mine, work, &name);
+        fd = openat (at, name, O_RDONLY);
+        if (fd < 0)
+            status = errno;
+        else
+            posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+    }
+    crew_release (crew, &crew->io, crew->io_limit);
+
+    if (fd >= 0) {
+        crew_acquire (crew, &crew->cpu, crew->cpu_limit);
+        if (mine->trigrams.bits == NULL)
+            status = trigram_set_init (&mine->trigrams);
+        if (status == 0) {
+            trigram_set_reset (&mine->trigrams);
+            status = trigram_set_fd (&mine->trigrams, fd);
+        }
+        crew_release (crew, &crew->cpu, crew->cpu_limit);
+        close (fd);
+        __atomic_add_fetch (&crew->index_reads, 1, __ATOMIC_RELAXED);
+    }
+    if (status == 0 && mine->indexed_count == mine->indexed_size) {
+        mine->indexed_size = mine->indexed_size == 0
+            ? 256 : mine->indexed_size * 2;
+        indexed = (trigram_record_t*)realloc (mine->indexed,
+            mine->indexed_size * sizeof (trigram_record_t));
+        if (indexed == NULL)
+            errno_abort ("Grow index records");
+        mine->indexed = indexed;
+    }
+    if (status == 0)
+        status = trigram_record (&mine->trigrams, old,
+            &mine->indexed[mine->indexed_count],
+            work_path (mine, work, NULL), &filestat);
+    if (status == 0) {
+        mine->indexed_count++;
+        __atomic_add_fetch (&crew->index_files, 1, __ATOMIC_RELAXED);
+    } else
+        fprintf (
+            stderr, "Unable to index %s: %d (%s)\n",
+            work_path (mine, work, NULL), status, strerror (status));
+}
+
+/*
+ * Queue a work item for an entry of directory "work", unless
+ * it's "." or "..".
+ */
+static void crew_queue_entry (
+    crew_p crew, worker_p mine, work_p work, char *name, unsigned char type)
+{
+    work_p new_work;
+
+    if (name[0] == '.'
+        && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        return;
+    new_work = work_new (mine, work, name, strlen (name), type);
+    crew_push (crew, mine, new_work);
+    DPRINTF ((
+        "Crew %d: add work %#lx, %ld outstanding\n",
+        mine->index, new_work, crew->outstanding));
+}
+
+/*
+ * Queue a work item for each entry of the directory open on "fd",
+ * which is left open, noting the entry's type if the directory
+ * gives it (most file systems do) so that it needn't be looked up
+ * with fstatat(). Return 0, or an error number.
+ *
+ * On Linux, the entries are read straight into a buffer of our
+ * own, many to a system call, without a directory stream.
+ */
+#ifdef __linux__
+struct linux_dirent64 {
+    unsigned long long  d_ino;
+    long long           d_off;
+    unsigned short      d_reclen;
+    unsigned char       d_type;
+    char                d_name[];
+};
+
+static int crew_read_dir (crew_p crew, worker_p mine, work_p work, int fd)
+{
+    struct linux_dirent64 *entry;
+    long bytes, offset;
+
+    if (mine->dirents == NULL) {
+        mine->dirents = (char*)malloc (CREW_DIRENTS);
+        if (mine->dirents == NULL)
+            return ENOMEM;
+    }
+    while ((bytes = syscall (
+        SYS_getdents64, fd, mine->dirents, CREW_DIRENTS)) > 0) {
+        for (offset = 0; offset < bytes; offset += entry->d_reclen) {
+            entry = (struct linux_dirent64*)(mine->dirents + offset);
+            crew_queue_entry (crew, mine, work, entry->d_name, entry->d_type);
+        }
+    }
+    return bytes < 0 ? errno : 0;
+}
+#else
+static int crew_read_dir (crew_p crew, worker_p mine, work_p work, int fd)
+{
+    DIR *directory;
+    struct dirent *entry;
+    int status = 0;
+
+    fd = dup (fd);
+    if (fd < 0)
+        return errno;
+    directory = fdopendir (fd);
+    if (directory == NULL) {
+        status = errno;
+        close (fd);
+        return status;
+    }
+    while (1) {
+        /*
+         * readdir is thread-safe as long as no two threads
+         * share a directory stream, and this one is ours.
+         */
+        errno = 0;
+        entry = readdir (directory);
+        if (entry == NULL) {
+            status = errno;
+            break;                      /* End of directory */
+        }
+        crew_queue_entry (crew, mine, work, entry->d_name, entry->d_type);
+    }
+    closedir (directory);
+    return status;
+}
+#endif
+
+/*
+ * Directories are held open while their entries are searched,
+ * which (with many workers each deep in a tree) could use up the
+ * process's descriptors. Hold at most half of them, leaving room
+ * for the file and directory each worker has open, and the files
+ * it has in flight; beyond that, a directory is closed once it's
+ * read, and its entries are reached by their path from an
+ * ancestor.
+ */
+static void crew_limit_dirs (crew_p crew)
+{
+    long open_max;
+
+    open_max = sysconf (_SC_OPEN_MAX);
+    if (open_max < 0)
+        open_max = 1024;
+    crew->dirs_limit = open_max / 2
+        - (long)crew->crew_size * (2 + crew->uring_depth);
+    if (crew->dirs_limit < 0)
+        crew->dirs_limit = 0;
+}
+
+#ifdef __linux__
+/*
+ * The io_uring engine. Each worker has its own ring, and a fixed
+ * set of "file" slots. A regular file taken from the deque gets a
+ * slot, and its open and its statx() (both relative to its
+ * directory) are prepared on the ring; the worker then goes on
+ * taking work until it runs out, or out of slots, or comes to a
+ * directory, and only then submits everything prepared in one
+ * system call. When a file's open and stat have both completed,
+ * a read of its first block is submitted; as each read completes,
+ * the worker scans the block and submits the next, until the
+ * file matches or ends. The kernel needs a path it's given only
+ * until the request completes, but a name built in the worker's
+ * path buffer would be overwritten before then, so that's copied.
+ */
+#define URING_OPEN      0               /* user_data tags */
+#define URING_STAT      1
+#define URING_READ      2
+#define URING_TAG       3
+
+typedef struct crew_file_tag {
+    struct crew_file_tag *next;         /* Free list */
+    work_p              work;           /* File being searched */
+    char                *name;          /* Copied name, or NULL */
+    int                 fd;             /* Open file, or -1 */
+    int                 pending;        /* Of the open and stat */
+    int                 status;         /* First error */
+    const char          *failed;        /* and what it was doing */
+    int                 found;          /* Search string found */
+    struct statx        stat;
+    char                *buffer;
+    size_t              allocated;
+    off_t               offset;         /* Bytes read */
+    size_t              carry;          /* Kept from the last block */
+    acsearch_match_t    match;
+} crew_file_t;
+
+static void crew_file_done (crew_p crew, worker_p mine, crew_file_t *file)
+{
+    if (file->fd >= 0)
+        close (file->fd);
+    if (file->status != 0)
+        fprintf (
+            stderr, "Unable to %s %s: %d (%s)\n",
+            file->failed,
+            work_path (mine, file->work, NULL),
+            file->status, strerror (file->status));
+    else if (crew->patterns != NULL) {
+        if (file->match.remaining < crew->patterns->count)
+            crew_found (crew, mine, file->work, &file->match);
+    } else if (file->found)
+        crew_found (crew, mine, file->work, NULL);
+    free (file->name);
+    crew_finish (crew, mine, file->work);
+    file->next = mine->free_files;
+    mine->free_files = file;
+    mine->busy--;
+}
+
+/*
+ * Submit a read of the file's next block, or finish with it if
+ * there's nothing left to read.
+ */
+static void crew_file_read (crew_p crew, worker_p mine, crew_file_t *file)
+{
+    struct io_uring_sqe *sqe;
+    size_t size;
+    char *buffer;
+
+    if (file->status != 0 || file->offset >= (off_t)file->stat.stx_size) {
+        crew_file_done (crew, mine, file);
+        return;
+    }
+    if (file->offset == 0 && file->stat.stx_size > CREW_CHUNK) {
+        crew_split (crew, mine, file->work, file->fd, file->stat.stx_size);
+        file->fd = -1;                  /* The file's item has it now */
+        crew_file_done (crew, mine, file);
+        return;
+    }
+    size = file->stat.stx_size - file->offset;
+    if (size > CREW_URING_BLOCK)
+        size = CREW_URING_BLOCK;
+    if (file->carry + size > file->allocated) {
+        buffer = (char*)realloc (file->buffer, file->carry + size);
+        if (buffer == NULL)
+            errno_abort ("Allocate file buffer");
+        file->buffer = buffer;
+        file->allocated = file->carry + size;
+    }
+    sqe = uring_sqe (mine->uring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = file->fd;
+    sqe->addr = (unsigned long)(file->buffer + file->carry);
+    sqe->len = size;
+    sqe->off = file->offset;
+    sqe->user_data = (unsigned long)file | URING_READ;
+}
+
+/*
+ * Scan a block that's been read, and go on to the next.
+ */
+static void crew_file_scan (
+    crew_p crew, worker_p mine, crew_file_t *file, int bytes)
+{
+    size_t length, keep;
+
+    if (bytes <= 0) {
+        if (bytes < 0) {
+            file->status = -bytes;
+            file->failed = "read";
+        }
+        crew_file_done (crew, mine, file);     /* (or it shrank) */
+        return;
+    }
+    file->offset += bytes;
+    length = file->carry + bytes;
+    crew_acquire (crew, &crew->cpu, crew->cpu_limit);
+    if (crew->patterns != NULL) {
+        if (acsearch_scan (crew->patterns, &file->match,
+                file->buffer, length) == 0)
+            file->offset = file->stat.stx_size;
+    } else if (scan_find (&crew->scan, file->buffer, length) != NULL) {
+        file->found = 1;
+        file->offset = file->stat.stx_size;
+    } else {
+        /*
+         * Carry the end of the block over, in case a match spans
+         * it and the next.
+         */
+        keep = crew->scan.length - 1;
+        if (keep > length)
+            keep = length;
+        memmove (file->buffer, file->buffer + length - keep, keep);
+        file->carry = keep;
+    }
+    crew_release (crew, &crew->cpu, crew->cpu_limit);
+    crew_file_read (crew, mine, file);
+}
+
+/*
+ * Start searching a regular file: prepare its open and stat.
+ */
+static void crew_file_start (
+    crew_p crew, worker_p mine, work_p work, int at, const char *name)
+{
+    struct io_uring_sqe *sqe;
+    crew_file_t *file;
+
+    file = mine->free_files;
+    mine->free_files = file->next;
+    mine->busy++;
+    file->work = work;
+    file->name = NULL;
+    if (name != work->name) {
+        file->name = strdup (name);
+        if (file->name == NULL)
+            errno_abort ("Copy name");
+        name = file->name;
+    }
+    file->fd = -1;
+    file->pending = 2;
+    file->status = 0;
+    file->found = 0;
+    file->offset = 0;
+    file->carry = 0;
+    if (crew->patterns != NULL)
+        acsearch_match_reset (crew->patterns, &file->match);
+
+    sqe = uring_sqe (mine->uring);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = at;
+    sqe->addr = (unsigned long)name;
+    sqe->open_flags = O_RDONLY;
+    sqe->user_data = (unsigned long)file | URING_OPEN;
+    sqe = uring_sqe (mine->uring);
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = at;
+    sqe->addr = (unsigned long)name;
+    sqe->off = (unsigned long)&file->stat;
+    sqe->len = STATX_SIZE;
+    sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+    sqe->user_data = (unsigned long)file | URING_STAT;
+}
+
+/*
+ * Submit everything prepared, wait until at least "wait" requests
+ * have completed, and then deal with every completion there is.
+ */
+static void crew_file_reap (crew_p crew, worker_p mine, unsigned wait)
+{
+    struct io_uring_cqe *cqe;
+    crew_file_t *file;
+    unsigned long tag;
+    int result, status;
+
+    status = uring_submit (mine->uring, wait);
+    if (status != 0)
+        err_abort (status, "Submit to ring");
+    while ((cqe = uring_cqe (mine->uring)) != NULL) {
+        file = (crew_file_t*)(unsigned long)(cqe->user_data & ~URING_TAG);
+        tag = cqe->user_data & URING_TAG;
+        result = cqe->res;
+        uring_cqe_seen (mine->uring);
+        if (tag == URING_READ) {
+            crew_file_scan (crew, mine, file, result);
+            continue;
+        }
+        if (result < 0 && file->status == 0) {
+            file->status = -result;
+            file->failed = tag == URING_OPEN ? "open" : "stat";
+        } else if (tag == URING_OPEN && result >= 0)
+            file->fd = result;
+        if (--file->pending == 0)
+            crew_file_read (crew, mine, file);
+    }
+}
+
+/*
+ * Free the workers' rings and file slots.
+ */
+static void crew_uring_free (crew_p crew)
+{
+    crew_file_t *files;
+    int crew_index, index;
+
+    for (crew_index = 0; crew_index < crew->crew_size; crew_index++) {
+        files = crew->crew[crew_index].files;
+        if (crew->crew[crew_index].uring != NULL) {
+            uring_destroy (crew->crew[crew_index].uring);
+            free (crew->crew[crew_index].uring);
+        }
+        for (index = 0; files != NULL && index < crew->uring_depth; index++) {
+            free (files[index].buffer);
+            acsearch_match_destroy (&files[index].match);
+        }
+        free (files);
+        crew->crew[crew_index].uring = NULL;
+        crew->crew[crew_index].files = NULL;
+        crew->crew[crew_index].free_files = NULL;
+    }
+    crew->uring_depth = 0;
+    crew_limit_dirs (crew);
+}
+#endif
+
+/*
+ * The thread start routine for crew threads. Waits until there's
+ * work, and processes work items until the crew is destroyed.
+ */
+static void *worker_routine (void *arg)
+{
+    worker_p mine = (worker_t*)arg;
+    crew_p crew = mine->crew;
+    work_p work;
+    struct stat filestat;
+    const char *name;
+    mode_t mode;
+    int at, status;
 
     DPRINTF (("Crew %d starting\n", mine->index));
 
@@ -103,383 +1202,758 @@ void *worker_routine (void *arg)
      */
     while (1) {
         /*
-         * Wait while there is nothing to do, and
-         * the hope of something coming along later. If
-         * crew->first is NULL, there's no work. But if
-         * crew->work_count goes to zero, we're done.
+         * With the io_uring engine, take new work only while
+         * there's a slot for a file; otherwise, or if there's no
+         * work to take, wait for the files in flight.
          */
-        status = pthread_mutex_lock (&crew->mutex);
-        if (status != 0)
-            err_abort (status, "Lock crew mutex");
-
-        DPRINTF (("Crew %d top: first is %#lx, count is %d\n",
-                  mine->index, crew->first, crew->work_count));
-        while (crew->first == NULL) {
-            status = pthread_cond_wait (&crew->go, &crew->mutex);
+        work = NULL;
+        if (mine->uring == NULL || mine->free_files != NULL)
+            work = crew_take (crew, mine);
+#ifdef __linux__
+        if (work == NULL && mine->busy > 0) {
+            crew_file_reap (crew, mine, 1);
+            continue;
+        }
+#endif
+        if (work == NULL) {
+            /*
+             * Wait while there is nothing to take. We count
+             * ourselves as sleeping before checking the queued
+             * count; crew_push counts the item before checking for
+             * sleepers, so one of us will see the other.
+             */
+            status = pthread_mutex_lock (&crew->mutex);
             if (status != 0)
-                err_abort (status, "Wait for work");
+                err_abort (status, "Lock crew mutex");
+            __atomic_add_fetch (&crew->sleepers, 1, __ATOMIC_SEQ_CST);
+            while (__atomic_load_n (&crew->queued, __ATOMIC_SEQ_CST) == 0
+                && !crew->shutdown) {
+                status = pthread_cond_wait (&crew->go, &crew->mutex);
+                if (status != 0)
+                    err_abort (status, "Wait for work");
+            }
+            __atomic_sub_fetch (&crew->sleepers, 1, __ATOMIC_SEQ_CST);
+            if (crew->shutdown) {
+                status = pthread_mutex_unlock (&crew->mutex);
+                if (status != 0)
+                    err_abort (status, "Unlock mutex");
+                DPRINTF (("Crew %d shutting down\n", mine->index));
+                return NULL;
+            }
+            status = pthread_mutex_unlock (&crew->mutex);
+            if (status != 0)
+                err_abort (status, "Unlock mutex");
+            continue;
         }
 
-        DPRINTF (("Crew %d woke: %#lx, %d\n",
-                  mine->index, crew->first, crew->work_count));
+        DPRINTF (("Crew %d took %#lx\n", mine->index, work));
 
         /*
-         * Remove and process a work item
+         * A chunk of a split file needs no lookup; the file is
+         * open already.
          */
-        work = crew->first;
-        crew->first = work->next;
-        if (crew->first == NULL)
-            crew->last = NULL;
-
-        DPRINTF (("Crew %d took %#lx, leaves first %#lx, last %#lx\n",
-                  mine->index, work, crew->first, crew->last));
-
-        status = pthread_mutex_unlock (&crew->mutex);
-        if (status != 0)
-            err_abort (status, "Unlock mutex");
+        if (work->type == DT_CHUNK) {
+            crew_chunk (crew, mine, work);
+            crew_finish (crew, mine, work);
+#ifdef __linux__
+            if (mine->busy > 0)
+                crew_file_reap (crew, mine, 0);
+#endif
+            continue;
+        }
 
         /*
          * We have a work item. Process it, which may involve
          * queuing new work items.
          */
-        status = lstat (work->path, &filestat);
+        at = work_at (mine, work, &name);
+        crew_acquire (crew, &crew->io, crew->io_limit);
+        mode = DTTOIF (work->type);
+        status = 0;
+        if (work->type == DT_UNKNOWN) {
+            status = fstatat (at, name, &filestat, AT_SYMLINK_NOFOLLOW);
+            mode = filestat.st_mode;
+        }
 
-        if (S_ISLNK (filestat.st_mode))
-            printf (
-                "Thread %d: %s is a link, skipping.\n",
-                mine->index,
-                work->path);
-        else if (S_ISDIR (filestat.st_mode)) {
-            DIR *directory;
-            struct dirent *result;
+        if (status != 0) {
+            crew_release (crew, &crew->io, crew->io_limit);
+            fprintf (
+                stderr, "Unable to stat %s: %d (%s)\n",
+                work_path (mine, work, NULL),
+                errno, strerror (errno));
+        } else if (S_ISLNK (mode)) {
+            crew_release (crew, &crew->io, crew->io_limit);
+            if (!crew->quiet) {
+                crew_report (crew, mine, work);
+                if (crew->sorted)
+                    output_append (&mine->output, 0,
+                        "%s is a link, skipping.\n", mine->path);
+                else
+                    output_append (&mine->output, 0,
+                        "Thread %d: %s is a link, skipping.\n",
+                        mine->index, mine->path);
+                crew_report_end (crew, mine);
+            }
+        } else if (S_ISDIR (mode)) {
+            int fd;
 
             /*
              * If the file is a directory, search it and place
-             * all files onto the queue as new work items.
+             * all files onto the queue as new work items. Its
+             * entries are found through its descriptor, which is
+             * kept open until they're finished -- unless too many
+             * directories are open already, in which case they're
+             * found by their path from an ancestor that's open.
              */
-            directory = opendir (work->path);
-            if (directory == NULL) {
+            fd = openat (at, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            if (fd < 0)
                 fprintf (
                     stderr, "Unable to open directory %s: %d (%s)\n",
-                    work->path,
+                    work_path (mine, work, NULL),
                     errno, strerror (errno));
-                continue;
-            }
-            
-            while (1) {
-                status = readdir_r (directory, entry, &result);
-                if (status != 0) {
+            else {
+                if (__atomic_add_fetch (&crew->dirs_open, 1, __ATOMIC_RELAXED)
+                    <= crew->dirs_limit)
+                    work->fd = fd;
+                else
+                    __atomic_sub_fetch (&crew->dirs_open, 1, __ATOMIC_RELAXED);
+                status = crew_read_dir (crew, mine, work, fd);
+                if (status != 0)
                     fprintf (
-                        stderr,
-                        "Unable to read directory %s: %d (%s)\n",
-                        work->path,
+                        stderr, "Unable to read directory %s: %d (%s)\n",
+                        work_path (mine, work, NULL),
                         status, strerror (status));
-                    break;
-                }
-                if (result == NULL)
-                    break;              /* End of directory */
-                
-                /*
-                 * Ignore "." and ".." entries.
-                 */
-                if (strcmp (entry->d_name, ".") == 0)
-                    continue;
-                if (strcmp (entry->d_name, "..") == 0)
-                    continue;
-                new_work = (work_p)malloc (sizeof (work_t));
-                if (new_work == NULL)
-                    errno_abort ("Unable to allocate space");
-                new_work->path = (char*)malloc (path_max);
-                if (new_work->path == NULL)
-                    errno_abort ("Unable to allocate path");
-                strcpy (new_work->path, work->path);
-                strcat (new_work->path, "/");
-                strcat (new_work->path, entry->d_name);
-                new_work->string = work->string;
-                new_work->next = NULL;
-                status = pthread_mutex_lock (&crew->mutex);
-                if (status != 0)
-                    err_abort (status, "Lock mutex");
-                if (crew->first == NULL) {
-                    crew->first = new_work;
-                    crew->last = new_work;
-                } else {
-                    crew->last->next = new_work;
-                    crew->last = new_work;
-                }
-                crew->work_count++;
-                DPRINTF ((
-                    "Crew %d: add work %#lx, first %#lx, last %#lx, %d\n",
-                    mine->index, new_work, crew->first,
-                    crew->last, crew->work_count));
-                status = pthread_cond_signal (&crew->go);
-                status = pthread_mutex_unlock (&crew->mutex);
-                if (status != 0)
-                    err_abort (status, "Unlock mutex");
+                if (work->fd != fd)
+                    close (fd);
+            }
+            crew_release (crew, &crew->io, crew->io_limit);
+        } else if (S_ISREG (mode) && crew->indexing)
+            crew_index_file (crew, mine, work, at, name);
+        else if (S_ISREG (mode) && crew->index.valid == TRIGRAM_VALID
+            && !crew_candidate (crew, mine, work, &at, &name))
+            crew_release (crew, &crew->io, crew->io_limit);
+        else if (S_ISREG (mode)) {
+            off_t offset;
+            int search, split;
+
+#ifdef __linux__
+            if (mine->uring != NULL) {
+                crew_file_start (crew, mine, work, at, name);
+                crew_release (crew, &crew->io, crew->io_limit);
+                continue;
             }
-            
-            closedir (directory);
-        } else if (S_ISREG (filestat.st_mode)) {
-            FILE *search;
-            char buffer[256], *bufptr, *search_ptr;
+#endif
 
             /*
              * If this is a file, not a directory, then search
-             * it for the string.
+             * it for the string. Start the kernel reading it
+             * before giving up the I/O slot, so that it's on its
+             * way while we wait for a CPU slot. A large file is
+             * split into chunks instead, each read as it's taken.
              */
-            search = fopen (work->path, "r");
-            if (search == NULL)
+            search = openat (at, name, O_RDONLY);
+            split = search >= 0 && fstat (search, &filestat) == 0
+                && filestat.st_size > CREW_CHUNK;
+            if (search >= 0 && !split)
+                posix_fadvise (search, 0, 0, POSIX_FADV_WILLNEED);
+            crew_release (crew, &crew->io, crew->io_limit);
+            if (search < 0)
                 fprintf (
                     stderr, "Unable to open %s: %d (%s)\n",
-                    work->path,
+                    work_path (mine, work, NULL),
                     errno, strerror (errno));
-            else {
-
-                while (1) {
-                    bufptr = fgets (
-                        buffer, sizeof (buffer), search);
-                    if (bufptr == NULL) {
-                        if (feof (search))
-                            break;
-                        if (ferror (search)) {
-                            fprintf (
-                                stderr,
-                                "Unable to read %s: %d (%s)\n",
-                                work->path,
-                                errno, strerror (errno));
-                            break;
-                        }
-                    }
-                    search_ptr = strstr (buffer, work->string);
-                    if (search_ptr != NULL) {
-                        flockfile (stdout);
-                        printf (
-                            "Thread %d found \"%s\" in %s\n",
-                            mine->index, work->string, work->path);
-#if 0
-                        printf ("%s\n", buffer);
-#endif
-                        funlockfile (stdout);
-                        break;
-                    }
-                }
-                fclose (search);
+            else if (split)
+                crew_split (crew, mine, work, search, filestat.st_size);
+            else if (crew->patterns != NULL) {
+                crew_acquire (crew, &crew->cpu, crew->cpu_limit);
+                acsearch_match_reset (crew->patterns, &mine->match);
+                status = acsearch_fd (crew->patterns, &mine->match, search);
+                crew_release (crew, &crew->cpu, crew->cpu_limit);
+                if (status != 0)
+                    fprintf (
+                        stderr,
+                        "Unable to read %s: %d (%s)\n",
+                        work_path (mine, work, NULL),
+                        status, strerror (status));
+                else if (mine->match.remaining < crew->patterns->count)
+                    crew_found (crew, mine, work, &mine->match);
+                close (search);
+            } else {
+                crew_acquire (crew, &crew->cpu, crew->cpu_limit);
+                status = scan_fd (&crew->scan, search, &offset);
+                crew_release (crew, &crew->cpu, crew->cpu_limit);
+                if (status != 0)
+                    fprintf (
+                        stderr,
+                        "Unable to read %s: %d (%s)\n",
+                        work_path (mine, work, NULL),
+                        status, strerror (status));
+                else if (offset >= 0)
+                    crew_found (crew, mine, work, NULL);
+                close (search);
             }
-        } else
+        } else {
+            crew_release (crew, &crew->io, crew->io_limit);
             fprintf (
                 stderr,
                 "Thread %d: %s is type %o (%s))\n",
                 mine->index,
-                work->path,
-                filestat.st_mode & S_IFMT,
-                (S_ISFIFO (filestat.st_mode) ? "FIFO"
-                 : (S_ISCHR (filestat.st_mode) ? "CHR"
-                    : (S_ISBLK (filestat.st_mode) ? "BLK"
-                       : (S_ISSOCK (filestat.st_mode) ? "SOCK"
+                work_path (mine, work, NULL),
+                mode & S_IFMT,
+                (S_ISFIFO (mode) ? "FIFO"
+                 : (S_ISCHR (mode) ? "CHR"
+                    : (S_ISBLK (mode) ? "BLK"
+                       : (S_ISSOCK (mode) ? "SOCK"
                           : "unknown")))));
-
-        free (work->path);              /* Free path buffer */
-        free (work);                    /* We're done with this */
-
-        /*
-         * Decrement count of outstanding work items, and wake
-         * waiters (trying to collect results or start a new
-         * calculation) if the crew is now idle.
-         *
-         * It's important that the count be decremented AFTER
-         * processing the current work item. That ensures the
-         * count won't go to 0 until we're really done.
-         */
-        status = pthread_mutex_lock (&crew->mutex);
-        if (status != 0)
-            err_abort (status, "Lock crew mutex");
-
-        crew->work_count--;
-        DPRINTF (("Crew %d decremented work to %d\n", mine->index,
-                  crew->work_count));
-        if (crew->work_count <= 0) {
-            DPRINTF (("Crew thread %d done\n", mine->index));
-            status = pthread_cond_broadcast (&crew->done);
-            if (status != 0)
-                err_abort (status, "Wake waiters");
-            status = pthread_mutex_unlock (&crew->mutex);
-            if (status != 0)
-                err_abort (status, "Unlock mutex");
-            break;
         }
 
-        status = pthread_mutex_unlock (&crew->mutex);
-        if (status != 0)
-            err_abort (status, "Unlock mutex");
-
+        crew_finish (crew, mine, work);
+#ifdef __linux__
+        if (mine->busy > 0)
+            crew_file_reap (crew, mine, 0);
+#endif
     }
 
-    free (entry);
     return NULL;
 }
 
 /*
- * Create a work crew.
+ * Create a work crew of "crew_size" workers, of which at most
+ * "io_limit" at a time read directories and open files, and at
+ * most "cpu_limit" at a time scan them. A value that's 0 (or less)
+ * takes the default described in crew.h.
  */
-int crew_create (crew_t *crew, int crew_size)
+int crew_create (crew_t *crew, int crew_size, int io_limit, int cpu_limit)
 {
+    long online;
     int crew_index;
     int status;
 
-    /*
-     * We won't create more than CREW_SIZE members
-     */
-    if (crew_size > CREW_SIZE)
-        return EINVAL;
+    online = sysconf (_SC_NPROCESSORS_ONLN);
+    if (online < 1)
+        online = 1;
+    if (crew_size <= 0)
+        crew_size = online;
+    if (io_limit <= 0)
+        io_limit = crew_size;
+    if (cpu_limit <= 0)
+        cpu_limit = online;
 
     crew->crew_size = crew_size;
-    crew->work_count = 0;
-    crew->first = NULL;
-    crew->last = NULL;
+    crew->io_limit = io_limit;
+    crew->cpu_limit = cpu_limit;
+    crew->outstanding = 0;
+    crew->queued = 0;
+    crew->sleepers = 0;
+    crew->shutdown = 0;
+    crew->quiet = 0;
+    crew->sorted = 0;
+    crew->uring_depth = 0;
+    crew->matches = 0;
+    crew->dirs_open = 0;
+    crew->string = NULL;
+    crew->patterns = NULL;
+    memset (&crew->index, 0, sizeof (trigram_t));
+    crew->candidate = NULL;
+    crew->indexing = 0;
+    crew->index_files = 0;
+    crew->index_reads = 0;
+    crew_limit_dirs (crew);
 
     /*
-     * Initialize synchronization objects
+     * The workers are allocated on cache line boundaries, so that
+     * each one's deque is in a line of its own.
      */
-    status = pthread_mutex_init (&crew->mutex, NULL);
+    status = posix_memalign ((void**)&crew->crew,
+        CREW_CACHELINE, crew_size * sizeof (worker_t));
     if (status != 0)
         return status;
+
+    /*
+     * Initialize synchronization objects. If one can't be, undo
+     * whatever was done before it (at the end).
+     */
+    if (sem_init (&crew->io, 0, io_limit) == -1) {
+        status = errno;
+        goto free_crew;
+    }
+    if (sem_init (&crew->cpu, 0, cpu_limit) == -1) {
+        status = errno;
+        goto destroy_io;
+    }
+    status = pthread_mutex_init (&crew->mutex, NULL);
+    if (status != 0)
+        goto destroy_cpu;
+    status = pthread_mutex_init (&crew->output, NULL);
+    if (status != 0)
+        goto destroy_mutex;
     status = pthread_cond_init (&crew->done, NULL);
     if (status != 0)
-        return status;
+        goto destroy_output;
     status = pthread_cond_init (&crew->go, NULL);
     if (status != 0)
-        return status;
+        goto destroy_done;
 
     /*
-     * Create the worker threads.
+     * Create the worker threads, once all of the deques they may
+     * steal from are ready.
      */
-    for (crew_index = 0; crew_index < CREW_SIZE; crew_index++) {
+    for (crew_index = 0; crew_index < crew_size; crew_index++) {
         crew->crew[crew_index].index = crew_index;
         crew->crew[crew_index].crew = crew;
+        crew->crew[crew_index].match.matched = NULL;
+        crew->crew[crew_index].arena.chunk = NULL;
+        crew->crew[crew_index].arena.used = 0;
+        crew->crew[crew_index].arena.size = 0;
+        crew->crew[crew_index].path = NULL;
+        crew->crew[crew_index].path_size = 0;
+        crew->crew[crew_index].dirents = NULL;
+        crew->crew[crew_index].uring = NULL;
+        crew->crew[crew_index].files = NULL;
+        crew->crew[crew_index].free_files = NULL;
+        crew->crew[crew_index].busy = 0;
+        memset (&crew->crew[crew_index].output, 0, sizeof (output_t));
+        memset (&crew->crew[crew_index].trigrams, 0, sizeof (trigram_set_t));
+        crew->crew[crew_index].indexed = NULL;
+        crew->crew[crew_index].indexed_count = 0;
+        crew->crew[crew_index].indexed_size = 0;
+        status = deque_init (&crew->crew[crew_index].deque);
+        if (status != 0)
+            goto destroy_deques;
+    }
+    for (crew_index = 0; crew_index < crew_size; crew_index++) {
         status = pthread_create (&crew->crew[crew_index].thread,
             NULL, worker_routine, (void*)&crew->crew[crew_index]);
         if (status != 0)
             err_abort (status, "Create worker");
     }
+    crew->valid = CREW_VALID;
     return 0;
+
+  destroy_deques:
+    while (--crew_index >= 0) {
+        free (crew->crew[crew_index].deque.item);
+        pthread_mutex_destroy (&crew->crew[crew_index].deque.mutex);
+    }
+    pthread_cond_destroy (&crew->go);
+  destroy_done:
+    pthread_cond_destroy (&crew->done);
+  destroy_output:
+    pthread_mutex_destroy (&crew->output);
+  destroy_mutex:
+    pthread_mutex_destroy (&crew->mutex);
+  destroy_cpu:
+    sem_destroy (&crew->cpu);
+  destroy_io:
+    sem_destroy (&crew->io);
+  free_crew:
+    free (crew->crew);
+    return status;
 }
 
 /*
- * Pass a file path to a work crew previously created
- * using crew_create
+ * Destroy a work crew: wait for any search to finish, then tell
+ * the workers to quit, and wait for them.
  */
-int crew_start (
-    crew_p crew,
-    char *filepath,
-    char *search)
+int crew_destroy (crew_t *crew)
 {
-    work_p request;
+    int crew_index;
     int status;
 
+    if (crew->valid != CREW_VALID)
+        return EINVAL;
+
     status = pthread_mutex_lock (&crew->mutex);
     if (status != 0)
         return status;
-
-    /*
-     * If the crew is busy, wait for them to finish.
-     */
-    while (crew->work_count > 0) {
+    while (__atomic_load_n (&crew->outstanding, __ATOMIC_ACQUIRE) > 0) {
         status = pthread_cond_wait (&crew->done, &crew->mutex);
         if (status != 0) {
             pthread_mutex_unlock (&crew->mutex);
             return status;
         }
     }
+    crew->valid = 0;
+    crew->shutdown = 1;
+    status = pthread_cond_broadcast (&crew->go);
+    if (status != 0) {
+        pthread_mutex_unlock (&crew->mutex);
+        return status;
+    }
+    status = pthread_mutex_unlock (&crew->mutex);
+    if (status != 0)
+        return status;
 
-    errno = 0;
-    path_max = pathconf (filepath, _PC_PATH_MAX);
-    if (path_max == -1) {
-        if (errno == 0)
-            path_max = 1024;             /* "No limit" */
-        else
-            errno_abort ("Unable to get PATH_MAX");
+    for (crew_index = 0; crew_index < crew->crew_size; crew_index++) {
+        status = pthread_join (crew->crew[crew_index].thread, NULL);
+        if (status != 0)
+            return status;
+        acsearch_match_destroy (&crew->crew[crew_index].match);
+        free (crew->crew[crew_index].path);
+        free (crew->crew[crew_index].dirents);
+        free (crew->crew[crew_index].output.buffer);
+        free (crew->crew[crew_index].output.record);
+        trigram_set_destroy (&crew->crew[crew_index].trigrams);
+        free (crew->crew[crew_index].indexed);
+        free (crew->crew[crew_index].deque.item);
+        pthread_mutex_destroy (&crew->crew[crew_index].deque.mutex);
     }
-    errno = 0;
-    name_max = pathconf (filepath, _PC_NAME_MAX);
-    if (name_max == -1) {
-        if (errno == 0)
-            name_max = 256;             /* "No limit" */
-        else
-            errno_abort ("Unable to get NAME_MAX");
+#ifdef __linux__
+    crew_uring_free (crew);
+#endif
+    if (crew->index.valid == TRIGRAM_VALID)
+        trigram_close (&crew->index);
+    free (crew->candidate);
+    free (crew->crew);
+    sem_destroy (&crew->io);
+    sem_destroy (&crew->cpu);
+    pthread_mutex_destroy (&crew->mutex);
+    pthread_mutex_destroy (&crew->output);
+    pthread_cond_destroy (&crew->done);
+    pthread_cond_destroy (&crew->go);
+    return 0;
+}
+
+/*
+ * Have each worker of an idle crew keep up to "depth" files in
+ * flight through an io_uring of its own, or (if "depth" is 0) go
+ * back to reading files itself. Return ENOSYS if the system can't
+ * open, stat, and read files through io_uring.
+ */
+int crew_use_uring (crew_t *crew, int depth)
+{
+#ifdef __linux__
+    static const int ops[] = {
+        IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ};
+    worker_p worker;
+    int crew_index, index;
+    int status = 0;
+
+    if (crew->valid != CREW_VALID || depth < 0)
+        return EINVAL;
+
+    status = pthread_mutex_lock (&crew->mutex);
+    if (status != 0)
+        return status;
+    while (__atomic_load_n (&crew->outstanding, __ATOMIC_ACQUIRE) > 0) {
+        status = pthread_cond_wait (&crew->done, &crew->mutex);
+        if (status != 0) {
+            pthread_mutex_unlock (&crew->mutex);
+            return status;
+        }
     }
-    DPRINTF ((
-        "PATH_MAX for %s is %ld, NAME_MAX is %ld\n",
-        filepath, path_max, name_max));
-    path_max++;                         /* Add null byte */
-    name_max++;                         /* Add null byte */
-    request = (work_p)malloc (sizeof (work_t));
-    if (request == NULL)
-        errno_abort ("Unable to allocate request");
-    DPRINTF (("Requesting %s\n", filepath));
-    request->path = (char*)malloc (path_max);
-    if (request->path == NULL)
-        errno_abort ("Unable to allocate path");
-    strcpy (request->path, filepath);
-    request->string = search;
-    request->next = NULL;
-    if (crew->first == NULL) {
-        crew->first = request;
-        crew->last = request;
-    } else {
-        crew->last->next = request;
-        crew->last = request;
+    crew_uring_free (crew);
+
+    /*
+     * Each file has at most two requests prepared at once.
+     */
+    for (crew_index = 0;
+        depth > 0 && crew_index < crew->crew_size; crew_index++) {
+        worker = &crew->crew[crew_index];
+        worker->files = (struct crew_file_tag*)calloc (
+            depth, sizeof (struct crew_file_tag));
+        if (worker->files == NULL) {
+            status = ENOMEM;
+            break;
+        }
+        for (index = 0; index < depth; index++) {
+            worker->files[index].next = worker->free_files;
+            worker->free_files = &worker->files[index];
+        }
+        worker->uring = (uring_t*)malloc (sizeof (uring_t));
+        if (worker->uring == NULL) {
+            status = ENOMEM;
+            break;
+        }
+        status = uring_init (worker->uring, 2 * depth);
+        if (status == 0)
+            status = uring_supports (
+                worker->uring, ops, sizeof (ops) / sizeof (ops[0]));
+        else {
+            free (worker->uring);
+            worker->uring = NULL;
+        }
+        if (status != 0)
+            break;
     }
+    crew->uring_depth = depth;
+    if (status != 0)
+        crew_uring_free (crew);
+    crew_limit_dirs (crew);
+    pthread_mutex_unlock (&crew->mutex);
+    return status;
+#else
+    return depth == 0 ? 0 : ENOSYS;
+#endif
+}
+
+/*
+ * Search (or index) the tree "filepath" with an idle crew, whose
+ * mutex we hold, and wait until it's done.
+ */
+static void crew_run (crew_p crew, char *filepath)
+{
+    work_p request;
+    int crew_index, status;
 
-    crew->work_count++;
+    DPRINTF (("Requesting %s\n", filepath));
+    request = work_new (
+        &crew->crew[0], NULL, filepath, strlen (filepath), DT_UNKNOWN);
+
+    /*
+     * Queue the request on the first worker's deque (as crew_push
+     * would, but we already hold the crew mutex).
+     */
+    __atomic_add_fetch (&crew->outstanding, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&crew->queued, 1, __ATOMIC_SEQ_CST);
+    deque_push (&crew->crew[0].deque, request);
     status = pthread_cond_signal (&crew->go);
-    if (status != 0) {
-        free (crew->first);
-        crew->first = NULL;
-        crew->work_count = 0;
-        pthread_mutex_unlock (&crew->mutex);
-        return status;
-    }
-    while (crew->work_count > 0) {
+    if (status != 0)
+        err_abort (status, "Signal go");
+    while (__atomic_load_n (&crew->outstanding, __ATOMIC_ACQUIRE) > 0) {
         status = pthread_cond_wait (&crew->done, &crew->mutex);
         if (status != 0)
             err_abort (status, "waiting for crew to finish");
     }
-    status = pthread_mutex_unlock (&crew->mutex);
+
+    /*
+     * Every item has been finished, so the workers' output can be
+     * written, and the work items can all be freed at once.
+     */
+    crew_output (crew);
+    for (crew_index = 0; crew_index < crew->crew_size; crew_index++)
+        arena_free (&crew->crew[crew_index].arena);
+}
+
+/*
+ * Replace an idle crew's index (whose mutex we hold) with the one
+ * in the file "index_path", or with none if that's NULL.
+ */
+static int crew_open_index (crew_p crew, const char *index_path)
+{
+    int status;
+
+    if (crew->index.valid == TRIGRAM_VALID)
+        trigram_close (&crew->index);
+    free (crew->candidate);
+    crew->candidate = NULL;
+    if (index_path == NULL)
+        return 0;
+    status = trigram_open (&crew->index, index_path);
     if (status != 0)
-        err_abort (status, "Unlock crew mutex");
+        return status;
+    crew->candidate = (unsigned char*)malloc (crew->index.header->files + 1);
+    if (crew->candidate == NULL) {
+        trigram_close (&crew->index);
+        return ENOMEM;
+    }
     return 0;
 }
 
 /*
- * The main program to "drive" the crew...
+ * Have an idle crew use the index in the file "index_path" to skip
+ * files that can't match, or (if it's NULL) stop using one. Return
+ * an error number from opening the file, or EINVAL if it isn't an
+ * index.
  */
-int main (int argc, char *argv[])
+int crew_use_index (crew_t *crew, const char *index_path)
 {
-    crew_t my_crew;
-    char line[128], *next;
     int status;
 
-    if (argc < 3) {
-        fprintf (stderr, "Usage: %s string path\n", argv[0]);
-        return -1;
+    if (crew->valid != CREW_VALID)
+        return EINVAL;
+
+    status = pthread_mutex_lock (&crew->mutex);
+    if (status != 0)
+        return status;
+    while (__atomic_load_n (&crew->outstanding, __ATOMIC_ACQUIRE) > 0) {
+        status = pthread_cond_wait (&crew->done, &crew->mutex);
+        if (status != 0) {
+            pthread_mutex_unlock (&crew->mutex);
+            return status;
+        }
+    }
+    status = crew_open_index (crew, index_path);
+    pthread_mutex_unlock (&crew->mutex);
+    return status;
+}
+
+/*
+ * Index the tree "filepath" into the file "index_path", bringing
+ * the index that's there up to date (or, if there's none, or it
+ * isn't an index, starting afresh), and have the crew use the new
+ * index from now on.
+ */
+int crew_index (crew_t *crew, char *filepath, const char *index_path)
+{
+    trigram_record_t *records;
+    worker_p worker;
+    size_t count = 0, index;
+    int crew_index, status;
+
+    if (crew->valid != CREW_VALID)
+        return EINVAL;
+
+    status = pthread_mutex_lock (&crew->mutex);
+    if (status != 0)
+        return status;
+    while (__atomic_load_n (&crew->outstanding, __ATOMIC_ACQUIRE) > 0) {
+        status = pthread_cond_wait (&crew->done, &crew->mutex);
+        if (status != 0) {
+            pthread_mutex_unlock (&crew->mutex);
+            return status;
+        }
+    }
+    status = crew_open_index (crew, index_path);
+    if (status != 0 && status != ENOENT && status != EINVAL) {
+        pthread_mutex_unlock (&crew->mutex);
+        return status;
     }
+    crew->index_files = 0;
+    crew->index_reads = 0;
+    crew->indexing = 1;
+    crew_run (crew, filepath);
+    crew->indexing = 0;
 
-#ifdef sun
     /*
-     * On Solaris 2.5, threads are not timesliced. To ensure
-     * that our threads can run concurrently, we need to
-     * increase the concurrency level to CREW_SIZE.
+     * Gather the workers' records, and write the new index. (The
+     * trigrams of unchanged files are filled in from the old index
+     * in the gathered copies, so it's those that are freed.)
      */
-    DPRINTF (("Setting concurrency level to %d\n", CREW_SIZE));
-    thr_setconcurrency (CREW_SIZE);
+    for (crew_index = 0; crew_index < crew->crew_size; crew_index++)
+        count += crew->crew[crew_index].indexed_count;
+    records = (trigram_record_t*)malloc (
+        count * sizeof (trigram_record_t) + 1);
+    count = 0;
+    for (crew_index = 0; crew_index < crew->crew_size; crew_index++) {
+        worker = &crew->crew[crew_index];
+        for (index = 0; index < worker->indexed_count; index++) {
+            if (records != NULL)
+                records[count++] = worker->indexed[index];
+            else
+                trigram_record_destroy (&worker->indexed[index]);
+        }
+        worker->indexed_count = 0;
+        trigram_set_destroy (&worker->trigrams);
+    }
+    if (records == NULL)
+        status = ENOMEM;
+    else {
+        status = trigram_write (index_path,
+            crew->index.valid == TRIGRAM_VALID ? &crew->index : NULL,
+            records, count);
+        for (index = 0; index < count; index++)
+            trigram_record_destroy (&records[index]);
+        free (records);
+    }
+    if (status == 0)
+        status = crew_open_index (crew, index_path);
+    pthread_mutex_unlock (&crew->mutex);
+    return status;
+}
+
+/*
+ * Pass a file path to a work crew previously created
+ * using crew_create, to search for the string "search" or, if
+ * "patterns" isn't NULL, for all of the patterns of that
+ * compiled searcher.
+ */
+int crew_start (
+    crew_p crew,
+    char *filepath,
+    char *search,
+    acsearch_t *patterns)
+{
+#ifdef __linux__
+    struct crew_file_tag *files;
 #endif
-    status = crew_create (&my_crew, CREW_SIZE);
-    if (status != 0)
-        err_abort (status, "Create crew");
+    int crew_index, index;
+    int status;
+
+    if (crew->valid != CREW_VALID)
+        return EINVAL;
 
-    status = crew_start (&my_crew, argv[2], argv[1]);
+    status = pthread_mutex_lock (&crew->mutex);
     if (status != 0)
-        err_abort (status, "Start crew");
+        return status;
+
+    /*
+     * If the crew is busy, wait for them to finish.
+     */
+    while (__atomic_load_n (&crew->outstanding, __ATOMIC_ACQUIRE) > 0) {
+        status = pthread_cond_wait (&crew->done, &crew->mutex);
+        if (status != 0) {
+            pthread_mutex_unlock (&crew->mutex);
+            return status;
+        }
+    }
+
+    crew->matches = 0;
+    crew->patterns = patterns;
+    crew->overlap = 0;
+    if (patterns != NULL) {
+        /*
+         * The crew is idle, so the workers' search state can be
+         * replaced; they'll see it when they take the new work,
+         * through a deque's mutex.
+         */
+        for (crew_index = 0; crew_index < crew->crew_size; crew_index++) {
+            acsearch_match_destroy (&crew->crew[crew_index].match);
+            status = acsearch_match_init (
+                patterns, &crew->crew[crew_index].match);
+            if (status != 0) {
+                pthread_mutex_unlock (&crew->mutex);
+                return status;
+            }
+#ifdef __linux__
+            for (index = 0; index < crew->uring_depth; index++) {
+                files = crew->crew[crew_index].files;
+                acsearch_match_destroy (&files[index].match);
+                status = acsearch_match_init (patterns, &files[index].match);
+                if (status != 0) {
+                    pthread_mutex_unlock (&crew->mutex);
+                    return status;
+                }
+            }
+#endif
+        }
+        for (index = 0; index < patterns->count; index++) {
+            if (patterns->length[index] > crew->overlap + 1)
+                crew->overlap = patterns->length[index] - 1;
+        }
+    } else {
+        status = scan_init (&crew->scan, search, strlen (search));
+        if (status != 0) {
+            pthread_mutex_unlock (&crew->mutex);
+            return status;
+        }
+        if (crew->scan.length > 0)
+            crew->overlap = crew->scan.length - 1;
+    }
+    crew->string = search;
+
+    /*
+     * With an index, find which of its files could match.
+     */
+    if (crew->index.valid == TRIGRAM_VALID) {
+        memset (crew->candidate, 0, crew->index.header->files);
+        if (patterns == NULL)
+            status = trigram_query (
+                &crew->index, search, strlen (search), crew->candidate);
+        for (index = 0;
+            status == 0 && patterns != NULL && index < patterns->count;
+            index++)
+            status = trigram_query (&crew->index, patterns->pattern[index],
+                patterns->length[index], crew->candidate);
+        if (status != 0) {
+            pthread_mutex_unlock (&crew->mutex);
+            return status;
+        }
+    }
 
+    crew_run (crew, filepath);
+    status = pthread_mutex_unlock (&crew->mutex);
+    if (status != 0)
+        err_abort (status, "Unlock crew mutex");
     return 0;
 }
@@ -0,0 +1,236 @@
+/*
+ * crew.h
+ *
+ * This header file describes a "work crew" that searches a
+ * directory tree in parallel, for one string or (with an
+ * Aho-Corasick automaton from acsearch.h) for many at once.
+ *
+ * The number of workers is chosen when the crew is created; by
+ * default, it's the number of online processors. Two further
+ * limits keep a large crew from overloading either the storage or
+ * the processors: at most "io_limit" workers at a time read
+ * directories and open files, and at most "cpu_limit" at a time
+ * scan file contents. (A worker waiting for a slot of one kind
+ * holds none of the other.) By default, the I/O limit is the
+ * size of the crew, and the CPU limit is the number of online
+ * processors, so a crew larger than the machine can keep more
+ * requests queued to the storage without having more scans
+ * compete for processors than there are processors.
+ *
+ * crew_use_uring() changes how files are read: instead of opening
+ * and reading one file at a time, each worker keeps up to "depth"
+ * files in flight through an io_uring of its own (see uring.h),
+ * scanning each block as its read completes, so that the number
+ * of requests the storage sees is no longer limited by the size
+ * of the crew. The I/O limit then applies only to directories.
+ *
+ * crew_start() searches one tree, and returns when the search is
+ * done; the crew can then be started again. Each matching file is
+ * printed on stdout unless the crew's "quiet" flag is set, and
+ * crew->matches counts the matching files (or, in multi-pattern
+ * mode, the matches) of the last search.
+ *
+ * Each worker collects its lines of output in a buffer of its own,
+ * and writes them out CREW_OUTPUT bytes or so at a time, so that
+ * workers contend for stdout once per buffer rather than once per
+ * line; whatever is left is written when the search ends. If the
+ * crew's "sorted" flag is set, nothing is written until the search
+ * ends, and then the files are reported in order of their paths
+ * (without the workers' numbers), so that the output is the same
+ * from one run to the next.
+ *
+ * A regular file larger than CREW_CHUNK bytes is split into chunks
+ * of that size, each queued as a work item of its own, so that a
+ * single huge file is searched by as many workers as are idle.
+ * Each chunk is scanned together with the first bytes of the next
+ * (one less than the longest pattern), so that any match starting
+ * in it is found whole; what the chunks find is merged, and the
+ * file is reported once, just as if one worker had searched it.
+ *
+ * A tree that's searched again and again can be indexed (see
+ * trigram.h). crew_index() builds an index of a tree, or brings
+ * one up to date, reading only the files that are new or have
+ * changed size or modification time since it was built, and
+ * leaves the crew using it; crew_use_index() uses an index built
+ * before. While the crew has an index, crew_start() first asks it
+ * which files could hold the search string (or any pattern), and
+ * a regular file that's in the index, unchanged, and not one of
+ * those isn't read at all. Any other file is searched as usual,
+ * so the results are the same as without the index, however out
+ * of date it is.
+ */
+#ifndef __crew_h
+#define __crew_h
+#include <pthread.h>
+#include <semaphore.h>
+#include "acsearch.h"
+#include "scan.h"
+#include "trigram.h"
+
+#define CREW_CACHELINE  64
+#define CREW_ARENA      (64 * 1024)     /* bytes per arena chunk */
+#define CREW_DIRENTS    (32 * 1024)     /* bytes of entries per read */
+#define CREW_URING_BLOCK (256 * 1024)   /* bytes per io_uring read */
+#define CREW_OUTPUT     (64 * 1024)     /* bytes of output per write */
+#define CREW_CHUNK      (8 * 1024 * 1024) /* bytes per chunk of a file */
+
+/*
+ * Queued items of work for the crew: one for each directory entry
+ * found. One is queued by crew_start, and each worker may queue
+ * additional items.
+ *
+ * An item holds only its own name, and a pointer to the item for
+ * the directory it was found in; it's opened or examined relative
+ * to that directory's descriptor (with openat() and fstatat()),
+ * so no full path is kept unless one must be printed. A directory
+ * keeps its descriptor open until each of its entries has been
+ * finished, which "refs" counts. Items are allocated from their
+ * worker's arena, and freed all at once when the search ends.
+ *
+ * A large file that's been split likewise keeps its descriptor
+ * open, and its "split" state, until each of its chunks has been
+ * finished. A chunk's item has no name; its parent is the file's
+ * item, and it holds the chunk's offset instead.
+ */
+typedef struct work_tag {
+    struct work_tag     *parent;        /* Directory, or NULL */
+    long                refs;           /* Self + unfinished entries */
+    int                 fd;             /* Open directory, or -1 */
+    unsigned char       type;           /* DT_ type, or DT_UNKNOWN */
+    union {
+        struct split_tag *split;        /* Split file: chunks' state */
+        off_t           offset;         /* Chunk: where it starts */
+    } part;
+    char                name[];         /* Entry name (or root path) */
+} work_t, *work_p;
+
+/*
+ * What the chunks of a split file have found between them. Each
+ * chunk merges its own matches in atomically.
+ */
+typedef struct split_tag {
+    off_t               size;           /* of the file */
+    int                 found;          /* Search string found */
+    int                 remaining;      /* Patterns not yet found */
+    unsigned char       *matched;       /* one flag per pattern */
+} split_t;
+
+/*
+ * A simple arena: a list of large chunks, carved up in order,
+ * and freed together.
+ */
+typedef struct arena_tag {
+    char                *chunk;         /* Current chunk */
+    size_t              used;           /* Bytes of it used */
+    size_t              size;           /* Bytes in it */
+} arena_t;
+
+/*
+ * A worker's deque of work items: a circular array, which grows
+ * when it fills. The owner pushes and pops at the bottom; thieves
+ * take from the top, where the oldest items (for a directory tree,
+ * usually those nearest the root, with the most work below them)
+ * are. The mutex is seldom contended, since only a thief ever
+ * competes with the owner.
+ */
+typedef struct deque_tag {
+    pthread_mutex_t     mutex;
+    work_p              *item;
+    unsigned long       top;            /* steal here */
+    unsigned long       bottom;         /* push and pop here */
+    unsigned long       size;           /* a power of 2 */
+} deque_t;
+
+/*
+ * A worker's buffered output, written out in large chunks. In
+ * sorted mode, it's kept until the search ends, as "records" (one
+ * for each file reported): the file's path and then its lines,
+ * each null-terminated.
+ */
+typedef struct output_tag {
+    char                *buffer;
+    size_t              used;
+    size_t              size;
+    size_t              *record;        /* Offsets of records */
+    size_t              records;
+    size_t              allocated;
+} output_t;
+
+/*
+ * One of these is initialized for each worker thread in the
+ * crew. It contains the "identity" of each worker, and its
+ * deque, in a cache line of its own.
+ */
+typedef struct worker_tag {
+    int                 index;          /* Thread's index */
+    pthread_t           thread;         /* Thread for stage */
+    struct crew_tag     *crew;          /* Pointer to crew */
+    acsearch_match_t    match;          /* Multi-pattern search state */
+    arena_t             arena;          /* Work items allocated */
+    char                *path;          /* Path of an item, to print */
+    size_t              path_size;
+    char                *dirents;       /* Directory entries read */
+    struct uring_tag    *uring;         /* io_uring, or NULL */
+    struct crew_file_tag *files;        /* Files it may have in flight */
+    struct crew_file_tag *free_files;
+    int                 busy;           /* Files in flight */
+    output_t            output;         /* Lines not yet written */
+    trigram_set_t       trigrams;       /* Indexing: a file's trigrams */
+    trigram_record_t    *indexed;       /* Indexing: files recorded */
+    size_t              indexed_count;
+    size_t              indexed_size;
+    deque_t             deque;          /* Work items found */
+} __attribute__ ((aligned (CREW_CACHELINE))) worker_t, *worker_p;
+
+/*
+ * The external "handle" for a work crew. Contains the
+ * crew synchronization state and staging area.
+ */
+typedef struct crew_tag {
+    int                 valid;          /* set when valid */
+    int                 crew_size;      /* Size of array */
+    worker_t            *crew;          /* Crew members */
+    int                 io_limit;       /* Workers doing I/O at once */
+    int                 cpu_limit;      /* Workers scanning at once */
+    sem_t               io;             /* I/O slots */
+    sem_t               cpu;            /* CPU slots */
+    long                outstanding;    /* Items not finished (atomic) */
+    long                queued;         /* Items in deques (atomic) */
+    int                 sleepers;       /* Idle workers (atomic) */
+    int                 dirs_open;      /* Directories held (atomic) */
+    int                 dirs_limit;     /* Most directories to hold */
+    int                 shutdown;       /* Set by crew_destroy */
+    int                 quiet;          /* Don't print matches */
+    int                 sorted;         /* Print matches sorted by path */
+    int                 uring_depth;    /* Files in flight per worker */
+    long                matches;        /* Found in last search (atomic) */
+    pthread_mutex_t     mutex;          /* Mutex for idle workers */
+    pthread_mutex_t     output;         /* Serialize writes to stdout */
+    pthread_cond_t      done;           /* Wait for crew done */
+    pthread_cond_t      go;             /* Wait for work */
+    char                *string;        /* Search string */
+    size_t              overlap;        /* Bytes chunks overlap */
+    scan_t              scan;           /* Scanner for search string */
+    acsearch_t          *patterns;      /* Or multi-pattern searcher */
+    trigram_t           index;          /* Index, if valid */
+    unsigned char       *candidate;     /* Indexed files to search */
+    int                 indexing;       /* Set by crew_index */
+    long                index_files;    /* Files in last index (atomic) */
+    long                index_reads;    /* Of those, read (atomic) */
+} crew_t, *crew_p;
+
+#define CREW_VALID      0xc4e3
+
+/*
+ * Define work crew functions
+ */
+extern int crew_create (
+    crew_t *crew, int crew_size, int io_limit, int cpu_limit);
+extern int crew_destroy (crew_t *crew);
+extern int crew_use_uring (crew_t *crew, int depth);
+extern int crew_use_index (crew_t *crew, const char *index_path);
+extern int crew_index (crew_t *crew, char *filepath, const char *index_path);
+extern int crew_start (
+    crew_t *crew, char *filepath, char *search, acsearch_t *patterns);
+
+#endif
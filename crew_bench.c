@@ -0,0 +1,200 @@
+/*
+ * crew_bench.c
+ *
+ * Measure how the work crew in crew.c scales with the number of
+ * workers, searching a synthetic directory tree.
+ *
+ * The tree is built in a new directory under /tmp: "dirs"
+ * directories of "files" files each, of "kbytes" kilobytes of
+ * pseudo-random lower case text, with the search string planted
+ * in every tenth file. After a first search to bring the tree into
+ * the page cache, it is searched by crews of 1 worker, doubling up
+ * to the maximum, and the time, files and megabytes per second,
+ * and speedup over one worker are reported. Each search's count of
+ * matching files is checked. The tree is removed at the end.
+ *
+ * Usage: crew_bench [-u depth] [max_workers [dirs [files [kbytes]]]]
+ *
+ * With -u, each worker keeps up to "depth" files in flight through
+ * io_uring (see crew.h).
+ *
+ * The default maximum is twice the number of online processors.
+ * Each crew has the default limits (see crew.h), so beyond one
+ * worker per processor the extra workers only read directories
+ * and open files ahead of the scans.
+ */
+#include <pthread.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "errors.h"
+#include "crew.h"
+
+#define DIRS            64
+#define FILES           64
+#define KBYTES          16
+#define PATTERN         "pthread_cond_broadcast"
+
+static double now_sec (void)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Build the tree under "root", and return the number of files
+ * holding the pattern.
+ */
+static long build_tree (const char *root, int dirs, int files, int kbytes)
+{
+    unsigned long long seed = 88172645463325252ULL;
+    char path[1024], *buffer;
+    size_t size = (size_t)kbytes * 1024, offset;
+    long planted = 0;
+    int dir, file, fd;
+
+    buffer = (char*)malloc (size);
+    if (buffer == NULL)
+        errno_abort ("Allocate file buffer");
+    for (dir = 0; dir < dirs; dir++) {
+        snprintf (path, sizeof (path), "%s/d%03d", root, dir);
+        if (mkdir (path, 0700) == -1)
+            errno_abort ("Make directory");
+        for (file = 0; file < files; file++) {
+            for (offset = 0; offset < size; offset++) {
+                seed ^= seed >> 12;
+                seed ^= seed << 25;
+                seed ^= seed >> 27;
+                buffer[offset] = (seed * 2685821657736338717ULL) % 7 == 0
+                    ? ' ' : 'a' + (seed * 2685821657736338717ULL >> 32) % 26;
+            }
+            if ((dir * files + file) % 10 == 0) {
+                memcpy (buffer + size / 2, PATTERN, strlen (PATTERN));
+                planted++;
+            }
+            snprintf (path, sizeof (path), "%s/d%03d/f%03d",
+                root, dir, file);
+            fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+            if (fd < 0)
+                errno_abort ("Create file");
+            if (write (fd, buffer, size) != (ssize_t)size)
+                errno_abort ("Write file");
+            close (fd);
+        }
+    }
+    free (buffer);
+    return planted;
+}
+
+static void remove_tree (const char *root, int dirs, int files)
+{
+    char path[1024];
+    int dir, file;
+
+    for (dir = 0; dir < dirs; dir++) {
+        for (file = 0; file < files; file++) {
+            snprintf (path, sizeof (path), "%s/d%03d/f%03d",
+                root, dir, file);
+            unlink (path);
+        }
+        snprintf (path, sizeof (path), "%s/d%03d", root, dir);
+        rmdir (path);
+    }
+    rmdir (root);
+}
+
+/*
+ * Search the tree with a crew of "workers", and return the elapsed
+ * seconds.
+ */
+static double run (char *root, int workers, int depth, long expected)
+{
+    crew_t crew;
+    double start, elapsed;
+    int status;
+
+    status = crew_create (&crew, workers, 0, 0);
+    if (status != 0)
+        err_abort (status, "Create crew");
+    crew.quiet = 1;
+    if (depth > 0) {
+        status = crew_use_uring (&crew, depth);
+        if (status != 0)
+            err_abort (status, "Use io_uring");
+    }
+    start = now_sec ();
+    status = crew_start (&crew, root, PATTERN, NULL);
+    if (status != 0)
+        err_abort (status, "Start crew");
+    elapsed = now_sec () - start;
+    if (crew.matches != expected)
+        fprintf (stderr, "%d workers found %ld files, expected %ld\n",
+            workers, crew.matches, expected);
+    status = crew_destroy (&crew);
+    if (status != 0)
+        err_abort (status, "Destroy crew");
+    return elapsed;
+}
+
+int main (int argc, char *argv[])
+{
+    char root[] = "/tmp/crew_benchXXXXXX";
+    int max_workers, workers, dirs = DIRS, files = FILES, kbytes = KBYTES;
+    int depth = 0, option;
+    long planted, online;
+    double elapsed, base = 0.0, megabytes;
+
+    online = sysconf (_SC_NPROCESSORS_ONLN);
+    max_workers = 2 * (int)online;
+    while ((option = getopt (argc, argv, "u:")) != -1)
+        depth = option == 'u' ? atoi (optarg) : -1;
+    argc -= optind;
+    if (argc > 0)
+        max_workers = atoi (argv[optind]);
+    if (argc > 1)
+        dirs = atoi (argv[optind + 1]);
+    if (argc > 2)
+        files = atoi (argv[optind + 2]);
+    if (argc > 3)
+        kbytes = atoi (argv[optind + 3]);
+    if (max_workers < 1 || dirs < 1 || files < 1 || depth < 0
+        || dirs > 1000 || files > 1000
+        || (size_t)kbytes * 1024 < strlen (PATTERN) * 2) {
+        fprintf (stderr,
+            "Usage: %s [-u depth] [max_workers [dirs [files [kbytes]]]]\n",
+            argv[0]);
+        return -1;
+    }
+
+    if (mkdtemp (root) == NULL)
+        errno_abort ("Make tree root");
+    planted = build_tree (root, dirs, files, kbytes);
+    megabytes = (double)dirs * files * kbytes / 1024;
+    printf ("%ld processors, %d x %d files of %d KB (%.0f MB) in %s\n",
+        online, dirs, files, kbytes, megabytes, root);
+    if (depth > 0)
+        printf ("io_uring, %d files in flight per worker\n", depth);
+
+    run (root, max_workers, depth, planted);   /* warm the page cache */
+    printf ("%7s %10s %10s %10s %8s\n",
+        "workers", "ms", "files/s", "MB/s", "speedup");
+    for (workers = 1; ; workers *= 2) {
+        if (workers > max_workers)
+            workers = max_workers;
+        elapsed = run (root, workers, depth, planted);
+        if (workers == 1)
+            base = elapsed;
+        printf ("%7d %10.1f %10.0f %10.1f %8.2f\n",
+            workers, elapsed * 1e3, dirs * files / elapsed,
+            megabytes / elapsed, base / elapsed);
+        fflush (stdout);
+        if (workers == max_workers)
+            break;
+    }
+
+    remove_tree (root, dirs, files);
+    return 0;
+}
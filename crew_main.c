@@ -0,0 +1,177 @@
+/*
+ * crew_main.c
+ *
+ * Demonstrate a work crew implementing a simple parallel search
+ * through a directory tree.
+ *
+ * With "-f file" in place of the search string, the crew searches
+ * for every line of the file at once, and every pattern found in a
+ * file is reported.
+ *
+ * The crew has one worker for each online processor unless -w
+ * says otherwise; -i limits the number of workers reading
+ * directories and opening files at once, and -c the number
+ * scanning files at once (see crew.h). With -u, each worker keeps
+ * up to that many files in flight through io_uring, if the system
+ * has it. With -s, the files found are printed in order of their
+ * paths, once the search is done.
+ *
+ * With "-x index", the search uses the trigram index in that file
+ * to skip files that can't match (see crew.h); with -b as well,
+ * the crew instead builds the index of the tree, or brings it up
+ * to date.
+ */
+#include <pthread.h>
+#include <unistd.h>
+#include "errors.h"
+#include "crew.h"
+
+static void usage (char *program)
+{
+    fprintf (stderr,
+        "Usage: %s [-w n] [-i n] [-c n] [-u n] [-s] [-x index]"
+        " string path\n",
+        program);
+    fprintf (stderr,
+        "       %s [-w n] [-i n] [-c n] [-u n] [-s] [-x index]"
+        " -f patterns path\n",
+        program);
+    fprintf (stderr,
+        "       %s [-w n] [-i n] [-c n] -x index -b path\n",
+        program);
+    exit (-1);
+}
+
+/*
+ * The main program to "drive" the crew...
+ */
+int main (int argc, char *argv[])
+{
+    crew_t my_crew;
+    acsearch_t patterns;
+    acsearch_t *search = NULL;
+    FILE *pattern_file;
+    char *pattern_path = NULL, *string = NULL, *index_path = NULL;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    int workers = 0, io_limit = 0, cpu_limit = 0, depth = 0, sorted = 0;
+    int build = 0;
+    int option, status;
+
+    while ((option = getopt (argc, argv, "w:i:c:u:sf:x:b")) != -1) {
+        switch (option) {
+        case 'w':
+            workers = atoi (optarg);
+            break;
+        case 'i':
+            io_limit = atoi (optarg);
+            break;
+        case 'c':
+            cpu_limit = atoi (optarg);
+            break;
+        case 'u':
+            depth = atoi (optarg);
+            break;
+        case 's':
+            sorted = 1;
+            break;
+        case 'f':
+            pattern_path = optarg;
+            break;
+        case 'x':
+            index_path = optarg;
+            break;
+        case 'b':
+            build = 1;
+            break;
+        default:
+            usage (argv[0]);
+        }
+    }
+    if (build) {
+        if (index_path == NULL || pattern_path != NULL || argc - optind != 1)
+            usage (argv[0]);
+    } else if (pattern_path == NULL) {
+        if (argc - optind != 2)
+            usage (argv[0]);
+        string = argv[optind++];
+    } else if (argc - optind != 1)
+        usage (argv[0]);
+
+    /*
+     * With -f, build the automaton for the file of patterns, one
+     * per line (empty lines are ignored).
+     */
+    if (pattern_path != NULL) {
+        pattern_file = fopen (pattern_path, "r");
+        if (pattern_file == NULL)
+            errno_abort ("Open pattern file");
+        acsearch_init (&patterns);
+        while ((length = getline (&line, &line_size, pattern_file)) >= 0) {
+            if (length > 0 && line[length - 1] == '\n')
+                length--;
+            if (length == 0)
+                continue;
+            status = acsearch_add (&patterns, line, length);
+            if (status != 0)
+                err_abort (status, "Add pattern");
+        }
+        free (line);
+        fclose (pattern_file);
+        status = acsearch_compile (&patterns);
+        if (status != 0)
+            err_abort (status, "Compile patterns");
+        search = &patterns;
+    }
+
+    status = crew_create (&my_crew, workers, io_limit, cpu_limit);
+    if (status != 0)
+        err_abort (status, "Create crew");
+#ifdef sun
+    /*
+     * On Solaris 2.5, threads are not timesliced. To ensure
+     * that our threads can run concurrently, we need to
+     * increase the concurrency level to the size of the crew.
+     */
+    DPRINTF (("Setting concurrency level to %d\n", my_crew.crew_size));
+    thr_setconcurrency (my_crew.crew_size);
+#endif
+
+    my_crew.sorted = sorted;
+    if (depth > 0) {
+        status = crew_use_uring (&my_crew, depth);
+        if (status == ENOSYS)
+            fprintf (stderr, "No io_uring; workers will read files.\n");
+        else if (status != 0)
+            err_abort (status, "Use io_uring");
+    }
+
+    if (build) {
+        my_crew.quiet = 1;
+        status = crew_index (&my_crew, argv[optind], index_path);
+        if (status != 0)
+            err_abort (status, "Index tree");
+        printf ("Indexed %ld files (%ld read) in %s\n",
+            my_crew.index_files, my_crew.index_reads, index_path);
+    } else {
+        if (index_path != NULL) {
+            status = crew_use_index (&my_crew, index_path);
+            if (status == ENOENT || status == EINVAL)
+                fprintf (stderr,
+                    "No index in %s; searching every file.\n", index_path);
+            else if (status != 0)
+                err_abort (status, "Use index");
+        }
+        status = crew_start (&my_crew, argv[optind], string, search);
+        if (status != 0)
+            err_abort (status, "Start crew");
+    }
+
+    status = crew_destroy (&my_crew);
+    if (status != 0)
+        err_abort (status, "Destroy crew");
+    if (search != NULL)
+        acsearch_destroy (search);
+    return 0;
+}
@@ -0,0 +1,315 @@
+/*
+ * epoch.c
+ *
+ * This file implements the "epoch-based reclamation" package.
+ *
+ * The domain keeps a global epoch counter, and each registered
+ * reader records the epoch it observed when entering a read-side
+ * critical section (or 0 when it is outside one). A grace period
+ * is simple: advance the epoch, then wait until no reader is
+ * still inside a section that it entered in an earlier epoch.
+ * Readers that enter after the advance may see only the newly
+ * published data, so they don't have to be waited for.
+ *
+ * The epoch_init() and epoch_destroy() functions, respectively,
+ * allow you to initialize and destroy the domain. Reader threads
+ * call epoch_register() once before using epoch_enter() and
+ * epoch_exit(), and epoch_unregister() when they are done.
+ *
+ * The epoch_synchronize() function waits for a grace period.
+ * epoch_retire() queues a pointer to be freed (by calling the
+ * supplied function) after a later grace period, and
+ * epoch_reclaim() forces that to happen now. Neither
+ * epoch_synchronize() nor epoch_retire() may be called from
+ * within a read-side critical section, because the caller would
+ * wait for itself.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include "errors.h"
+#include "epoch.h"
+#ifdef __linux__
+# include <sys/syscall.h>
+# include <linux/membarrier.h>
+#else
+# define MEMBARRIER_CMD_PRIVATE_EXPEDITED 0
+#endif
+
+/*
+ * Number of times epoch_synchronize() polls a busy reader before
+ * yielding the processor.
+ */
+#define EPOCH_SPINS     100
+
+/*
+ * Issue a memory barrier on every processor running one of our
+ * threads. Returns nonzero if the system can't do that, in which
+ * case readers must execute their own fence.
+ */
+static int epoch_membarrier (int cmd)
+{
+#if defined (__linux__) && defined (__NR_membarrier)
+    return syscall (__NR_membarrier, cmd, 0) != 0;
+#else
+    return 1;
+#endif
+}
+
+/*
+ * Initialize an epoch domain.
+ */
+int epoch_init (epoch_t *epoch)
+{
+    int status;
+
+    epoch->gp = 1;
+    epoch->readers = NULL;
+    epoch->retired = NULL;
+    epoch->retired_count = 0;
+    epoch->membarrier = 0;
+#if defined (__linux__) && defined (__NR_membarrier)
+    /*
+     * Use the "private expedited" membarrier if the kernel
+     * supports it; that lets epoch_enter() skip its full fence,
+     * moving the cost to epoch_synchronize().
+     */
+    {
+        long cmds = syscall (__NR_membarrier, MEMBARRIER_CMD_QUERY, 0);
+
+        if (cmds > 0
+            && (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED)
+            && epoch_membarrier (
+                MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED) == 0)
+            epoch->membarrier = 1;
+    }
+#endif
+    status = pthread_mutex_init (&epoch->mutex, NULL);
+    if (status != 0)
+        return status;
+    status = pthread_mutex_init (&epoch->sync, NULL);
+    if (status != 0) {
+        pthread_mutex_destroy (&epoch->mutex);
+        return status;
+    }
+    epoch->valid = EPOCH_VALID;
+    return 0;
+}
+
+/*
+ * Destroy an epoch domain, freeing anything still retired.
+ */
+int epoch_destroy (epoch_t *epoch)
+{
+    int status, status2;
+
+    if (epoch->valid != EPOCH_VALID)
+        return EINVAL;
+    status = pthread_mutex_lock (&epoch->mutex);
+    if (status != 0)
+        return status;
+
+    /*
+     * Check whether any readers are still registered; report
+     * "BUSY" if so.
+     */
+    if (epoch->readers != NULL) {
+        pthread_mutex_unlock (&epoch->mutex);
+        return EBUSY;
+    }
+    status = pthread_mutex_unlock (&epoch->mutex);
+    if (status != 0)
+        return status;
+
+    status = epoch_reclaim (epoch);
+    if (status != 0)
+        return status;
+    epoch->valid = 0;
+    status = pthread_mutex_destroy (&epoch->mutex);
+    status2 = pthread_mutex_destroy (&epoch->sync);
+    return (status != 0 ? status : status2);
+}
+
+/*
+ * Register a reader record for the calling thread.
+ */
+int epoch_register (epoch_t *epoch, epoch_reader_t *reader)
+{
+    int status;
+
+    if (epoch->valid != EPOCH_VALID)
+        return EINVAL;
+    reader->ctr = 0;
+    reader->nest = 0;
+    reader->epoch = epoch;
+    status = pthread_mutex_lock (&epoch->mutex);
+    if (status != 0)
+        return status;
+    reader->next = epoch->readers;
+    epoch->readers = reader;
+    return pthread_mutex_unlock (&epoch->mutex);
+}
+
+/*
+ * Remove a reader record. The reader must not be inside a
+ * read-side critical section.
+ */
+int epoch_unregister (epoch_reader_t *reader)
+{
+    epoch_t *epoch = reader->epoch;
+    epoch_reader_t **link;
+    int status;
+
+    if (epoch == NULL || epoch->valid != EPOCH_VALID)
+        return EINVAL;
+    if (reader->nest != 0)
+        return EBUSY;
+
+    /*
+     * The registry is walked by epoch_synchronize() while holding
+     * the sync mutex, so take that first to keep the record from
+     * vanishing underneath a grace period.
+     */
+    status = pthread_mutex_lock (&epoch->sync);
+    if (status != 0)
+        return status;
+    status = pthread_mutex_lock (&epoch->mutex);
+    if (status != 0) {
+        pthread_mutex_unlock (&epoch->sync);
+        return status;
+    }
+    for (link = &epoch->readers; *link != NULL; link = &(*link)->next) {
+        if (*link == reader) {
+            *link = reader->next;
+            break;
+        }
+    }
+    reader->epoch = NULL;
+    pthread_mutex_unlock (&epoch->mutex);
+    return pthread_mutex_unlock (&epoch->sync);
+}
+
+/*
+ * Wait until every reader that was inside a read-side critical
+ * section when we were called has left it.
+ */
+int epoch_synchronize (epoch_t *epoch)
+{
+    epoch_reader_t *reader;
+    unsigned long target, ctr;
+    int spins, status;
+
+    if (epoch->valid != EPOCH_VALID)
+        return EINVAL;
+    status = pthread_mutex_lock (&epoch->sync);
+    if (status != 0)
+        return status;
+
+    /*
+     * Order the caller's prior stores (typically, publishing a
+     * new version of the data) before we sample the readers. With
+     * membarrier this also serves as the fence that readers
+     * omitted in epoch_enter().
+     */
+    if (epoch->membarrier)
+        epoch_membarrier (MEMBARRIER_CMD_PRIVATE_EXPEDITED);
+    else
+        __atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+    target = __atomic_add_fetch (&epoch->gp, 1, __ATOMIC_SEQ_CST);
+
+    status = pthread_mutex_lock (&epoch->mutex);
+    if (status != 0) {
+        pthread_mutex_unlock (&epoch->sync);
+        return status;
+    }
+    for (reader = epoch->readers; reader != NULL; reader = reader->next) {
+        spins = 0;
+        while (1) {
+            ctr = __atomic_load_n (&reader->ctr, __ATOMIC_ACQUIRE);
+            if (ctr == 0 || ctr >= target)
+                break;
+            if (++spins >= EPOCH_SPINS) {
+                sched_yield ();
+                spins = 0;
+            }
+        }
+    }
+    pthread_mutex_unlock (&epoch->mutex);
+
+    /*
+     * Make sure the readers' critical sections are complete
+     * before the caller frees anything they might have seen.
+     */
+    if (epoch->membarrier)
+        epoch_membarrier (MEMBARRIER_CMD_PRIVATE_EXPEDITED);
+    else
+        __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    return pthread_mutex_unlock (&epoch->sync);
+}
+
+/*
+ * Defer freeing "ptr" until no reader can still be using it.
+ * Retired pointers are batched, so that one grace period serves
+ * many of them.
+ */
+int epoch_retire (epoch_t *epoch, void *ptr, void (*free_fn)(void *))
+{
+    epoch_retired_t *item;
+    int status, reclaim;
+
+    if (epoch->valid != EPOCH_VALID)
+        return EINVAL;
+    item = (epoch_retired_t*)malloc (sizeof (epoch_retired_t));
+    if (item == NULL)
+        return ENOMEM;
+    item->ptr = ptr;
+    item->free_fn = free_fn;
+    status = pthread_mutex_lock (&epoch->mutex);
+    if (status != 0) {
+        free (item);
+        return status;
+    }
+    item->next = epoch->retired;
+    epoch->retired = item;
+    reclaim = (++epoch->retired_count >= EPOCH_RETIRE_BATCH);
+    status = pthread_mutex_unlock (&epoch->mutex);
+    if (status != 0)
+        return status;
+    if (reclaim)
+        return epoch_reclaim (epoch);
+    return 0;
+}
+
+/*
+ * Free everything retired so far, after a grace period.
+ */
+int epoch_reclaim (epoch_t *epoch)
+{
+    epoch_retired_t *list, *item;
+    int status;
+
+    if (epoch->valid != EPOCH_VALID)
+        return EINVAL;
+    status = pthread_mutex_lock (&epoch->mutex);
+    if (status != 0)
+        return status;
+    list = epoch->retired;
+    epoch->retired = NULL;
+    epoch->retired_count = 0;
+    status = pthread_mutex_unlock (&epoch->mutex);
+    if (status != 0)
+        return status;
+    if (list == NULL)
+        return 0;
+
+    status = epoch_synchronize (epoch);
+    if (status != 0)
+        return status;
+    while (list != NULL) {
+        item = list;
+        list = item->next;
+        item->free_fn (item->ptr);
+        free (item);
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * epoch.h
+ *
+ * This header file describes an "epoch-based reclamation"
+ * package, providing an RCU-style read side for shared data that
+ * is replaced copy-on-write (configuration, routing tables, and
+ * the like).
+ *
+ * Each reader thread registers an epoch_reader_t with the epoch
+ * domain. epoch_enter() and epoch_exit() bracket a read-side
+ * critical section; they take no locks, and (where the Linux
+ * membarrier system call is available) cost only a store to the
+ * reader's own record. Writers publish a new version of the data
+ * and either call epoch_synchronize() to wait until every reader
+ * that might still see the old version has left its critical
+ * section, or hand the old version to epoch_retire() to be freed
+ * later.
+ */
+#ifndef __epoch_h
+#define __epoch_h
+#include <pthread.h>
+
+#define EPOCH_CACHELINE 64
+
+/*
+ * Per-thread reader record. Each record sits in its own cache
+ * line, so readers never write a line that another reader uses.
+ */
+typedef struct epoch_reader_tag {
+    unsigned long               ctr;    /* epoch entered, 0 if idle */
+    int                         nest;   /* read-side nesting depth */
+    struct epoch_tag            *epoch; /* domain registered with */
+    struct epoch_reader_tag     *next;  /* registry link */
+} __attribute__ ((aligned (EPOCH_CACHELINE))) epoch_reader_t;
+
+/*
+ * Pointer retired by a writer, waiting for a grace period to
+ * expire before it can be freed.
+ */
+typedef struct epoch_retired_tag {
+    struct epoch_retired_tag    *next;
+    void                        *ptr;
+    void                        (*free_fn)(void *);
+} epoch_retired_t;
+
+/*
+ * Structure describing an epoch domain.
+ */
+typedef struct epoch_tag {
+    pthread_mutex_t     mutex;          /* registry and retire list */
+    pthread_mutex_t     sync;           /* serialize grace periods */
+    int                 valid;          /* set when valid */
+    int                 membarrier;     /* readers skip their fence */
+    unsigned long       gp;             /* current epoch */
+    epoch_reader_t      *readers;       /* registered readers */
+    epoch_retired_t     *retired;       /* awaiting reclamation */
+    int                 retired_count;  /* length of retired list */
+} epoch_t;
+
+#define EPOCH_VALID     0xe0c4bad
+
+/*
+ * Number of retired pointers that triggers reclamation from
+ * within epoch_retire().
+ */
+#define EPOCH_RETIRE_BATCH      64
+
+/*
+ * Define epoch functions
+ */
+extern int epoch_init (epoch_t *epoch);
+extern int epoch_destroy (epoch_t *epoch);
+extern int epoch_register (epoch_t *epoch, epoch_reader_t *reader);
+extern int epoch_unregister (epoch_reader_t *reader);
+extern int epoch_synchronize (epoch_t *epoch);
+extern int epoch_retire (
+    epoch_t *epoch, void *ptr, void (*free_fn)(void *));
+extern int epoch_reclaim (epoch_t *epoch);
+
+/*
+ * Enter a read-side critical section. Sections may nest.
+ *
+ * The reader publishes the epoch it saw on entry. That store must
+ * be visible to epoch_synchronize() before the reader loads any
+ * protected pointer; when the domain uses membarrier, the writer
+ * supplies the necessary fence on the reader's behalf and the
+ * reader needs only a compiler barrier.
+ */
+static inline void epoch_enter (epoch_reader_t *reader)
+{
+    epoch_t *epoch = reader->epoch;
+
+    if (reader->nest++ == 0) {
+        __atomic_store_n (&reader->ctr,
+            __atomic_load_n (&epoch->gp, __ATOMIC_RELAXED),
+            __ATOMIC_RELAXED);
+        if (epoch->membarrier)
+            __atomic_signal_fence (__ATOMIC_SEQ_CST);
+        else
+            __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    }
+}
+
+/*
+ * Leave a read-side critical section.
+ */
+static inline void epoch_exit (epoch_reader_t *reader)
+{
+    if (--reader->nest == 0)
+        __atomic_store_n (&reader->ctr, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Load an epoch-protected pointer inside a read-side critical
+ * section, and publish a new one from a writer.
+ */
+#define epoch_deref(p)          __atomic_load_n (&(p), __ATOMIC_CONSUME)
+#define epoch_publish(p, v)     __atomic_store_n (&(p), (v), __ATOMIC_RELEASE)
+
+#endif
@@ -0,0 +1,261 @@
+/*
+ * epoch_main.c
+ *
+ * Compare the read side of the epoch-based reclamation package in
+ * epoch.c with the read-write locks in rwlock.c.
+ *
+ * A shared "routing table" is read continuously by THREADS reader
+ * threads while one writer thread replaces it every WRITE_USEC
+ * microseconds. In the rwlock run, readers take a read lock
+ * around each lookup (as in rwlock_main.c), and the writer
+ * updates the table under the write lock. In the epoch run, the
+ * writer builds a new copy of the table, publishes it, and retires
+ * the old one; readers just bracket the lookup with epoch_enter()
+ * and epoch_exit().
+ *
+ * Each reader checks that every entry of the table it sees
+ * belongs to the same version, which catches both torn updates
+ * and tables freed while still in use (the free routine scribbles
+ * over the table first).
+ *
+ * Usage: epoch_main [threads [seconds]]
+ */
+#include <pthread.h>
+#include <time.h>
+#include "rwlock.h"
+#include "epoch.h"
+#include "errors.h"
+
+#define THREADS         4
+#define SECONDS         2
+#define TABLESIZE       16
+#define WRITE_USEC      1000
+
+/*
+ * The shared table.
+ */
+typedef struct table_tag {
+    unsigned long       version;
+    unsigned long       route[TABLESIZE];
+} table_t;
+
+/*
+ * Keep statistics for each reader thread.
+ */
+typedef struct thread_tag {
+    epoch_reader_t      reader;         /* first: cache-line aligned */
+    pthread_t           thread_id;
+    int                 thread_num;
+    unsigned long       reads;
+    unsigned long       errors;
+} thread_t;
+
+table_t *table;                         /* Current table */
+table_t rw_table;                       /* Table for the rwlock run */
+rwlock_t rw_lock = RWL_INITIALIZER;
+epoch_t epoch;
+int use_epoch;                          /* Which run is this? */
+volatile int stop;                      /* Set when time's up */
+
+/*
+ * Free a retired table, destroying its contents first so that a
+ * reader still using it would notice.
+ */
+static void table_free (void *arg)
+{
+    table_t *old = (table_t*)arg;
+
+    memset (old, 0xdb, sizeof (table_t));
+    free (old);
+}
+
+/*
+ * Check that every route in a table belongs to its version.
+ */
+static int table_check (table_t *t)
+{
+    int i;
+
+    for (i = 0; i < TABLESIZE; i++)
+        if (t->route[i] != t->version)
+            return 1;
+    return 0;
+}
+
+/*
+ * Reader thread start routine.
+ */
+void *reader_routine (void *arg)
+{
+    thread_t *self = (thread_t*)arg;
+    table_t *t;
+    int status;
+
+    if (use_epoch) {
+        status = epoch_register (&epoch, &self->reader);
+        if (status != 0)
+            err_abort (status, "Register reader");
+    }
+    while (!stop) {
+        if (use_epoch) {
+            epoch_enter (&self->reader);
+            t = epoch_deref (table);
+            self->errors += table_check (t);
+            epoch_exit (&self->reader);
+        } else {
+            status = rwl_readlock (&rw_lock);
+            if (status != 0)
+                err_abort (status, "Read lock");
+            self->errors += table_check (&rw_table);
+            status = rwl_readunlock (&rw_lock);
+            if (status != 0)
+                err_abort (status, "Read unlock");
+        }
+        self->reads++;
+    }
+    if (use_epoch) {
+        status = epoch_unregister (&self->reader);
+        if (status != 0)
+            err_abort (status, "Unregister reader");
+    }
+    return NULL;
+}
+
+/*
+ * Writer thread start routine: replace the table periodically.
+ */
+void *writer_routine (void *arg)
+{
+    unsigned long *updates = (unsigned long*)arg;
+    struct timespec delay;
+    table_t *new_table, *old_table;
+    int i, status;
+
+    delay.tv_sec = 0;
+    delay.tv_nsec = WRITE_USEC * 1000;
+    while (!stop) {
+        if (use_epoch) {
+            old_table = table;
+            new_table = (table_t*)malloc (sizeof (table_t));
+            if (new_table == NULL)
+                errno_abort ("Allocate table");
+            new_table->version = old_table->version + 1;
+            for (i = 0; i < TABLESIZE; i++)
+                new_table->route[i] = new_table->version;
+            epoch_publish (table, new_table);
+            status = epoch_retire (&epoch, old_table, table_free);
+            if (status != 0)
+                err_abort (status, "Retire table");
+        } else {
+            status = rwl_writelock (&rw_lock);
+            if (status != 0)
+                err_abort (status, "Write lock");
+            rw_table.version++;
+            for (i = 0; i < TABLESIZE; i++)
+                rw_table.route[i] = rw_table.version;
+            status = rwl_writeunlock (&rw_lock);
+            if (status != 0)
+                err_abort (status, "Write unlock");
+        }
+        (*updates)++;
+        nanosleep (&delay, NULL);
+    }
+    return NULL;
+}
+
+/*
+ * Run one timed pass with "threads" readers, and report the read
+ * throughput.
+ */
+static void run (const char *name, int threads, int seconds)
+{
+    thread_t *reader;
+    pthread_t writer;
+    struct timespec start, end;
+    unsigned long reads = 0, errors = 0, updates = 0;
+    double elapsed;
+    int count, status;
+
+    /*
+     * Keep each reader record on its own cache line.
+     */
+    status = posix_memalign (
+        (void**)&reader, EPOCH_CACHELINE, threads * sizeof (thread_t));
+    if (status != 0)
+        err_abort (status, "Allocate readers");
+    memset (reader, 0, threads * sizeof (thread_t));
+    stop = 0;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    for (count = 0; count < threads; count++) {
+        reader[count].thread_num = count;
+        status = pthread_create (&reader[count].thread_id,
+            NULL, reader_routine, (void*)&reader[count]);
+        if (status != 0)
+            err_abort (status, "Create reader");
+    }
+    status = pthread_create (&writer, NULL, writer_routine, &updates);
+    if (status != 0)
+        err_abort (status, "Create writer");
+
+    sleep (seconds);
+    stop = 1;
+
+    for (count = 0; count < threads; count++) {
+        status = pthread_join (reader[count].thread_id, NULL);
+        if (status != 0)
+            err_abort (status, "Join reader");
+        reads += reader[count].reads;
+        errors += reader[count].errors;
+    }
+    status = pthread_join (writer, NULL);
+    if (status != 0)
+        err_abort (status, "Join writer");
+    clock_gettime (CLOCK_MONOTONIC, &end);
+    elapsed = (end.tv_sec - start.tv_sec)
+        + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf ("%-6s: %d readers, %lu reads (%.1f Mreads/s), "
+        "%lu updates, %lu errors\n",
+        name, threads, reads, reads / elapsed / 1e6, updates, errors);
+    free (reader);
+}
+
+int main (int argc, char *argv[])
+{
+    int threads = THREADS, seconds = SECONDS;
+    int i, status;
+
+    if (argc > 1)
+        threads = atoi (argv[1]);
+    if (argc > 2)
+        seconds = atoi (argv[2]);
+    if (threads < 1 || seconds < 1) {
+        fprintf (stderr, "Usage: %s [threads [seconds]]\n", argv[0]);
+        return -1;
+    }
+
+    status = epoch_init (&epoch);
+    if (status != 0)
+        err_abort (status, "Init epoch");
+    printf ("epoch readers %s membarrier\n",
+        epoch.membarrier ? "use" : "can't use");
+
+    table = (table_t*)malloc (sizeof (table_t));
+    if (table == NULL)
+        errno_abort ("Allocate table");
+    table->version = 0;
+    for (i = 0; i < TABLESIZE; i++)
+        table->route[i] = rw_table.route[i] = 0;
+    rw_table.version = 0;
+
+    use_epoch = 0;
+    run ("rwlock", threads, seconds);
+    use_epoch = 1;
+    run ("epoch", threads, seconds);
+
+    status = epoch_destroy (&epoch);
+    if (status != 0)
+        err_abort (status, "Destroy epoch");
+    free (table);
+    return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * futex.h
+ *
+ * Thin wrappers for the Linux futex system call, used by the
+ * synchronization packages that park threads directly in the
+ * kernel rather than through a pthread mutex and condition
+ * variable.
+ *
+ * futex_wait() blocks only if *addr still contains "val", and
+ * returns 0 when awakened (or spuriously), EAGAIN if the value had
+ * already changed, EINTR, or ETIMEDOUT. Timeouts are absolute, and
+ * measured against CLOCK_MONOTONIC. Waiters and wakers may select
+ * a subset of the waiters on a word with a "bitset": a wake only
+ * reaches waiters whose bitset intersects its own.
+ *
+ * All futexes are process-private.
+ */
+#ifndef __futex_h
+#define __futex_h
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define FUTEX_ALL       INT_MAX         /* wake all waiters */
+
+static inline int futex_wait_bitset (
+    unsigned int *addr, unsigned int val,
+    const struct timespec *abstime, unsigned int bits)
+{
+    if (syscall (SYS_futex, addr, FUTEX_WAIT_BITSET_PRIVATE,
+            val, abstime, NULL, bits) == -1)
+        return errno;
+    return 0;
+}
+
+static inline int futex_wake_bitset (
+    unsigned int *addr, int count, unsigned int bits)
+{
+    if (syscall (SYS_futex, addr, FUTEX_WAKE_BITSET_PRIVATE,
+            count, NULL, NULL, bits) == -1)
+        return errno;
+    return 0;
+}
+
+static inline int futex_wait (
+    unsigned int *addr, unsigned int val, const struct timespec *abstime)
+{
+    return futex_wait_bitset (addr, val, abstime, FUTEX_BITSET_MATCH_ANY);
+}
+
+static inline int futex_wake (unsigned int *addr, int count)
+{
+    return futex_wake_bitset (addr, count, FUTEX_BITSET_MATCH_ANY);
+}
+
+#endif
@@ -0,0 +1,434 @@
+/*
+ * hashmap.c
+ *
+ * This file implements the lock-striped concurrent hash map.
+ *
+ * The hashmap_init() and hashmap_destroy() functions,
+ * respectively, allow you to initialize and destroy a map. The
+ * number of stripes is fixed at initialization (rounded up to a
+ * power of two), and bounds the number of concurrent writers.
+ *
+ * hashmap_lookup() finds the value for a key, returning ENOENT if
+ * there is none. hashmap_insert() adds a key, or replaces its
+ * value. hashmap_erase() removes a key, returning ENOENT if it
+ * was not present.
+ *
+ * Resizing: because both the stripe count and every table size
+ * are powers of two, and a table is never smaller than the number
+ * of stripes, the low bits of a key's hash select the same stripe
+ * in any table. So a stripe's lock protects its buckets in the old
+ * and the new table alike, and the stripe's entries can move from
+ * one to the other under that lock alone.
+ *
+ * When an insert finds its stripe over HASHMAP_LOAD entries per
+ * bucket, it calls hashmap_grow(), which allocates a table twice
+ * the size and installs it with every stripe write-locked. That
+ * pause is brief: it only swaps pointers. The entries are moved
+ * afterward. Each insert or erase moves HASHMAP_MIGRATE of its own
+ * stripe's old buckets, and the growing thread walks all the
+ * stripes, locking one at a time, so that the migration finishes
+ * even for stripes nobody updates. Until a stripe is finished,
+ * lookups there check both tables.
+ */
+#include <pthread.h>
+#include "errors.h"
+#include "hashmap.h"
+
+/*
+ * Mix the bits of a key (the splitmix64 finalizer), so that keys
+ * that differ only in high bits spread across stripes and buckets.
+ */
+static unsigned long hashmap_hash (unsigned long key)
+{
+    unsigned long long h = key;
+
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return (unsigned long)h;
+}
+
+/*
+ * Allocate an empty table with "size" buckets.
+ */
+static hashmap_table_t *hashmap_table_alloc (unsigned long size)
+{
+    hashmap_table_t *table;
+
+    table = (hashmap_table_t*)malloc (sizeof (hashmap_table_t));
+    if (table == NULL)
+        return NULL;
+    table->size = size;
+    table->bucket = (hashmap_entry_t**)calloc (
+        size, sizeof (hashmap_entry_t*));
+    if (table->bucket == NULL) {
+        free (table);
+        return NULL;
+    }
+    return table;
+}
+
+/*
+ * Free a table and every entry still in it.
+ */
+static void hashmap_table_free (hashmap_table_t *table)
+{
+    hashmap_entry_t *entry, *next;
+    unsigned long index;
+
+    for (index = 0; index < table->size; index++) {
+        for (entry = table->bucket[index]; entry != NULL; entry = next) {
+            next = entry->next;
+            free (entry);
+        }
+    }
+    free (table->bucket);
+    free (table);
+}
+
+/*
+ * Find the link that points to a key's entry in a bucket chain
+ * (or the terminating NULL link, if it is not present).
+ */
+static hashmap_entry_t **hashmap_find (
+    hashmap_table_t *table, unsigned long hash, unsigned long key)
+{
+    hashmap_entry_t **link;
+
+    link = &table->bucket[hash & (table->size - 1)];
+    while (*link != NULL && (*link)->key != key)
+        link = &(*link)->next;
+    return link;
+}
+
+/*
+ * Move up to "limit" of a stripe's old buckets into the current
+ * table. Called with the stripe write-locked. When the stripe's
+ * last old bucket is moved, the stripe stops using the old table;
+ * when the last stripe does so, free it.
+ */
+static void hashmap_migrate (
+    hashmap_t *map, hashmap_stripe_t *stripe, unsigned long limit)
+{
+    hashmap_table_t *old = stripe->old, *table = map->table;
+    hashmap_entry_t *entry, *next, **link;
+    unsigned long index, per_stripe;
+
+    per_stripe = old->size / map->stripes;
+    while (limit-- > 0 && stripe->migrate < per_stripe) {
+        index = (stripe - map->stripe)
+            + stripe->migrate * map->stripes;
+        for (entry = old->bucket[index]; entry != NULL; entry = next) {
+            next = entry->next;
+            link = &table->bucket[
+                hashmap_hash (entry->key) & (table->size - 1)];
+            entry->next = *link;
+            *link = entry;
+        }
+        old->bucket[index] = NULL;
+        stripe->migrate++;
+    }
+    if (stripe->migrate == per_stripe) {
+        stripe->old = NULL;
+        if (__atomic_sub_fetch (&map->migrating, 1, __ATOMIC_ACQ_REL) == 0)
+            hashmap_table_free (old);
+    }
+}
+
+/*
+ * Double the size of the bucket array, unless another thread
+ * already did so since the caller saw a table of "size" buckets.
+ */
+static int hashmap_grow (hashmap_t *map, unsigned long size)
+{
+    hashmap_table_t *table;
+    int index, status, done;
+
+    status = pthread_mutex_lock (&map->resize);
+    if (status != 0)
+        return status;
+
+    table = hashmap_table_alloc (size * 2);
+    if (table == NULL) {
+        pthread_mutex_unlock (&map->resize);
+        return ENOMEM;
+    }
+
+    /*
+     * Install the new table with every stripe write-locked (in
+     * order, so that concurrent growers can't deadlock -- though
+     * the resize mutex already prevents that).
+     */
+    for (index = 0; index < map->stripes; index++) {
+        status = rwl_writelock (&map->stripe[index].lock);
+        if (status != 0)
+            err_abort (status, "Lock stripe");
+    }
+    done = (map->table->size != size || map->migrating != 0);
+    if (!done) {
+        for (index = 0; index < map->stripes; index++) {
+            map->stripe[index].old = map->table;
+            map->stripe[index].migrate = 0;
+        }
+        map->migrating = map->stripes;
+        map->table = table;
+    }
+    for (index = map->stripes - 1; index >= 0; index--) {
+        status = rwl_writeunlock (&map->stripe[index].lock);
+        if (status != 0)
+            err_abort (status, "Unlock stripe");
+    }
+    if (done) {
+        hashmap_table_free (table);
+        return pthread_mutex_unlock (&map->resize);
+    }
+
+    /*
+     * Now move the entries, a batch at a time, releasing each
+     * stripe's lock between batches so that other threads are
+     * never held up for long.
+     */
+    for (index = 0; index < map->stripes; index++) {
+        hashmap_stripe_t *stripe = &map->stripe[index];
+
+        while (1) {
+            status = rwl_writelock (&stripe->lock);
+            if (status != 0)
+                err_abort (status, "Lock stripe");
+            if (stripe->old != NULL)
+                hashmap_migrate (map, stripe, HASHMAP_MIGRATE);
+            done = (stripe->old == NULL);
+            status = rwl_writeunlock (&stripe->lock);
+            if (status != 0)
+                err_abort (status, "Unlock stripe");
+            if (done)
+                break;
+        }
+    }
+    return pthread_mutex_unlock (&map->resize);
+}
+
+/*
+ * Initialize a hash map.
+ */
+int hashmap_init (hashmap_t *map, int stripes, unsigned long buckets)
+{
+    int count, index, status;
+    unsigned long size;
+
+    if (stripes < 1)
+        return EINVAL;
+    for (count = 1; count < stripes; count <<= 1)
+        ;
+    for (size = count; size < buckets; size <<= 1)
+        ;
+    map->stripes = count;
+    map->migrating = 0;
+    map->table = hashmap_table_alloc (size);
+    if (map->table == NULL)
+        return ENOMEM;
+    status = posix_memalign ((void**)&map->stripe, HASHMAP_CACHELINE,
+        count * sizeof (hashmap_stripe_t));
+    if (status != 0) {
+        hashmap_table_free (map->table);
+        return status;
+    }
+    for (index = 0; index < count; index++) {
+        map->stripe[index].old = NULL;
+        map->stripe[index].migrate = 0;
+        map->stripe[index].count = 0;
+        status = rwl_init (&map->stripe[index].lock);
+        if (status != 0) {
+            while (--index >= 0)
+                rwl_destroy (&map->stripe[index].lock);
+            free (map->stripe);
+            hashmap_table_free (map->table);
+            return status;
+        }
+    }
+    status = pthread_mutex_init (&map->resize, NULL);
+    if (status != 0) {
+        for (index = 0; index < count; index++)
+            rwl_destroy (&map->stripe[index].lock);
+        free (map->stripe);
+        hashmap_table_free (map->table);
+        return status;
+    }
+    map->valid = HASHMAP_VALID;
+    return 0;
+}
+
+/*
+ * Destroy a hash map, and free all its entries. (The values
+ * themselves belong to the caller.)
+ */
+int hashmap_destroy (hashmap_t *map)
+{
+    int index, status;
+
+    if (map->valid != HASHMAP_VALID)
+        return EINVAL;
+    status = pthread_mutex_lock (&map->resize);
+    if (status != 0)
+        return status;
+    for (index = 0; index < map->stripes; index++) {
+        status = rwl_destroy (&map->stripe[index].lock);
+        if (status != 0) {
+            pthread_mutex_unlock (&map->resize);
+            return status;
+        }
+    }
+    map->valid = 0;
+    if (map->migrating != 0) {
+        for (index = 0; index < map->stripes; index++) {
+            if (map->stripe[index].old != NULL) {
+                hashmap_table_free (map->stripe[index].old);
+                break;
+            }
+        }
+    }
+    hashmap_table_free (map->table);
+    free (map->stripe);
+    pthread_mutex_unlock (&map->resize);
+    return pthread_mutex_destroy (&map->resize);
+}
+
+/*
+ * Look up a key.
+ */
+int hashmap_lookup (hashmap_t *map, unsigned long key, void **value)
+{
+    unsigned long hash = hashmap_hash (key);
+    hashmap_stripe_t *stripe;
+    hashmap_entry_t *entry;
+    int status, status2;
+
+    if (map->valid != HASHMAP_VALID)
+        return EINVAL;
+    stripe = &map->stripe[hash & (map->stripes - 1)];
+    status = rwl_readlock (&stripe->lock);
+    if (status != 0)
+        return status;
+    entry = *hashmap_find (map->table, hash, key);
+    if (entry == NULL && stripe->old != NULL)
+        entry = *hashmap_find (stripe->old, hash, key);
+    if (entry != NULL)
+        *value = entry->value;
+    else
+        status = ENOENT;
+    status2 = rwl_readunlock (&stripe->lock);
+    return (status2 != 0 ? status2 : status);
+}
+
+/*
+ * Insert a key, or replace its value.
+ */
+int hashmap_insert (hashmap_t *map, unsigned long key, void *value)
+{
+    unsigned long hash = hashmap_hash (key);
+    unsigned long size = 0;
+    hashmap_stripe_t *stripe;
+    hashmap_entry_t *entry, *new_entry, **link;
+    int status;
+
+    if (map->valid != HASHMAP_VALID)
+        return EINVAL;
+
+    /*
+     * Allocate outside the lock; it's freed if the key turns out
+     * to be present already.
+     */
+    new_entry = (hashmap_entry_t*)malloc (sizeof (hashmap_entry_t));
+    if (new_entry == NULL)
+        return ENOMEM;
+    new_entry->key = key;
+    new_entry->value = value;
+
+    stripe = &map->stripe[hash & (map->stripes - 1)];
+    status = rwl_writelock (&stripe->lock);
+    if (status != 0) {
+        free (new_entry);
+        return status;
+    }
+    if (stripe->old != NULL)
+        hashmap_migrate (map, stripe, HASHMAP_MIGRATE);
+    entry = *hashmap_find (map->table, hash, key);
+    if (entry == NULL && stripe->old != NULL)
+        entry = *hashmap_find (stripe->old, hash, key);
+    if (entry != NULL) {
+        entry->value = value;
+    } else {
+        link = &map->table->bucket[hash & (map->table->size - 1)];
+        new_entry->next = *link;
+        *link = new_entry;
+        new_entry = NULL;
+        stripe->count++;
+        if (stripe->old == NULL && stripe->count
+            > HASHMAP_LOAD * (map->table->size / map->stripes))
+            size = map->table->size;
+    }
+    status = rwl_writeunlock (&stripe->lock);
+    free (new_entry);
+    if (status != 0)
+        return status;
+    if (size != 0)
+        return hashmap_grow (map, size);
+    return 0;
+}
+
+/*
+ * Remove a key.
+ */
+int hashmap_erase (hashmap_t *map, unsigned long key)
+{
+    unsigned long hash = hashmap_hash (key);
+    hashmap_stripe_t *stripe;
+    hashmap_entry_t *entry = NULL, **link;
+    int status, status2;
+
+    if (map->valid != HASHMAP_VALID)
+        return EINVAL;
+    stripe = &map->stripe[hash & (map->stripes - 1)];
+    status = rwl_writelock (&stripe->lock);
+    if (status != 0)
+        return status;
+    if (stripe->old != NULL)
+        hashmap_migrate (map, stripe, HASHMAP_MIGRATE);
+    link = hashmap_find (map->table, hash, key);
+    if (*link == NULL && stripe->old != NULL)
+        link = hashmap_find (stripe->old, hash, key);
+    if (*link != NULL) {
+        entry = *link;
+        *link = entry->next;
+        stripe->count--;
+    } else
+        status = ENOENT;
+    status2 = rwl_writeunlock (&stripe->lock);
+    free (entry);
+    return (status2 != 0 ? status2 : status);
+}
+
+/*
+ * Count the entries in the map. The result is exact only if no
+ * other thread is updating the map.
+ */
+int hashmap_count (hashmap_t *map, unsigned long *count)
+{
+    int index, status;
+
+    if (map->valid != HASHMAP_VALID)
+        return EINVAL;
+    *count = 0;
+    for (index = 0; index < map->stripes; index++) {
+        status = rwl_readlock (&map->stripe[index].lock);
+        if (status != 0)
+            return status;
+        *count += map->stripe[index].count;
+        status = rwl_readunlock (&map->stripe[index].lock);
+        if (status != 0)
+            return status;
+    }
+    return 0;
+}
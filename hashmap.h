@@ -0,0 +1,92 @@
+/*
+ * hashmap.h
+ *
+ * This header file describes a concurrent hash map built on the
+ * read-write locks in rwlock.c. The map's buckets are divided
+ * among a fixed number of "stripes", each protected by its own
+ * read-write lock in its own cache line: lookups take the stripe's
+ * read lock, and inserts and erases take its write lock.
+ *
+ * The bucket array doubles when the map gets too full. The
+ * entries are moved to the new array incrementally, a few buckets
+ * at a time under one stripe's write lock, so that lookups and
+ * updates continue throughout the resize.
+ *
+ * Keys are unsigned longs, and values are untyped pointers.
+ */
+#ifndef __hashmap_h
+#define __hashmap_h
+#include <pthread.h>
+#include "rwlock.h"
+
+#define HASHMAP_CACHELINE       64
+
+/*
+ * One key/value pair.
+ */
+typedef struct hashmap_entry_tag {
+    struct hashmap_entry_tag    *next;  /* bucket chain */
+    unsigned long               key;
+    void                        *value;
+} hashmap_entry_t;
+
+/*
+ * A bucket array. Its size is a power of two, and at least the
+ * number of stripes, so that every key maps to the same stripe
+ * in any table.
+ */
+typedef struct hashmap_table_tag {
+    unsigned long               size;   /* number of buckets */
+    hashmap_entry_t             **bucket;
+} hashmap_table_t;
+
+/*
+ * A stripe: the lock for buckets (s, s + stripes, s + 2*stripes,
+ * ...) of both the current table and, during a resize, the old
+ * one.
+ */
+typedef struct hashmap_stripe_tag {
+    rwlock_t                    lock;
+    hashmap_table_t             *old;   /* being emptied, or NULL */
+    unsigned long               migrate;/* next old bucket to move */
+    unsigned long               count;  /* entries in this stripe */
+} __attribute__ ((aligned (HASHMAP_CACHELINE))) hashmap_stripe_t;
+
+/*
+ * Structure describing a hash map.
+ */
+typedef struct hashmap_tag {
+    hashmap_stripe_t    *stripe;        /* array of stripes */
+    int                 stripes;        /* number of stripes */
+    int                 valid;          /* set when valid */
+    hashmap_table_t     *table;         /* current bucket array */
+    int                 migrating;      /* stripes not yet migrated */
+    pthread_mutex_t     resize;         /* one resize at a time */
+} hashmap_t;
+
+#define HASHMAP_VALID   0xa5b17a
+
+/*
+ * Average entries per bucket at which the map grows.
+ */
+#define HASHMAP_LOAD    2
+
+/*
+ * Number of old buckets an update moves to the new table.
+ */
+#define HASHMAP_MIGRATE 8
+
+/*
+ * Define hash map functions
+ */
+extern int hashmap_init (
+    hashmap_t *map, int stripes, unsigned long buckets);
+extern int hashmap_destroy (hashmap_t *map);
+extern int hashmap_lookup (
+    hashmap_t *map, unsigned long key, void **value);
+extern int hashmap_insert (
+    hashmap_t *map, unsigned long key, void *value);
+extern int hashmap_erase (hashmap_t *map, unsigned long key);
+extern int hashmap_count (hashmap_t *map, unsigned long *count);
+
+#endif
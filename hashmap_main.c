@@ -0,0 +1,190 @@
+/*
+ * hashmap_main.c
+ *
+ * Benchmark the lock-striped hash map in hashmap.c, for uniform
+ * and zipfian key distributions at several read/write ratios.
+ *
+ * Each run keeps THREADS threads busy for SECONDS; of the writes,
+ * half insert and half erase a key drawn from the same
+ * distribution as the lookups. The map starts small, and the
+ * first run ("fill") only inserts and looks up uniform keys, so
+ * that the table grows several times while readers and writers
+ * are busy; each run reports the number of buckets before and
+ * after it, so that the fill shows how the map does while it's
+ * resizing.
+ *
+ * Usage: hashmap_main [threads [seconds [keys [stripes]]]]
+ */
+#include <pthread.h>
+#include <time.h>
+#include "hashmap.h"
+#include "bench.h"
+#include "errors.h"
+
+#define THREADS         4
+#define SECONDS         1
+#define KEYS            1000000
+#define STRIPES         64
+#define ZIPF_THETA      0.99
+
+/*
+ * Keep track of each thread.
+ */
+typedef struct thread_tag {
+    pthread_t           thread_id;
+    unsigned long long  seed;           /* xorshift state */
+    unsigned long       ops;
+    unsigned long       hits;
+} thread_t;
+
+hashmap_t map;
+bench_zipf_t zipf;
+int use_zipf;                           /* Distribution for this run */
+int read_percent;                       /* Read ratio for this run */
+int fill;                               /* Writes only insert */
+unsigned long keys = KEYS;
+volatile int stop;
+
+/*
+ * xorshift64* -- cheap per-thread random numbers.
+ */
+static unsigned long long next_random (thread_t *self)
+{
+    self->seed ^= self->seed >> 12;
+    self->seed ^= self->seed << 25;
+    self->seed ^= self->seed >> 27;
+    return self->seed * 2685821657736338717ULL;
+}
+
+static unsigned long next_key (thread_t *self)
+{
+    unsigned long long r = next_random (self);
+
+    if (use_zipf)
+        return bench_zipf_next (&zipf, (r >> 11) * (1.0 / 9007199254740992.0));
+    return r % keys;
+}
+
+/*
+ * Thread start routine: a mix of lookups, inserts, and erases.
+ */
+void *thread_routine (void *arg)
+{
+    thread_t *self = (thread_t*)arg;
+    unsigned long key;
+    void *value;
+    int op, status;
+
+    while (!stop) {
+        key = next_key (self);
+        op = next_random (self) % 200;
+        if (op < read_percent * 2) {
+            status = hashmap_lookup (&map, key, &value);
+            if (status == 0)
+                self->hits++;
+            else if (status != ENOENT)
+                err_abort (status, "Lookup");
+        } else if (fill || (op & 1)) {
+            status = hashmap_insert (&map, key, (void*)key);
+            if (status != 0)
+                err_abort (status, "Insert");
+        } else {
+            status = hashmap_erase (&map, key);
+            if (status != 0 && status != ENOENT)
+                err_abort (status, "Erase");
+        }
+        self->ops++;
+    }
+    return NULL;
+}
+
+/*
+ * Run one timed pass, and report the throughput.
+ */
+static void run (int threads, int seconds)
+{
+    thread_t *thread;
+    unsigned long ops = 0, hits = 0, count, buckets;
+    int index, status;
+
+    thread = (thread_t*)calloc (threads, sizeof (thread_t));
+    if (thread == NULL)
+        errno_abort ("Allocate threads");
+    buckets = map.table->size;
+    stop = 0;
+    for (index = 0; index < threads; index++) {
+        thread[index].seed = 0x9e3779b97f4a7c15ULL * (index + 1);
+        status = pthread_create (&thread[index].thread_id,
+            NULL, thread_routine, (void*)&thread[index]);
+        if (status != 0)
+            err_abort (status, "Create thread");
+    }
+    sleep (seconds);
+    stop = 1;
+    for (index = 0; index < threads; index++) {
+        status = pthread_join (thread[index].thread_id, NULL);
+        if (status != 0)
+            err_abort (status, "Join thread");
+        ops += thread[index].ops;
+        hits += thread[index].hits;
+    }
+    status = hashmap_count (&map, &count);
+    if (status != 0)
+        err_abort (status, "Count");
+    printf ("%-8s %5d%% %8.2f %8.1f%% %10lu %8lu %8lu\n",
+        fill ? "fill" : use_zipf ? "zipf" : "uniform", read_percent,
+        ops / (double)seconds / 1e6,
+        ops == 0 ? 0.0 : 100.0 * hits / ops,
+        count, buckets, map.table->size);
+    free (thread);
+}
+
+int main (int argc, char *argv[])
+{
+    static int ratios[] = {100, 95, 80, 50};
+    int threads = THREADS, seconds = SECONDS, stripes = STRIPES;
+    int dist, ratio, status;
+
+    if (argc > 1)
+        threads = atoi (argv[1]);
+    if (argc > 2)
+        seconds = atoi (argv[2]);
+    if (argc > 3)
+        keys = strtoul (argv[3], NULL, 0);
+    if (argc > 4)
+        stripes = atoi (argv[4]);
+    if (threads < 1 || seconds < 1 || keys < 2 || stripes < 1) {
+        fprintf (stderr,
+            "Usage: %s [threads [seconds [keys [stripes]]]]\n", argv[0]);
+        return -1;
+    }
+
+    /*
+     * Start with a small table, which the fill run grows.
+     */
+    status = hashmap_init (&map, stripes, stripes);
+    if (status != 0)
+        err_abort (status, "Init map");
+    bench_zipf_init (&zipf, keys, ZIPF_THETA);
+
+    printf ("%d threads, %d stripes, %lu keys, %d s per run\n",
+        threads, map.stripes, keys, seconds);
+    printf ("%-8s %6s %8s %9s %10s %8s %8s\n",
+        "dist", "reads", "Mops/s", "hits", "entries", "from", "buckets");
+    fill = 1;
+    read_percent = 50;
+    run (threads, seconds);
+    fill = 0;
+    for (dist = 0; dist < 2; dist++) {
+        use_zipf = dist;
+        for (ratio = 0; ratio < sizeof (ratios) / sizeof (ratios[0]); ratio++) {
+            read_percent = ratios[ratio];
+            run (threads, seconds);
+        }
+    }
+
+    status = hashmap_destroy (&map);
+    if (status != 0)
+        err_abort (status, "Destroy map");
+    return 0;
+}
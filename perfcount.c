@@ -0,0 +1,163 @@
+/*
+ * perfcount.c
+ *
+ * This file implements the perf_event_open() counter wrapper.
+ *
+ * perfcount_open() opens a counter for the calling process, with
+ * "inherit" set so that threads created afterward are counted
+ * too. (The kernel folds a thread's count into the parent counter
+ * when the thread exits, so read the counter after joining.)
+ * It returns 0 even if the counter is unavailable -- for example,
+ * because perf_event_paranoid forbids it, or there is no PMU in a
+ * virtual machine -- in which case perfcount_available() returns
+ * 0 and perfcount_read() returns ENOENT.
+ */
+#include <sys/ioctl.h>
+#include "errors.h"
+#include "perfcount.h"
+#ifdef __linux__
+# include <sys/syscall.h>
+# include <linux/perf_event.h>
+#endif
+
+/*
+ * The system call counter uses the raw_syscalls:sys_enter
+ * tracepoint, whose id must be read from tracefs.
+ */
+static long perfcount_tracepoint (const char *event)
+{
+    static const char *roots[] = {
+        "/sys/kernel/tracing/events/",
+        "/sys/kernel/debug/tracing/events/",
+        NULL};
+    char path[256];
+    FILE *file;
+    long id;
+    int root;
+
+    for (root = 0; roots[root] != NULL; root++) {
+        snprintf (path, sizeof (path), "%s%s/id", roots[root], event);
+        file = fopen (path, "r");
+        if (file == NULL)
+            continue;
+        if (fscanf (file, "%ld", &id) != 1)
+            id = -1;
+        fclose (file);
+        return id;
+    }
+    return -1;
+}
+
+/*
+ * Open a counter for an event.
+ */
+int perfcount_open (perfcount_t *pc, int event)
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+    long id;
+
+    pc->fd = -1;
+    pc->event = event;
+    memset (&attr, 0, sizeof (attr));
+    attr.size = sizeof (attr);
+    attr.inherit = 1;
+    attr.exclude_hv = 1;
+    switch (event) {
+    case PERFCOUNT_SYSCALLS:
+        id = perfcount_tracepoint ("raw_syscalls/sys_enter");
+        if (id < 0)
+            return 0;
+        attr.type = PERF_TYPE_TRACEPOINT;
+        attr.config = id;
+        break;
+    case PERFCOUNT_CSWITCHES:
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+        break;
+    case PERFCOUNT_CACHE_MISSES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.exclude_kernel = 1;
+        break;
+    case PERFCOUNT_L1D_MISSES:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.exclude_kernel = 1;
+        break;
+    default:
+        return EINVAL;
+    }
+    pc->fd = syscall (SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (pc->fd < 0)
+        pc->fd = -1;
+    return 0;
+#else
+    pc->fd = -1;
+    pc->event = event;
+    return 0;
+#endif
+}
+
+/*
+ * Close a counter.
+ */
+int perfcount_close (perfcount_t *pc)
+{
+    if (pc->fd >= 0 && close (pc->fd) != 0)
+        return errno;
+    pc->fd = -1;
+    return 0;
+}
+
+/*
+ * Report whether the counter is counting.
+ */
+int perfcount_available (perfcount_t *pc)
+{
+    return pc->fd >= 0;
+}
+
+/*
+ * Reset a counter to zero.
+ */
+int perfcount_reset (perfcount_t *pc)
+{
+#ifdef __linux__
+    if (pc->fd < 0)
+        return ENOENT;
+    if (ioctl (pc->fd, PERF_EVENT_IOC_RESET, 0) != 0)
+        return errno;
+    return 0;
+#else
+    return ENOENT;
+#endif
+}
+
+/*
+ * Read a counter's current value.
+ */
+int perfcount_read (perfcount_t *pc, unsigned long long *value)
+{
+    if (pc->fd < 0)
+        return ENOENT;
+    if (read (pc->fd, value, sizeof (*value)) != sizeof (*value))
+        return errno != 0 ? errno : EIO;
+    return 0;
+}
+
+/*
+ * Return a short printable name for an event.
+ */
+const char *perfcount_name (int event)
+{
+    switch (event) {
+    case PERFCOUNT_SYSCALLS:            return "syscalls";
+    case PERFCOUNT_CSWITCHES:           return "cswitches";
+    case PERFCOUNT_CACHE_MISSES:        return "cache-misses";
+    case PERFCOUNT_L1D_MISSES:          return "L1d-misses";
+    default:                            return "unknown";
+    }
+}
@@ -0,0 +1,42 @@
+/*
+ * perfcount.h
+ *
+ * This header file describes a small wrapper for Linux
+ * perf_event_open() counters, used by the benchmark programs to
+ * count system calls, context switches, and cache misses made by
+ * the whole process (including threads created after the counter
+ * is opened, once they have been joined).
+ *
+ * Counters that the kernel or the system configuration doesn't
+ * allow are simply reported as unavailable.
+ */
+#ifndef __perfcount_h
+#define __perfcount_h
+
+/*
+ * Events that can be counted.
+ */
+#define PERFCOUNT_SYSCALLS      0       /* system calls entered */
+#define PERFCOUNT_CSWITCHES     1       /* context switches */
+#define PERFCOUNT_CACHE_MISSES  2       /* last-level cache misses */
+#define PERFCOUNT_L1D_MISSES    3       /* L1 data cache read misses */
+
+/*
+ * Structure describing a counter.
+ */
+typedef struct perfcount_tag {
+    int                 fd;             /* -1 if unavailable */
+    int                 event;          /* PERFCOUNT_xxx */
+} perfcount_t;
+
+/*
+ * Define counter functions
+ */
+extern int perfcount_open (perfcount_t *pc, int event);
+extern int perfcount_close (perfcount_t *pc);
+extern int perfcount_available (perfcount_t *pc);
+extern int perfcount_reset (perfcount_t *pc);
+extern int perfcount_read (perfcount_t *pc, unsigned long long *value);
+extern const char *perfcount_name (int event);
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ * phaser_main.c
+ *
+ * Demonstrate use of the barrier package as a phaser, whose set
+ * of threads changes from phase to phase.
+ *
+ * The main thread drives PHASES phases. Before each of the first
+ * THREADS phases, it registers a new party with the barrier, and
+ * starts a worker to be that party; worker n stays for
+ * WORK_PHASES + n phases, and leaves. Each worker counts itself
+ * in each of its phases, so the printed totals show the set
+ * growing and shrinking with no barrier_destroy()/barrier_init()
+ * in between.
+ */
+#include <pthread.h>
+#include "barrier.h"
+#include "errors.h"
+
+#define THREADS         4
+#define WORK_PHASES     3
+#define PHASES          (2 * THREADS + WORK_PHASES - 2)
+
+/*
+ * Keep track of each thread
+ */
+typedef struct thread_tag {
+    pthread_t   thread_id;
+    int         number;
+    unsigned long phase;                /* First phase */
+} thread_t;
+
+barrier_t barrier;
+thread_t thread[THREADS];
+int work[PHASES + 1];                   /* Parties in each phase */
+pthread_mutex_t work_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Start routine for workers.
+ */
+void *thread_routine (void *arg)
+{
+    thread_t *self = (thread_t*)arg;
+    barrier_token_t token;
+    unsigned long phase = self->phase;
+    int count, status;
+
+    for (count = 0; count < WORK_PHASES + self->number; count++) {
+        status = pthread_mutex_lock (&work_mutex);
+        if (status != 0)
+            err_abort (status, "Lock work");
+        work[phase]++;
+        status = pthread_mutex_unlock (&work_mutex);
+        if (status != 0)
+            err_abort (status, "Unlock work");
+
+        /*
+         * The last phase for this worker: leave, without waiting
+         * for the others.
+         */
+        if (count == WORK_PHASES + self->number - 1) {
+            status = barrier_arrive_and_deregister (&barrier);
+            if (status > 0)
+                err_abort (status, "Deregister");
+            break;
+        }
+        status = barrier_arrive (&barrier, &token);
+        if (status > 0)
+            err_abort (status, "Arrive");
+        status = barrier_await (&barrier, &token);
+        if (status > 0)
+            err_abort (status, "Await");
+        phase = token.phase + 1;
+    }
+    return NULL;
+}
+
+int main (int argc, char *argv[])
+{
+    barrier_token_t token;
+    int count, status;
+
+    /*
+     * The main thread is the one initial party.
+     */
+    status = barrier_init (&barrier, 1);
+    if (status != 0)
+        err_abort (status, "Init barrier");
+
+    for (count = 0; count < PHASES; count++) {
+        if (count < THREADS) {
+            /*
+             * Register the worker before starting it, so that it
+             * is sure to take part in this phase.
+             */
+            status = barrier_register (&barrier, &thread[count].phase);
+            if (status != 0)
+                err_abort (status, "Register");
+            thread[count].number = count;
+            status = pthread_create (&thread[count].thread_id,
+                NULL, thread_routine, (void*)&thread[count]);
+            if (status != 0)
+                err_abort (status, "Create thread");
+        }
+
+        status = barrier_arrive (&barrier, &token);
+        if (status > 0)
+            err_abort (status, "Arrive");
+        status = barrier_await (&barrier, &token);
+        if (status > 0)
+            err_abort (status, "Await");
+        printf ("phase %lu: %d workers\n", token.phase, work[token.phase]);
+    }
+
+    for (count = 0; count < THREADS; count++) {
+        status = pthread_join (thread[count].thread_id, NULL);
+        if (status != 0)
+            err_abort (status, "Join thread");
+    }
+    status = barrier_destroy (&barrier);
+    if (status != 0)
+        err_abort (status, "Destroy barrier");
+    return 0;
+}
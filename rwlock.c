@@ -20,15 +20,172 @@
  * exclusive write access, and rwl_writeunlock() releases the
  * lock. rwl_writetrylock() attempts to lock a read-write lock
  * for write access, and returns EBUSY instead of blocking.
+ *
+ * The rwl_timedreadlock() and rwl_timedwritelock() functions
+ * behave like rwl_readlock() and rwl_writelock(), but give up
+ * and return ETIMEDOUT if the lock cannot be acquired before an
+ * absolute deadline measured against CLOCK_MONOTONIC.
+ *
+ * When compiled with -DRWL_PROFILE, every lock counts its
+ * acquisitions and contended acquisitions, and keeps histograms
+ * of the time spent waiting and the time the lock is held.
+ * rwl_init_named() attaches a name to a lock for the report,
+ * and rwl_stats_dump() prints the most contended locks. Without
+ * RWL_PROFILE the hooks below expand to nothing.
  */
+#define _GNU_SOURCE                     /* for pthread_cond_clockwait */
 #include <pthread.h>
+#include <time.h>
 #include "errors.h"
 #include "rwlock.h"
 
+#ifdef RWL_PROFILE
+/*
+ * All profiled locks are kept on a list, so that rwl_stats_dump()
+ * can find them. Lock ordering: prof_mutex may be locked before a
+ * lock's own mutex, never after.
+ */
+static pthread_mutex_t prof_mutex = PTHREAD_MUTEX_INITIALIZER;
+static rwlock_t *prof_list = NULL;
+
+static unsigned long long rwl_prof_now (void)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void rwl_prof_record (unsigned long *hist, unsigned long long ns)
+{
+    int bucket = 0;
+
+    while (ns != 0 && bucket < RWL_HIST_BUCKETS - 1) {
+        ns >>= 1;
+        bucket++;
+    }
+    hist[bucket]++;
+}
+
+/*
+ * Put a lock on the list of profiled locks. Statically
+ * initialized locks come here on first use.
+ */
+static void rwl_prof_register (rwlock_t *rwl)
+{
+    pthread_mutex_lock (&prof_mutex);
+    if (!rwl->stats.registered) {
+        rwl->stats.next = prof_list;
+        prof_list = rwl;
+        rwl->stats.registered = 1;
+    }
+    pthread_mutex_unlock (&prof_mutex);
+}
+
+static void rwl_prof_unregister (rwlock_t *rwl)
+{
+    rwlock_t **link;
+
+    pthread_mutex_lock (&prof_mutex);
+    for (link = &prof_list; *link != NULL; link = &(*link)->stats.next) {
+        if (*link == rwl) {
+            *link = rwl->stats.next;
+            break;
+        }
+    }
+    rwl->stats.registered = 0;
+    pthread_mutex_unlock (&prof_mutex);
+}
+
+/*
+ * Lock the internal mutex, counting the times some other thread
+ * already held it.
+ */
+static int rwl_prof_mutex_lock (rwlock_t *rwl)
+{
+    int status;
+
+    if (!rwl->stats.registered)
+        rwl_prof_register (rwl);
+    status = pthread_mutex_trylock (&rwl->mutex);
+    if (status != EBUSY)
+        return status;
+    status = pthread_mutex_lock (&rwl->mutex);
+    if (status == 0)
+        rwl->stats.m_contended++;
+    return status;
+}
+
+/*
+ * Record a successful acquisition. "start" is the time the
+ * caller began to wait, or 0 if it didn't have to. Called with
+ * the mutex locked, after r_active or w_active is updated.
+ */
+static void rwl_prof_acquire (
+    rwlock_t *rwl, int write, unsigned long long start)
+{
+    rwl_stats_t *stats = &rwl->stats;
+    unsigned long long now = rwl_prof_now ();
+
+    if (start != 0)
+        rwl_prof_record (stats->wait_hist, now - start);
+    if (write) {
+        stats->w_acquired++;
+        if (start != 0)
+            stats->w_contended++;
+        stats->w_start = now;
+    } else {
+        stats->r_acquired++;
+        if (start != 0)
+            stats->r_contended++;
+        if (rwl->r_active == 1)
+            stats->r_start = now;
+        if (rwl->r_active > stats->max_readers)
+            stats->max_readers = rwl->r_active;
+    }
+}
+
+/*
+ * Record the end of a hold. For readers, the hold time is the
+ * length of the period during which any reader held the lock.
+ */
+static void rwl_prof_release (rwlock_t *rwl, int write)
+{
+    rwl_stats_t *stats = &rwl->stats;
+
+    if (write)
+        rwl_prof_record (stats->hold_hist, rwl_prof_now () - stats->w_start);
+    else if (rwl->r_active == 0)
+        rwl_prof_record (stats->hold_hist, rwl_prof_now () - stats->r_start);
+}
+
+# define RWL_LOCK(rwl)                  rwl_prof_mutex_lock (rwl)
+# define PROF_DECL(start)               unsigned long long start = 0
+# define PROF_START(start)              (start) = rwl_prof_now ()
+# define PROF_ACQUIRE(rwl, w, start)    rwl_prof_acquire (rwl, w, start)
+# define PROF_RELEASE(rwl, w)           rwl_prof_release (rwl, w)
+#else
+# define RWL_LOCK(rwl)                  pthread_mutex_lock (&(rwl)->mutex)
+# define PROF_DECL(start)
+# define PROF_START(start)
+# define PROF_ACQUIRE(rwl, w, start)
+# define PROF_RELEASE(rwl, w)
+#endif
+
 /*
  * Initialize a read-write lock
  */
 int rwl_init (rwlock_t *rwl)
+{
+    return rwl_init_named (rwl, NULL);
+}
+
+/*
+ * Initialize a read-write lock, giving it a name by which
+ * rwl_stats_dump() can report it. The name is not copied. (The
+ * name is ignored unless compiled with RWL_PROFILE.)
+ */
+int rwl_init_named (rwlock_t *rwl, const char *name)
 {
     int status;
 
@@ -52,6 +209,11 @@ int rwl_init (rwlock_t *rwl)
         return status;
     }
     rwl->valid = RWLOCK_VALID;
+#ifdef RWL_PROFILE
+    memset (&rwl->stats, 0, sizeof (rwl->stats));
+    rwl->stats.name = name;
+    rwl_prof_register (rwl);
+#endif
     return 0;
 }
 
@@ -90,6 +252,9 @@ int rwl_destroy (rwlock_t *rwl)
     status = pthread_mutex_unlock (&rwl->mutex);
     if (status != 0)
         return status;
+#ifdef RWL_PROFILE
+    rwl_prof_unregister (rwl);
+#endif
     status = pthread_mutex_destroy (&rwl->mutex);
     status1 = pthread_cond_destroy (&rwl->read);
     status2 = pthread_cond_destroy (&rwl->write);
@@ -117,13 +282,15 @@ static void rwl_readcleanup (void *arg)
 int rwl_readlock (rwlock_t *rwl)
 {
     int status;
+    PROF_DECL (start);
 
     if (rwl->valid != RWLOCK_VALID)
         return EINVAL;
-    status = pthread_mutex_lock (&rwl->mutex);
+    status = RWL_LOCK (rwl);
     if (status != 0)
         return status;
     if (rwl->w_active) {
+        PROF_START (start);
         rwl->r_wait++;
         pthread_cleanup_push (rwl_readcleanup, (void*)rwl);
         while (rwl->w_active) {
@@ -134,8 +301,10 @@ int rwl_readlock (rwlock_t *rwl)
         pthread_cleanup_pop (0);
         rwl->r_wait--;
     }
-    if (status == 0)
+    if (status == 0) {
         rwl->r_active++;
+        PROF_ACQUIRE (rwl, 0, start);
+    }
     pthread_mutex_unlock (&rwl->mutex);
     return status;
 }
@@ -150,17 +319,65 @@ int rwl_readtrylock (rwlock_t *rwl)
 
     if (rwl->valid != RWLOCK_VALID)
         return EINVAL;
-    status = pthread_mutex_lock (&rwl->mutex);
+    status = RWL_LOCK (rwl);
     if (status != 0)
         return status;
     if (rwl->w_active)
         status = EBUSY;
-    else
+    else {
         rwl->r_active++;
+        PROF_ACQUIRE (rwl, 0, 0);
+    }
     status2 = pthread_mutex_unlock (&rwl->mutex);
     return (status2 != 0 ? status2 : status);
 }
 
+/*
+ * Lock a read-write lock for read access, waiting no later than
+ * the absolute CLOCK_MONOTONIC time "abstime".
+ *
+ * Readers are awakened by broadcast, so a reader that times out
+ * never "consumes" a wakeup intended for another thread; it need
+ * only record that it is no longer waiting.
+ */
+int rwl_timedreadlock (rwlock_t *rwl, const struct timespec *abstime)
+{
+    int status;
+    PROF_DECL (start);
+
+    if (rwl->valid != RWLOCK_VALID)
+        return EINVAL;
+    status = RWL_LOCK (rwl);
+    if (status != 0)
+        return status;
+    if (rwl->w_active) {
+        PROF_START (start);
+        rwl->r_wait++;
+        pthread_cleanup_push (rwl_readcleanup, (void*)rwl);
+        while (rwl->w_active) {
+            status = pthread_cond_clockwait (
+                &rwl->read, &rwl->mutex, CLOCK_MONOTONIC, abstime);
+            if (status != 0)
+                break;
+        }
+        pthread_cleanup_pop (0);
+        rwl->r_wait--;
+
+        /*
+         * If the writer released the lock just as we timed out,
+         * take the lock rather than report a spurious failure.
+         */
+        if (status == ETIMEDOUT && !rwl->w_active)
+            status = 0;
+    }
+    if (status == 0) {
+        rwl->r_active++;
+        PROF_ACQUIRE (rwl, 0, start);
+    }
+    pthread_mutex_unlock (&rwl->mutex);
+    return status;
+}
+
 /*
  * Unlock a read-write lock from read access.
  */
@@ -170,10 +387,11 @@ int rwl_readunlock (rwlock_t *rwl)
 
     if (rwl->valid != RWLOCK_VALID)
         return EINVAL;
-    status = pthread_mutex_lock (&rwl->mutex);
+    status = RWL_LOCK (rwl);
     if (status != 0)
         return status;
     rwl->r_active--;
+    PROF_RELEASE (rwl, 0);
     if (rwl->r_active == 0 && rwl->w_wait > 0)
         status = pthread_cond_signal (&rwl->write);
     status2 = pthread_mutex_unlock (&rwl->mutex);
@@ -201,13 +419,15 @@ static void rwl_writecleanup (void *arg)
 int rwl_writelock (rwlock_t *rwl)
 {
     int status;
+    PROF_DECL (start);
 
     if (rwl->valid != RWLOCK_VALID)
         return EINVAL;
-    status = pthread_mutex_lock (&rwl->mutex);
+    status = RWL_LOCK (rwl);
     if (status != 0)
         return status;
     if (rwl->w_active || rwl->r_active > 0) {
+        PROF_START (start);
         rwl->w_wait++;
         pthread_cleanup_push (rwl_writecleanup, (void*)rwl);
         while (rwl->w_active || rwl->r_active > 0) {
@@ -218,8 +438,56 @@ int rwl_writelock (rwlock_t *rwl)
         pthread_cleanup_pop (0);
         rwl->w_wait--;
     }
-    if (status == 0)
+    if (status == 0) {
+        rwl->w_active = 1;
+        PROF_ACQUIRE (rwl, 1, start);
+    }
+    pthread_mutex_unlock (&rwl->mutex);
+    return status;
+}
+
+/*
+ * Lock a read-write lock for write access, waiting no later than
+ * the absolute CLOCK_MONOTONIC time "abstime".
+ *
+ * Writers are awakened one at a time by pthread_cond_signal, so
+ * a writer that times out may have absorbed the signal meant to
+ * hand a free lock to another writer. If the lock is free when we
+ * time out, take it anyway: our own rwl_writeunlock will then pass
+ * the wakeup on. If it is still held, the holder's unlock will
+ * wake the remaining waiters. Readers wait only for an active
+ * writer, never for a waiting one, so a writer that gives up
+ * can't leave them blocked.
+ */
+int rwl_timedwritelock (rwlock_t *rwl, const struct timespec *abstime)
+{
+    int status;
+    PROF_DECL (start);
+
+    if (rwl->valid != RWLOCK_VALID)
+        return EINVAL;
+    status = RWL_LOCK (rwl);
+    if (status != 0)
+        return status;
+    if (rwl->w_active || rwl->r_active > 0) {
+        PROF_START (start);
+        rwl->w_wait++;
+        pthread_cleanup_push (rwl_writecleanup, (void*)rwl);
+        while (rwl->w_active || rwl->r_active > 0) {
+            status = pthread_cond_clockwait (
+                &rwl->write, &rwl->mutex, CLOCK_MONOTONIC, abstime);
+            if (status != 0)
+                break;
+        }
+        pthread_cleanup_pop (0);
+        rwl->w_wait--;
+        if (status == ETIMEDOUT && !rwl->w_active && rwl->r_active == 0)
+            status = 0;
+    }
+    if (status == 0) {
         rwl->w_active = 1;
+        PROF_ACQUIRE (rwl, 1, start);
+    }
     pthread_mutex_unlock (&rwl->mutex);
     return status;
 }
@@ -234,13 +502,15 @@ int rwl_writetrylock (rwlock_t *rwl)
 
     if (rwl->valid != RWLOCK_VALID)
         return EINVAL;
-    status = pthread_mutex_lock (&rwl->mutex);
+    status = RWL_LOCK (rwl);
     if (status != 0)
         return status;
     if (rwl->w_active || rwl->r_active > 0)
         status = EBUSY;
-    else
+    else {
         rwl->w_active = 1;
+        PROF_ACQUIRE (rwl, 1, 0);
+    }
     status2 = pthread_mutex_unlock (&rwl->mutex);
     return (status != 0 ? status : status2);
 }
@@ -254,9 +524,10 @@ int rwl_writeunlock (rwlock_t *rwl)
 
     if (rwl->valid != RWLOCK_VALID)
         return EINVAL;
-    status = pthread_mutex_lock (&rwl->mutex);
+    status = RWL_LOCK (rwl);
     if (status != 0)
         return status;
+    PROF_RELEASE (rwl, 1);
     rwl->w_active = 0;
     if (rwl->r_wait > 0) {
         status = pthread_cond_broadcast (&rwl->read);
@@ -274,3 +545,107 @@ int rwl_writeunlock (rwlock_t *rwl)
     status = pthread_mutex_unlock (&rwl->mutex);
     return status;
 }
+
+#ifdef RWL_PROFILE
+/*
+ * Snapshot of one lock's statistics, for sorting.
+ */
+typedef struct rwl_report_tag {
+    rwlock_t            *lock;
+    rwl_stats_t         stats;
+} rwl_report_t;
+
+static int rwl_report_compare (const void *a, const void *b)
+{
+    const rwl_stats_t *sa = &((const rwl_report_t*)a)->stats;
+    const rwl_stats_t *sb = &((const rwl_report_t*)b)->stats;
+    unsigned long ca = sa->r_contended + sa->w_contended;
+    unsigned long cb = sb->r_contended + sb->w_contended;
+
+    return (ca < cb) - (ca > cb);
+}
+
+/*
+ * Return the upper bound (in nanoseconds) of the histogram bucket
+ * containing the given fraction of all samples.
+ */
+static unsigned long long rwl_hist_percentile (
+    const unsigned long *hist, double fraction)
+{
+    unsigned long total = 0, seen = 0;
+    int bucket;
+
+    for (bucket = 0; bucket < RWL_HIST_BUCKETS; bucket++)
+        total += hist[bucket];
+    if (total == 0)
+        return 0;
+    for (bucket = 0; bucket < RWL_HIST_BUCKETS; bucket++) {
+        seen += hist[bucket];
+        if (seen >= fraction * total)
+            break;
+    }
+    return bucket == 0 ? 0 : (1ULL << bucket) - 1;
+}
+#endif
+
+/*
+ * Print the statistics of the "top_n" most contended locks (all
+ * of them, if top_n <= 0). Returns ENOSYS unless compiled with
+ * RWL_PROFILE.
+ */
+int rwl_stats_dump (FILE *out, int top_n)
+{
+#ifdef RWL_PROFILE
+    rwl_report_t *report;
+    rwl_stats_t *stats;
+    rwlock_t *rwl;
+    unsigned long acquired, contended;
+    int count = 0, index, status;
+
+    status = pthread_mutex_lock (&prof_mutex);
+    if (status != 0)
+        return status;
+    for (rwl = prof_list; rwl != NULL; rwl = rwl->stats.next)
+        count++;
+    report = (rwl_report_t*)malloc ((count + 1) * sizeof (rwl_report_t));
+    if (report == NULL) {
+        pthread_mutex_unlock (&prof_mutex);
+        return ENOMEM;
+    }
+    for (rwl = prof_list, index = 0; rwl != NULL; rwl = rwl->stats.next) {
+        report[index].lock = rwl;
+        pthread_mutex_lock (&rwl->mutex);
+        report[index++].stats = rwl->stats;
+        pthread_mutex_unlock (&rwl->mutex);
+    }
+    pthread_mutex_unlock (&prof_mutex);
+
+    qsort (report, count, sizeof (rwl_report_t), rwl_report_compare);
+    if (top_n <= 0 || top_n > count)
+        top_n = count;
+    fprintf (out, "%-20s %10s %10s %6s %8s %5s %9s %9s %9s %9s\n",
+        "lock", "acquired", "contended", "%", "mutex", "maxrd",
+        "wait50ns", "wait99ns", "hold50ns", "hold99ns");
+    for (index = 0; index < top_n; index++) {
+        stats = &report[index].stats;
+        acquired = stats->r_acquired + stats->w_acquired;
+        contended = stats->r_contended + stats->w_contended;
+        if (stats->name != NULL)
+            fprintf (out, "%-20s ", stats->name);
+        else
+            fprintf (out, "%-20p ", (void*)report[index].lock);
+        fprintf (out, "%10lu %10lu %6.2f %8lu %5d %9llu %9llu %9llu %9llu\n",
+            acquired, contended,
+            acquired == 0 ? 0.0 : 100.0 * contended / acquired,
+            stats->m_contended, stats->max_readers,
+            rwl_hist_percentile (stats->wait_hist, 0.5),
+            rwl_hist_percentile (stats->wait_hist, 0.99),
+            rwl_hist_percentile (stats->hold_hist, 0.5),
+            rwl_hist_percentile (stats->hold_hist, 0.99));
+    }
+    free (report);
+    return 0;
+#else
+    return ENOSYS;
+#endif
+}
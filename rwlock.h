@@ -10,9 +10,79 @@
  *
  * The rwl_init() and rwl_destroy() functions, respectively, allow you to
  * initialize/create and destroy/free the reader/writer lock.
+ *
+ * The rwl_timedreadlock() and rwl_timedwritelock() functions take
+ * an absolute deadline measured against CLOCK_MONOTONIC.
+ *
+ * When compiled with -DRWL_PROFILE, each lock also keeps contention
+ * statistics, and rwl_stats_dump() reports the most contended locks
+ * in the process. Without RWL_PROFILE, none of that code or data is
+ * compiled in.
+ *
+ * When compiled with -DRWL_FUTEX, rwlock_t is instead the Linux
+ * native implementation in rwlock_futex.c: a single 32-bit state
+ * word on which threads wait using futexes directly. The
+ * interface, cancellation behavior, and reader preference are
+ * the same. (RWL_PROFILE is not supported with RWL_FUTEX.)
  */
+#ifndef __rwlock_h
+#define __rwlock_h
 #include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifdef RWL_PROFILE
+/*
+ * Histograms have one bucket per power of two nanoseconds; bucket
+ * "n" counts times from 2^(n-1) up to 2^n - 1 ns.
+ */
+#define RWL_HIST_BUCKETS        40
+
+/*
+ * Profiling state for a read-write lock. All fields other than
+ * "next" and "registered" are protected by the lock's mutex.
+ */
+typedef struct rwl_stats_tag {
+    const char          *name;          /* optional name */
+    struct rwlock_tag   *next;          /* list of profiled locks */
+    int                 registered;     /* on the list */
+    int                 max_readers;    /* most concurrent readers */
+    unsigned long       r_acquired;     /* read acquisitions */
+    unsigned long       w_acquired;     /* write acquisitions */
+    unsigned long       r_contended;    /* reads that had to wait */
+    unsigned long       w_contended;    /* writes that had to wait */
+    unsigned long       m_contended;    /* internal mutex collisions */
+    unsigned long long  r_start;        /* start of read-held period */
+    unsigned long long  w_start;        /* start of write hold */
+    unsigned long       wait_hist[RWL_HIST_BUCKETS];
+    unsigned long       hold_hist[RWL_HIST_BUCKETS];
+} rwl_stats_t;
+#endif
+
+#ifdef RWL_FUTEX
+# ifdef RWL_PROFILE
+#  error "RWL_PROFILE is not supported by the futex read-write lock"
+# endif
+
+/*
+ * Structure describing a futex-based read-write lock. The state
+ * word holds the count of active readers, plus RWL_WRITER while a
+ * writer holds the lock. The waiter counts are advisory: they only
+ * tell an unlocking thread whether it needs to make a wake call.
+ */
+typedef struct rwlock_tag {
+    unsigned int        state;          /* futex word */
+    int                 valid;          /* set when valid */
+    int                 r_wait;         /* readers waiting */
+    int                 w_wait;         /* writers waiting */
+} rwlock_t;
+
+#define RWL_WRITER      0x80000000U     /* writer active */
+#define RWLOCK_VALID    0xfacade
+
+#define RWL_INITIALIZER {0, RWLOCK_VALID, 0, 0}
 
+#else
 /*
  * Structure describing a read-write lock.
  */
@@ -25,25 +95,60 @@ typedef struct rwlock_tag {
     int                 w_active;       /* writer active */
     int                 r_wait;         /* readers waiting */
     int                 w_wait;         /* writers waiting */
+#ifdef RWL_PROFILE
+    rwl_stats_t         stats;          /* contention profile */
+#endif
 } rwlock_t;
 
 #define RWLOCK_VALID    0xfacade
 
 /*
- * Support static initialization of barriers
+ * Support static initialization of read-write locks. (Profiled
+ * locks initialized this way are unnamed, and join the list of
+ * profiled locks when first used.)
  */
 #define RWL_INITIALIZER \
     {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, \
     PTHREAD_COND_INITIALIZER, RWLOCK_VALID, 0, 0, 0, 0}
+#endif
+
+/*
+ * A read-write lock that has its cache line(s) to itself, for
+ * arrays of locks that are used by different threads. Without
+ * padding, a thread that takes one lock invalidates the line
+ * holding its neighbors too ("false sharing").
+ */
+#define RWL_CACHELINE   64
+#define RWL_PADDED_SIZE(size) \
+    (((size) + RWL_CACHELINE - 1) & ~(size_t)(RWL_CACHELINE - 1))
+
+typedef union rwlock_padded_tag {
+    rwlock_t            lock;
+    char                pad[RWL_PADDED_SIZE (sizeof (rwlock_t))];
+} __attribute__ ((aligned (RWL_CACHELINE))) rwlock_padded_t;
 
 /*
  * Define read-write lock functions
  */
 extern int rwl_init (rwlock_t *rwlock);
+extern int rwl_init_named (rwlock_t *rwlock, const char *name);
 extern int rwl_destroy (rwlock_t *rwlock);
 extern int rwl_readlock (rwlock_t *rwlock);
 extern int rwl_readtrylock (rwlock_t *rwlock);
+extern int rwl_timedreadlock (
+    rwlock_t *rwlock, const struct timespec *abstime);
 extern int rwl_readunlock (rwlock_t *rwlock);
 extern int rwl_writelock (rwlock_t *rwlock);
 extern int rwl_writetrylock (rwlock_t *rwlock);
+extern int rwl_timedwritelock (
+    rwlock_t *rwlock, const struct timespec *abstime);
 extern int rwl_writeunlock (rwlock_t *rwlock);
+extern int rwl_stats_dump (FILE *out, int top_n);
+
+/*
+ * Define padded lock array functions (rwlock_pad.c)
+ */
+extern void *rwl_array_alloc (size_t count, size_t size, size_t *stride);
+extern int rwl_array_init (rwlock_padded_t **array, int count);
+extern int rwl_array_destroy (rwlock_padded_t *array, int count);
+#endif
@@ -0,0 +1,339 @@
+/*
+ * rwlock_futex.c
+ *
+ * This file implements the "read-write lock" synchronization
+ * construct directly on Linux futexes, as an alternative to the
+ * mutex and condition variable implementation in rwlock.c. Compile
+ * users of rwlock.h with -DRWL_FUTEX to select it.
+ *
+ * The whole lock state lives in one 32-bit word: the number of
+ * active readers, plus the RWL_WRITER bit. An uncontended lock or
+ * unlock is a single atomic operation on that word, and makes no
+ * system call at all. Threads that must wait sleep on the state
+ * word with FUTEX_WAIT_BITSET, readers and writers using different
+ * bits, so that an unlock can wake all readers or a single writer
+ * without disturbing the other class.
+ *
+ * The policy is the same as rwl_readlock() and friends in
+ * rwlock.c: readers are admitted whenever no writer is active, and
+ * a writer releasing the lock wakes waiting readers in preference
+ * to waiting writers.
+ *
+ * The r_wait and w_wait counts tell an unlocking thread whether
+ * anyone could be asleep. A waiter increments its count before
+ * sampling the state word, and an unlocker changes the state word
+ * before reading the counts (both sequentially consistent), so
+ * either the unlocker sees the waiter and wakes it, or the waiter
+ * sees the new state and doesn't sleep (FUTEX_WAIT refuses to
+ * sleep if the word no longer holds the sampled value).
+ *
+ * Like pthread_cond_wait, the blocking lock calls are cancellation
+ * points. Cancellation is enabled asynchronously only around the
+ * futex system call itself, while the thread has no lock state to
+ * undo except its waiter count, which the cleanup handlers remove.
+ */
+#include <pthread.h>
+#include <limits.h>
+#include "errors.h"
+#include "futex.h"
+#include "rwlock.h"
+
+#define READER_BITS     0x1             /* futex bitset for readers */
+#define WRITER_BITS     0x2             /* futex bitset for writers */
+#define READER_MASK     (~RWL_WRITER)
+
+/*
+ * Sleep on the state word while it still holds "val", as a
+ * cancellation point.
+ */
+static int rwl_futex_wait (
+    rwlock_t *rwl, unsigned int val,
+    const struct timespec *abstime, unsigned int bits)
+{
+    int oldtype, status;
+
+    pthread_setcanceltype (PTHREAD_CANCEL_ASYNCHRONOUS, &oldtype);
+    status = futex_wait_bitset (&rwl->state, val, abstime, bits);
+    pthread_setcanceltype (oldtype, &oldtype);
+    return status;
+}
+
+/*
+ * Try once to add a reader. Returns nonzero on success.
+ */
+static int rwl_read_acquire (rwlock_t *rwl)
+{
+    unsigned int state = __atomic_load_n (&rwl->state, __ATOMIC_RELAXED);
+
+    while (!(state & RWL_WRITER)) {
+        if ((state & READER_MASK) == READER_MASK)
+            return 0;                   /* Reader count would overflow */
+        if (__atomic_compare_exchange_n (&rwl->state, &state, state + 1,
+                1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Try once to take the lock for a writer. Returns nonzero on
+ * success.
+ */
+static int rwl_write_acquire (rwlock_t *rwl)
+{
+    unsigned int state = 0;
+
+    return __atomic_compare_exchange_n (&rwl->state, &state, RWL_WRITER,
+        0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/*
+ * Initialize a read-write lock
+ */
+int rwl_init (rwlock_t *rwl)
+{
+    rwl->state = 0;
+    rwl->r_wait = rwl->w_wait = 0;
+    rwl->valid = RWLOCK_VALID;
+    return 0;
+}
+
+/*
+ * Names are used only by the profiling support in rwlock.c.
+ */
+int rwl_init_named (rwlock_t *rwl, const char *name)
+{
+    return rwl_init (rwl);
+}
+
+/*
+ * Destroy a read-write lock
+ */
+int rwl_destroy (rwlock_t *rwl)
+{
+    if (rwl->valid != RWLOCK_VALID)
+        return EINVAL;
+
+    /*
+     * Check whether any threads own the lock, or are known to be
+     * waiting; report "BUSY" if so.
+     */
+    if (__atomic_load_n (&rwl->state, __ATOMIC_SEQ_CST) != 0
+        || __atomic_load_n (&rwl->r_wait, __ATOMIC_SEQ_CST) != 0
+        || __atomic_load_n (&rwl->w_wait, __ATOMIC_SEQ_CST) != 0)
+        return EBUSY;
+
+    rwl->valid = 0;
+    return 0;
+}
+
+/*
+ * Handle cleanup when a wait for read access is cancelled.
+ *
+ * rwl_writeunlock() wakes only readers when any are waiting, so if
+ * we were the reason it didn't wake a writer, and the lock is now
+ * free, wake one.
+ */
+static void rwl_readcleanup (void *arg)
+{
+    rwlock_t    *rwl = (rwlock_t *)arg;
+
+    __atomic_sub_fetch (&rwl->r_wait, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n (&rwl->state, __ATOMIC_SEQ_CST) == 0
+        && __atomic_load_n (&rwl->w_wait, __ATOMIC_SEQ_CST) > 0)
+        futex_wake_bitset (&rwl->state, 1, WRITER_BITS);
+}
+
+/*
+ * Wait for read access (the slow path of rwl_readlock and
+ * rwl_timedreadlock).
+ */
+static int rwl_readwait (rwlock_t *rwl, const struct timespec *abstime)
+{
+    unsigned int state;
+    int status = 0;
+
+    __atomic_add_fetch (&rwl->r_wait, 1, __ATOMIC_SEQ_CST);
+    pthread_cleanup_push (rwl_readcleanup, (void*)rwl);
+    while (!rwl_read_acquire (rwl)) {
+        state = __atomic_load_n (&rwl->state, __ATOMIC_SEQ_CST);
+        if (!(state & RWL_WRITER))
+            continue;
+        status = rwl_futex_wait (rwl, state, abstime, READER_BITS);
+        if (status == ETIMEDOUT) {
+            /*
+             * If the writer released the lock just as we timed
+             * out, take the lock rather than report a spurious
+             * failure.
+             */
+            if (rwl_read_acquire (rwl))
+                status = 0;
+            break;
+        }
+        status = 0;                     /* EAGAIN, EINTR: retry */
+    }
+    pthread_cleanup_pop (0);
+    __atomic_sub_fetch (&rwl->r_wait, 1, __ATOMIC_SEQ_CST);
+    return status;
+}
+
+/*
+ * Lock a read-write lock for read access.
+ */
+int rwl_readlock (rwlock_t *rwl)
+{
+    if (rwl->valid != RWLOCK_VALID)
+        return EINVAL;
+    if (rwl_read_acquire (rwl))
+        return 0;
+    return rwl_readwait (rwl, NULL);
+}
+
+/*
+ * Attempt to lock a read-write lock for read access (don't
+ * block if unavailable).
+ */
+int rwl_readtrylock (rwlock_t *rwl)
+{
+    if (rwl->valid != RWLOCK_VALID)
+        return EINVAL;
+    return rwl_read_acquire (rwl) ? 0 : EBUSY;
+}
+
+/*
+ * Lock a read-write lock for read access, waiting no later than
+ * the absolute CLOCK_MONOTONIC time "abstime".
+ */
+int rwl_timedreadlock (rwlock_t *rwl, const struct timespec *abstime)
+{
+    if (rwl->valid != RWLOCK_VALID)
+        return EINVAL;
+    if (rwl_read_acquire (rwl))
+        return 0;
+    return rwl_readwait (rwl, abstime);
+}
+
+/*
+ * Unlock a read-write lock from read access.
+ */
+int rwl_readunlock (rwlock_t *rwl)
+{
+    unsigned int state;
+
+    if (rwl->valid != RWLOCK_VALID)
+        return EINVAL;
+    state = __atomic_sub_fetch (&rwl->state, 1, __ATOMIC_SEQ_CST);
+    if (state == 0 && __atomic_load_n (&rwl->w_wait, __ATOMIC_SEQ_CST) > 0)
+        return futex_wake_bitset (&rwl->state, 1, WRITER_BITS);
+    return 0;
+}
+
+/*
+ * Handle cleanup when a wait for write access is cancelled.
+ *
+ * Writers are awakened one at a time, so we may have absorbed a
+ * wakeup meant to hand a free lock to another writer. If so, pass
+ * it on.
+ */
+static void rwl_writecleanup (void *arg)
+{
+    rwlock_t *rwl = (rwlock_t *)arg;
+
+    if (__atomic_sub_fetch (&rwl->w_wait, 1, __ATOMIC_SEQ_CST) > 0
+        && __atomic_load_n (&rwl->state, __ATOMIC_SEQ_CST) == 0)
+        futex_wake_bitset (&rwl->state, 1, WRITER_BITS);
+}
+
+/*
+ * Wait for write access (the slow path of rwl_writelock and
+ * rwl_timedwritelock).
+ */
+static int rwl_writewait (rwlock_t *rwl, const struct timespec *abstime)
+{
+    unsigned int state;
+    int status = 0;
+
+    __atomic_add_fetch (&rwl->w_wait, 1, __ATOMIC_SEQ_CST);
+    pthread_cleanup_push (rwl_writecleanup, (void*)rwl);
+    while (!rwl_write_acquire (rwl)) {
+        state = __atomic_load_n (&rwl->state, __ATOMIC_SEQ_CST);
+        if (state == 0)
+            continue;
+        status = rwl_futex_wait (rwl, state, abstime, WRITER_BITS);
+        if (status == ETIMEDOUT) {
+            /*
+             * As in rwlock.c, a writer that times out while the
+             * lock is free takes it, so that its own unlock passes
+             * on any wakeup it absorbed. If the lock is held, the
+             * holder's unlock will wake the remaining waiters.
+             */
+            if (rwl_write_acquire (rwl))
+                status = 0;
+            break;
+        }
+        status = 0;                     /* EAGAIN, EINTR: retry */
+    }
+    pthread_cleanup_pop (0);
+    __atomic_sub_fetch (&rwl->w_wait, 1, __ATOMIC_SEQ_CST);
+    return status;
+}
+
+/*
+ * Lock a read-write lock for write access.
+ */
+int rwl_writelock (rwlock_t *rwl)
+{
+    if (rwl->valid != RWLOCK_VALID)
+        return EINVAL;
+    if (rwl_write_acquire (rwl))
+        return 0;
+    return rwl_writewait (rwl, NULL);
+}
+
+/*
+ * Lock a read-write lock for write access, waiting no later than
+ * the absolute CLOCK_MONOTONIC time "abstime".
+ */
+int rwl_timedwritelock (rwlock_t *rwl, const struct timespec *abstime)
+{
+    if (rwl->valid != RWLOCK_VALID)
+        return EINVAL;
+    if (rwl_write_acquire (rwl))
+        return 0;
+    return rwl_writewait (rwl, abstime);
+}
+
+/*
+ * Attempt to lock a read-write lock for write access. Don't
+ * block if unavailable.
+ */
+int rwl_writetrylock (rwlock_t *rwl)
+{
+    if (rwl->valid != RWLOCK_VALID)
+        return EINVAL;
+    return rwl_write_acquire (rwl) ? 0 : EBUSY;
+}
+
+/*
+ * Unlock a read-write lock from write access. Waiting readers are
+ * preferred; otherwise wake one waiting writer.
+ */
+int rwl_writeunlock (rwlock_t *rwl)
+{
+    if (rwl->valid != RWLOCK_VALID)
+        return EINVAL;
+    __atomic_and_fetch (&rwl->state, ~RWL_WRITER, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n (&rwl->r_wait, __ATOMIC_SEQ_CST) > 0)
+        return futex_wake_bitset (&rwl->state, FUTEX_ALL, READER_BITS);
+    if (__atomic_load_n (&rwl->w_wait, __ATOMIC_SEQ_CST) > 0)
+        return futex_wake_bitset (&rwl->state, 1, WRITER_BITS);
+    return 0;
+}
+
+/*
+ * Profiling is available only in rwlock.c.
+ */
+int rwl_stats_dump (FILE *out, int top_n)
+{
+    return ENOSYS;
+}
@@ -1,19 +1,48 @@
 /*
  * rwlock_main.c
  *
- * Demonstrate use of read-write locks as implemented by
- * rwlock.c
+ * Demonstrate and benchmark the read-write locks implemented by
+ * rwlock.c (or rwlock_futex.c).
+ *
+ * Each thread repeatedly picks a data element, and either reads
+ * it under a read lock or updates it under a write lock. The
+ * thread count, number of elements, read/write mix, critical
+ * section length, key distribution, and run length are all set
+ * from the command line (see bench.c); the defaults match the
+ * original demonstration. The report gives throughput, latency
+ * percentiles of the lock operations, and how evenly the threads
+ * shared the work, as text, CSV, or JSON.
+ *
+ * Additional options:
+ *
+ *      -p      pad each data_t and thread_t to its own cache line(s)
+ *      -b      run twice, packed and padded, to show the effect of
+ *              false sharing; where perf_event_open() allows, cache
+ *              misses per operation are also reported
+ *
+ * When compiled with -DRWL_PROFILE, each data element's lock is
+ * named, and the contention profile is printed at the end.
  *
  * Special notes: On a Solaris system, call thr_setconcurrency()
  * to allow interleaved thread execution, since threads are not
  * timesliced.
  */
 #include "rwlock.h"
+#include "perfcount.h"
+#include "bench.h"
 #include "errors.h"
 
 #define THREADS         5
 #define DATASIZE        15
 #define ITERATIONS      10000
+#define READ_PERCENT    97
+#define BENCH_ITERATIONS 1000000
+
+#ifdef RWL_FUTEX
+# define LOCK_TYPE      "futex"
+#else
+# define LOCK_TYPE      "mutex"
+#endif
 
 /*
  * Keep statistics for each thread.
@@ -23,7 +52,8 @@ typedef struct thread_tag {
     pthread_t   thread_id;
     int         updates;
     int         reads;
-    int         interval;
+    int         repeats;
+    bench_thread_t bench;
 } thread_t;
 
 /*
@@ -35,8 +65,25 @@ typedef struct data_tag {
     int         updates;
 } data_t;
 
-thread_t threads[THREADS];
-data_t data[DATASIZE];
+/*
+ * The thread_t and data_t arrays are allocated at run time, so
+ * that they can be padded out to a cache line. Index them with
+ * THREAD() and DATA().
+ */
+char *threads;
+size_t thread_stride;
+char *data;
+size_t data_stride;
+char (*names)[16];                      /* Lock names for profiling */
+bench_config_t config = {
+    .name = "rwlock_main", .threads = THREADS, .keys = DATASIZE,
+    .read_percent = READ_PERCENT, .dist = BENCH_SEQ, .theta = 0.99,
+    .ops = ITERATIONS, .format = BENCH_TEXT};
+int pad;                                /* -p */
+int compare;                            /* -b */
+
+#define THREAD(n)       ((thread_t*)(threads + (n) * thread_stride))
+#define DATA(n)         ((data_t*)(data + (n) * data_stride))
 
 /*
  * Thread start routine that uses read-write locks
@@ -44,25 +91,22 @@ data_t data[DATASIZE];
 void *thread_routine (void *arg)
 {
     thread_t *self = (thread_t*)arg;
-    int repeats = 0;
-    int iteration;
-    int element = 0;
+    unsigned long long start;
+    unsigned long element;
     int status;
 
-    for (iteration = 0; iteration < ITERATIONS; iteration++) {
-        /*
-         * Each "self->interval" iterations, perform an
-         * update operation (write lock instead of read
-         * lock).
-         */
-        if ((iteration % self->interval) == 0) {
-            status = rwl_writelock (&data[element].lock);
+    while (!bench_done (&config, &self->bench)) {
+        element = bench_key (&config, &self->bench);
+        start = bench_now ();
+        if (!bench_is_read (&config, &self->bench)) {
+            status = rwl_writelock (&DATA (element)->lock);
             if (status != 0)
                 err_abort (status, "Write lock");
-            data[element].data = self->thread_num;
-            data[element].updates++;
+            DATA (element)->data = self->thread_num;
+            DATA (element)->updates++;
+            bench_critical (&config);
             self->updates++;
-            status = rwl_writeunlock (&data[element].lock);
+            status = rwl_writeunlock (&DATA (element)->lock);
             if (status != 0)
                 err_abort (status, "Write unlock");
         } else {
@@ -71,97 +115,206 @@ void *thread_routine (void *arg)
              * the current thread last updated it. Count the
              * times, to report later.
              */
-            status = rwl_readlock (&data[element].lock);
+            status = rwl_readlock (&DATA (element)->lock);
             if (status != 0)
                 err_abort (status, "Read lock");
             self->reads++;
-            if (data[element].data == self->thread_num)
-                repeats++;
-            status = rwl_readunlock (&data[element].lock);
+            if (DATA (element)->data == self->thread_num)
+                self->repeats++;
+            bench_critical (&config);
+            status = rwl_readunlock (&DATA (element)->lock);
             if (status != 0)
                 err_abort (status, "Read unlock");
         }
-        element++;
-        if (element >= DATASIZE)
-            element = 0;
+        bench_record (&self->bench, bench_now () - start);
     }
-
-    if (repeats > 0)
-        printf (
-            "Thread %d found unchanged elements %d times\n",
-            self->thread_num, repeats);
     return NULL;
 }
 
-int main (int argc, char *argv[])
+/*
+ * Allocate and initialize the thread and data arrays, padded or
+ * packed.
+ */
+static void setup (int pad)
 {
-    int count;
-    int data_count;
+    unsigned long count;
     int status;
-    unsigned int seed = 1;
-    int thread_updates = 0;
-    int data_updates = 0;
-
-#ifdef sun
-    /*
-     * On Solaris 2.5, threads are not timesliced. To ensure
-     * that our threads can run concurrently, we need to
-     * increase the concurrency level to THREADS.
-     */
-    DPRINTF (("Setting concurrency level to %d\n", THREADS));
-    thr_setconcurrency (THREADS);
-#endif
 
-    /*
-     * Initialize the shared data.
-     */
-    for (data_count = 0; data_count < DATASIZE; data_count++) {
-        data[data_count].data = 0;
-        data[data_count].updates = 0;
-        status = rwl_init (&data[data_count].lock);
+    if (pad) {
+        threads = (char*)rwl_array_alloc (
+            config.threads, sizeof (thread_t), &thread_stride);
+        data = (char*)rwl_array_alloc (
+            config.keys, sizeof (data_t), &data_stride);
+    } else {
+        thread_stride = sizeof (thread_t);
+        threads = (char*)calloc (config.threads, thread_stride);
+        data_stride = sizeof (data_t);
+        data = (char*)calloc (config.keys, data_stride);
+    }
+    names = calloc (config.keys, sizeof (*names));
+    if (threads == NULL || data == NULL || names == NULL)
+        errno_abort ("Allocate arrays");
+    for (count = 0; count < config.keys; count++) {
+        sprintf (names[count], "data[%02lu]", count);
+        status = rwl_init_named (&DATA (count)->lock, names[count]);
         if (status != 0)
             err_abort (status, "Init rw lock");
     }
+}
 
-    /*
-     * Create THREADS threads to access shared data.
-     */
-    for (count = 0; count < THREADS; count++) {
-        threads[count].thread_num = count;
-        threads[count].updates = 0;
-        threads[count].reads = 0;
-        threads[count].interval = rand_r (&seed) % 71;
-        status = pthread_create (&threads[count].thread_id,
-            NULL, thread_routine, (void*)&threads[count]);
+/*
+ * Create the threads to access shared data, and wait for them
+ * all to complete.
+ */
+static void run (void)
+{
+    int count, status;
+
+    bench_start (&config);
+    for (count = 0; count < config.threads; count++) {
+        THREAD (count)->thread_num = count;
+        bench_thread_init (&config, &THREAD (count)->bench, count);
+        status = pthread_create (&THREAD (count)->thread_id,
+            NULL, thread_routine, (void*)THREAD (count));
         if (status != 0)
             err_abort (status, "Create thread");
     }
-
-    /*
-     * Wait for all threads to complete, and collect
-     * statistics.
-     */
-    for (count = 0; count < THREADS; count++) {
-        status = pthread_join (threads[count].thread_id, NULL);
+    bench_wait (&config);
+    for (count = 0; count < config.threads; count++) {
+        status = pthread_join (THREAD (count)->thread_id, NULL);
         if (status != 0)
             err_abort (status, "Join thread");
-        thread_updates += threads[count].updates;
-        printf ("%02d: interval %d, updates %d, reads %d\n",
-            count, threads[count].interval,
-            threads[count].updates, threads[count].reads);
+    }
+}
+
+/*
+ * Total the thread statistics, check them against the data, and
+ * print the report.
+ */
+static void report (int pad, perfcount_t *counter)
+{
+    static const char *events[] = {"cache_misses_per_op", "l1d_misses_per_op"};
+    bench_result_t result;
+    unsigned long long misses;
+    unsigned long count;
+    long thread_updates = 0, data_updates = 0, repeats = 0;
+    char label[32];
+    int event, status;
+
+    status = bench_result_init (&result, config.threads);
+    if (status != 0)
+        err_abort (status, "Init result");
+    for (count = 0; count < config.threads; count++) {
+        bench_result_add (&result, count, &THREAD (count)->bench);
+        thread_updates += THREAD (count)->updates;
+        repeats += THREAD (count)->repeats;
+    }
+    for (count = 0; count < config.keys; count++)
+        data_updates += DATA (count)->updates;
+    if (thread_updates != data_updates) {
+        fprintf (stderr, "%ld thread updates, %ld data updates\n",
+            thread_updates, data_updates);
+        abort ();
+    }
+    bench_result_extra (&result, "updates", thread_updates);
+    bench_result_extra (&result, "unchanged_reads", repeats);
+    if (counter != NULL) {
+        for (event = 0; event < 2; event++) {
+            if (perfcount_read (&counter[event], &misses) == 0
+                && result.total > 0)
+                bench_result_extra (&result, events[event],
+                    (double)misses / result.total);
+            else
+                bench_result_extra (&result, events[event], -1);
+        }
+    }
+    sprintf (label, "%s/%s", LOCK_TYPE, pad ? "padded" : "packed");
+    bench_report (&config, &result, label);
+    bench_result_free (&result);
+}
+
+/*
+ * Destroy the locks and free the arrays.
+ */
+static void cleanup (void)
+{
+    unsigned long count;
+
+    for (count = 0; count < config.keys; count++)
+        rwl_destroy (&DATA (count)->lock);
+    free (threads);
+    free (data);
+    free (names);
+}
+
+static int option (int opt, char *arg)
+{
+    switch (opt) {
+    case 'p':
+        pad = 1;
+        return 0;
+    case 'b':
+        /*
+         * The comparison needs a longer run to be meaningful,
+         * unless -n or -s (before or after -b) says otherwise.
+         */
+        compare = 1;
+        if (!config.length_set)
+            config.ops = BENCH_ITERATIONS;
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+int main (int argc, char *argv[])
+{
+    perfcount_t counter[2];
+    int event;
+
+    if (bench_parse (&config, argc, argv, "pb", option) != 0) {
+        bench_usage (&config, "[-p] [-b]");
+        return -1;
     }
 
+#ifdef sun
     /*
-     * Collect statistics for the data.
+     * On Solaris 2.5, threads are not timesliced. To ensure
+     * that our threads can run concurrently, we need to
+     * increase the concurrency level to the number of threads.
      */
-    for (data_count = 0; data_count < DATASIZE; data_count++) {
-        data_updates += data[data_count].updates;
-        printf ("data %02d: value %d, %d updates\n",
-            data_count, data[data_count].data, data[data_count].updates);
-        rwl_destroy (&data[data_count].lock);
+    DPRINTF (("Setting concurrency level to %d\n", config.threads));
+    thr_setconcurrency (config.threads);
+#endif
+
+    if (compare) {
+        /*
+         * Time the test with packed and padded arrays.
+         */
+        for (pad = 0; pad <= 1; pad++) {
+            setup (pad);
+            perfcount_open (&counter[0], PERFCOUNT_CACHE_MISSES);
+            perfcount_open (&counter[1], PERFCOUNT_L1D_MISSES);
+            run ();
+            report (pad, counter);
+            for (event = 0; event < 2; event++)
+                perfcount_close (&counter[event]);
+            cleanup ();
+        }
+        return 0;
     }
 
-    printf ("%d thread updates, %d data updates\n",
-        thread_updates, data_updates);
+    /*
+     * Initialize the shared data, and run the threads.
+     */
+    setup (pad);
+    run ();
+    report (pad, NULL);
+
+#ifdef RWL_PROFILE
+    rwl_stats_dump (stdout, 5);
+#endif
+
+    cleanup ();
     return 0;
 }
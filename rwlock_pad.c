@@ -0,0 +1,81 @@
+/*
+ * rwlock_pad.c
+ *
+ * This file implements helpers for arrays of read-write locks
+ * (or of structures holding them) that keep each element in its
+ * own cache line(s). It works with either read-write lock
+ * implementation.
+ *
+ * rwl_array_alloc() allocates zeroed, cache-line aligned storage
+ * for "count" elements of "size" bytes each, rounding the element
+ * size up to a multiple of the cache line. The rounded size is
+ * returned through "stride"; index the array as
+ * (char*)array + index * stride, and release it with free().
+ *
+ * rwl_array_init() allocates and initializes an array of padded
+ * locks, and rwl_array_destroy() destroys and frees it.
+ */
+#include <pthread.h>
+#include "errors.h"
+#include "rwlock.h"
+
+/*
+ * Allocate a cache-line aligned, padded array.
+ */
+void *rwl_array_alloc (size_t count, size_t size, size_t *stride)
+{
+    void *array;
+    size_t padded = RWL_PADDED_SIZE (size);
+
+    if (posix_memalign (&array, RWL_CACHELINE, count * padded) != 0)
+        return NULL;
+    memset (array, 0, count * padded);
+    if (stride != NULL)
+        *stride = padded;
+    return array;
+}
+
+/*
+ * Allocate and initialize an array of padded locks.
+ */
+int rwl_array_init (rwlock_padded_t **array, int count)
+{
+    rwlock_padded_t *locks;
+    int index, status;
+
+    locks = (rwlock_padded_t*)rwl_array_alloc (
+        count, sizeof (rwlock_padded_t), NULL);
+    if (locks == NULL)
+        return ENOMEM;
+    for (index = 0; index < count; index++) {
+        status = rwl_init (&locks[index].lock);
+        if (status != 0) {
+            while (--index >= 0)
+                rwl_destroy (&locks[index].lock);
+            free (locks);
+            return status;
+        }
+    }
+    *array = locks;
+    return 0;
+}
+
+/*
+ * Destroy and free an array of padded locks. If any lock is busy,
+ * nothing is freed, and EBUSY is returned.
+ */
+int rwl_array_destroy (rwlock_padded_t *array, int count)
+{
+    int index, status;
+
+    for (index = 0; index < count; index++) {
+        status = rwl_destroy (&array[index].lock);
+        if (status != 0) {
+            while (--index >= 0)
+                rwl_init (&array[index].lock);
+            return status;
+        }
+    }
+    free (array);
+    return 0;
+}
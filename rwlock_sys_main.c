@@ -0,0 +1,164 @@
+/*
+ * rwlock_sys_main.c
+ *
+ * Measure the system calls and context switches that a contended
+ * read-write lock costs per operation. Built twice: "rwlock_sys"
+ * uses the mutex and condition variable implementation in
+ * rwlock.c, and "rwlock_sys_futex" (compiled with -DRWL_FUTEX)
+ * uses the futex implementation in rwlock_futex.c.
+ *
+ * All threads hammer a single lock, so that nearly every handoff
+ * is contended. System calls are counted with the
+ * raw_syscalls:sys_enter tracepoint when tracefs and
+ * perf_event_paranoid allow it; context switches are counted with
+ * a software perf counter, or getrusage() as a last resort.
+ *
+ * Usage: rwlock_sys [threads [iterations [write_interval]]]
+ */
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "rwlock.h"
+#include "perfcount.h"
+#include "errors.h"
+
+#define THREADS         4
+#define ITERATIONS      100000
+#define INTERVAL        10              /* one write in INTERVAL ops */
+
+/*
+ * Keep statistics for each thread.
+ */
+typedef struct thread_tag {
+    pthread_t   thread_id;
+    int         thread_num;
+    long        reads;
+    long        updates;
+} thread_t;
+
+rwlock_t lock = RWL_INITIALIZER;
+long shared_data;
+int iterations = ITERATIONS;
+int interval = INTERVAL;
+
+/*
+ * Thread start routine that uses the lock.
+ */
+void *thread_routine (void *arg)
+{
+    thread_t *self = (thread_t*)arg;
+    long value;
+    int iteration, status;
+
+    for (iteration = 0; iteration < iterations; iteration++) {
+        if ((iteration + self->thread_num) % interval == 0) {
+            status = rwl_writelock (&lock);
+            if (status != 0)
+                err_abort (status, "Write lock");
+            shared_data++;
+            self->updates++;
+            status = rwl_writeunlock (&lock);
+            if (status != 0)
+                err_abort (status, "Write unlock");
+        } else {
+            status = rwl_readlock (&lock);
+            if (status != 0)
+                err_abort (status, "Read lock");
+            value = shared_data;
+            self->reads++;
+            status = rwl_readunlock (&lock);
+            if (status != 0)
+                err_abort (status, "Read unlock");
+        }
+    }
+    (void)value;
+    return NULL;
+}
+
+int main (int argc, char *argv[])
+{
+    thread_t *threads;
+    perfcount_t syscalls, cswitches;
+    struct timespec start, end;
+    struct rusage usage;
+    unsigned long long nsys = 0, ncsw = 0;
+    long ops, updates = 0;
+    double elapsed;
+    int thread_count = THREADS, count, status;
+
+    if (argc > 1)
+        thread_count = atoi (argv[1]);
+    if (argc > 2)
+        iterations = atoi (argv[2]);
+    if (argc > 3)
+        interval = atoi (argv[3]);
+    if (thread_count < 1 || iterations < 1 || interval < 1) {
+        fprintf (stderr,
+            "Usage: %s [threads [iterations [write_interval]]]\n",
+            argv[0]);
+        return -1;
+    }
+
+    threads = (thread_t*)calloc (thread_count, sizeof (thread_t));
+    if (threads == NULL)
+        errno_abort ("Allocate threads");
+    perfcount_open (&syscalls, PERFCOUNT_SYSCALLS);
+    perfcount_open (&cswitches, PERFCOUNT_CSWITCHES);
+
+    /*
+     * Don't count the system calls made to create the threads.
+     * The counters are reset after they've all started; anything
+     * they do before that is counted, which is a small error
+     * compared to the lock traffic.
+     */
+    for (count = 0; count < thread_count; count++) {
+        threads[count].thread_num = count;
+        status = pthread_create (&threads[count].thread_id,
+            NULL, thread_routine, (void*)&threads[count]);
+        if (status != 0)
+            err_abort (status, "Create thread");
+    }
+    perfcount_reset (&syscalls);
+    perfcount_reset (&cswitches);
+    clock_gettime (CLOCK_MONOTONIC, &start);
+
+    for (count = 0; count < thread_count; count++) {
+        status = pthread_join (threads[count].thread_id, NULL);
+        if (status != 0)
+            err_abort (status, "Join thread");
+        updates += threads[count].updates;
+    }
+    clock_gettime (CLOCK_MONOTONIC, &end);
+    elapsed = (end.tv_sec - start.tv_sec)
+        + (end.tv_nsec - start.tv_nsec) / 1e9;
+    ops = (long)thread_count * iterations;
+
+#ifdef RWL_FUTEX
+    printf ("futex rwlock: ");
+#else
+    printf ("mutex/cond rwlock: ");
+#endif
+    printf ("%d threads, %ld ops (%ld updates) in %.3f s, %.0f ns/op\n",
+        thread_count, ops, updates, elapsed, elapsed * 1e9 / ops);
+    if (updates != shared_data)
+        printf ("error: %ld updates, data %ld\n", updates, shared_data);
+
+    if (perfcount_read (&syscalls, &nsys) == 0)
+        printf ("  syscalls: %llu (%.4f/op)\n", nsys, (double)nsys / ops);
+    else
+        printf ("  syscalls: unavailable (needs tracefs access)\n");
+    if (perfcount_read (&cswitches, &ncsw) != 0) {
+        getrusage (RUSAGE_SELF, &usage);
+        ncsw = usage.ru_nvcsw + usage.ru_nivcsw;
+    }
+    printf ("  context switches: %llu (%.4f/op)\n",
+        ncsw, (double)ncsw / ops);
+
+    perfcount_close (&syscalls);
+    perfcount_close (&cswitches);
+    status = rwl_destroy (&lock);
+    if (status != 0)
+        err_abort (status, "Destroy lock");
+    free (threads);
+    return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * rwlock_timed_main.c
+ *
+ * Demonstrate use of timed read-write locks. Each thread holds
+ * its write locks for a while, so that readers (and other
+ * writers) sometimes give up rather than wait indefinitely.
+ *
+ * Special notes: On a Solaris system, call thr_setconcurrency()
+ * to allow interleaved thread execution, since threads are not
+ * timesliced.
+ */
+#include <pthread.h>
+#include <time.h>
+#include "rwlock.h"
+#include "errors.h"
+
+#define THREADS         5
+#define ITERATIONS      1000
+#define DATASIZE        15
+#define TIMEOUT_NSEC    100000          /* 100 microseconds */
+#define HOLD_NSEC       200000          /* 200 microseconds */
+
+/*
+ * Keep statistics for each thread.
+ */
+typedef struct thread_tag {
+    int         thread_num;
+    pthread_t   thread_id;
+    int         r_timeouts;
+    int         w_timeouts;
+    int         updates;
+    int         interval;
+} thread_t;
+
+/*
+ * Read-write lock and shared data
+ */
+typedef struct data_tag {
+    rwlock_t    lock;
+    int         data;
+    int         updates;
+} data_t;
+
+thread_t threads[THREADS];
+data_t data[DATASIZE];
+
+/*
+ * Compute an absolute CLOCK_MONOTONIC deadline "nsec" nanoseconds
+ * from now.
+ */
+static void deadline (struct timespec *abstime, long nsec)
+{
+    clock_gettime (CLOCK_MONOTONIC, abstime);
+    abstime->tv_nsec += nsec;
+    if (abstime->tv_nsec >= 1000000000) {
+        abstime->tv_sec++;
+        abstime->tv_nsec -= 1000000000;
+    }
+}
+
+/*
+ * Thread start routine that uses timed read-write locks
+ */
+void *thread_routine (void *arg)
+{
+    thread_t *self = (thread_t*)arg;
+    struct timespec abstime, hold;
+    int iteration;
+    int element;
+    int status;
+
+    element = 0;                        /* Current data element */
+    hold.tv_sec = 0;
+    hold.tv_nsec = HOLD_NSEC;
+
+    for (iteration = 0; iteration < ITERATIONS; iteration++) {
+        deadline (&abstime, TIMEOUT_NSEC);
+        if ((iteration % self->interval) == 0) {
+            status = rwl_timedwritelock (&data[element].lock, &abstime);
+            if (status == ETIMEDOUT)
+                self->w_timeouts++;
+            else if (status == 0) {
+                data[element].data++;
+                data[element].updates++;
+                self->updates++;
+                nanosleep (&hold, NULL);
+                rwl_writeunlock (&data[element].lock);
+            } else
+                err_abort (status, "Timed write lock");
+        } else {
+            status = rwl_timedreadlock (&data[element].lock, &abstime);
+            if (status == ETIMEDOUT)
+                self->r_timeouts++;
+            else if (status != 0) {
+                err_abort (status, "Timed read lock");
+            } else {
+                if (data[element].data != data[element].updates)
+                    printf ("%d: data[%d] %d != %d\n",
+                        self->thread_num, element,
+                        data[element].data, data[element].updates);
+                rwl_readunlock (&data[element].lock);
+            }
+        }
+
+        element++;
+        if (element >= DATASIZE)
+            element = 0;
+    }
+    return NULL;
+}
+
+int main (int argc, char *argv[])
+{
+    int count, data_count;
+    unsigned int seed = 1;
+    int status;
+
+#ifdef sun
+    /*
+     * On Solaris 2.5, threads are not timesliced. To ensure
+     * that our threads can run concurrently, we need to
+     * increase the concurrency level to THREADS.
+     */
+    DPRINTF (("Setting concurrency level to %d\n", THREADS));
+    thr_setconcurrency (THREADS);
+#endif
+
+    /*
+     * Initialize the shared data.
+     */
+    for (data_count = 0; data_count < DATASIZE; data_count++) {
+        data[data_count].data = 0;
+        data[data_count].updates = 0;
+        status = rwl_init (&data[data_count].lock);
+        if (status != 0)
+            err_abort (status, "Init rw lock");
+    }
+
+    /*
+     * Create THREADS threads to access shared data.
+     */
+    for (count = 0; count < THREADS; count++) {
+        threads[count].thread_num = count;
+        threads[count].r_timeouts = 0;
+        threads[count].w_timeouts = 0;
+        threads[count].updates = 0;
+        threads[count].interval = rand_r (&seed) % 71 + 1;
+        status = pthread_create (&threads[count].thread_id,
+            NULL, thread_routine, (void*)&threads[count]);
+        if (status != 0)
+            err_abort (status, "Create thread");
+    }
+
+    /*
+     * Wait for all threads to complete, and collect
+     * statistics.
+     */
+    for (count = 0; count < THREADS; count++) {
+        status = pthread_join (threads[count].thread_id, NULL);
+        if (status != 0)
+            err_abort (status, "Join thread");
+        printf ("%02d: interval %d, updates %d, "
+                "r_timeouts %d, w_timeouts %d\n",
+            count, threads[count].interval,
+            threads[count].updates,
+            threads[count].r_timeouts, threads[count].w_timeouts);
+    }
+
+    /*
+     * Collect statistics for the data. Every lock must be idle
+     * (no stranded waiters) for rwl_destroy to succeed.
+     */
+    for (data_count = 0; data_count < DATASIZE; data_count++) {
+        printf ("data %02d: value %d, %d updates\n",
+            data_count, data[data_count].data, data[data_count].updates);
+        status = rwl_destroy (&data[data_count].lock);
+        if (status != 0)
+            err_abort (status, "Destroy rw lock");
+    }
+
+    return 0;
+}
@@ -3,17 +3,30 @@
  *
  * Demonstrate use of non-blocking read-write locks.
  *
+ * The run is configured from the command line like rwlock_main
+ * (see bench.c). Every attempt counts toward throughput, but only
+ * those that got the lock are timed; the read and write collisions
+ * (EBUSY) are reported separately.
+ *
  * Special notes: On a Solaris system, call thr_setconcurrency()
  * to allow interleaved thread execution, since threads are not
  * timesliced.
  */
 #include <pthread.h>
 #include "rwlock.h"
+#include "bench.h"
 #include "errors.h"
 
 #define THREADS         5
 #define ITERATIONS      1000
 #define DATASIZE        15
+#define READ_PERCENT    97
+
+#ifdef RWL_FUTEX
+# define LOCK_TYPE      "futex"
+#else
+# define LOCK_TYPE      "mutex"
+#endif
 
 /*
  * Keep statistics for each thread.
@@ -24,7 +37,7 @@ typedef struct thread_tag {
     int         r_collisions;
     int         w_collisions;
     int         updates;
-    int         interval;
+    bench_thread_t bench;
 } thread_t;
 
 /*
@@ -36,8 +49,12 @@ typedef struct data_tag {
     int         updates;
 } data_t;
 
-thread_t threads[THREADS];
-data_t data[DATASIZE];
+thread_t *threads;
+data_t *data;
+bench_config_t config = {
+    .name = "rwlock_try_main", .threads = THREADS, .keys = DATASIZE,
+    .read_percent = READ_PERCENT, .dist = BENCH_SEQ, .theta = 0.99,
+    .ops = ITERATIONS, .format = BENCH_TEXT};
 
 /*
  * Thread start routine that uses read-write locks
@@ -45,112 +62,138 @@ data_t data[DATASIZE];
 void *thread_routine (void *arg)
 {
     thread_t *self = (thread_t*)arg;
-    int iteration;
-    int element;
+    unsigned long long start;
+    unsigned long element;
     int status;
 
-    element = 0;                        /* Current data element */
-
-    for (iteration = 0; iteration < ITERATIONS; iteration++) {
-        if ((iteration % self->interval) == 0) {
+    while (!bench_done (&config, &self->bench)) {
+        element = bench_key (&config, &self->bench);
+        start = bench_now ();
+        if (!bench_is_read (&config, &self->bench)) {
             status = rwl_writetrylock (&data[element].lock);
-            if (status == EBUSY)
+            if (status == EBUSY) {
                 self->w_collisions++;
-            else if (status == 0) {
-                data[element].data++;
-                data[element].updates++;
-                self->updates++;
-                rwl_writeunlock (&data[element].lock);
-            } else
+                self->bench.ops++;
+                continue;
+            } else if (status != 0)
                 err_abort (status, "Try write lock");
+            data[element].data++;
+            data[element].updates++;
+            bench_critical (&config);
+            self->updates++;
+            rwl_writeunlock (&data[element].lock);
         } else {
             status = rwl_readtrylock (&data[element].lock);
-            if (status == EBUSY)
+            if (status == EBUSY) {
                 self->r_collisions++;
-            else if (status != 0) {
+                self->bench.ops++;
+                continue;
+            } else if (status != 0)
                 err_abort (status, "Try read lock");
-            } else {
-                if (data[element].data != data[element].updates)
-                    printf ("%d: data[%d] %d != %d\n",
-                        self->thread_num, element,
-                        data[element].data, data[element].updates);
-                rwl_readunlock (&data[element].lock);
-            }
+            if (data[element].data != data[element].updates)
+                printf ("%d: data[%lu] %d != %d\n",
+                    self->thread_num, element,
+                    data[element].data, data[element].updates);
+            bench_critical (&config);
+            rwl_readunlock (&data[element].lock);
         }
-
-        element++;
-        if (element >= DATASIZE)
-            element = 0;
+        bench_record (&self->bench, bench_now () - start);
     }
     return NULL;
 }
 
 int main (int argc, char *argv[])
 {
-    int count, data_count;
-    unsigned int seed = 1;
-    int thread_updates = 0, data_updates = 0;
+    bench_result_t result;
+    unsigned long data_count;
+    int count;
+    long thread_updates = 0, data_updates = 0;
+    long r_collisions = 0, w_collisions = 0;
+    char label[32];
     int status;
 
+    if (bench_parse (&config, argc, argv, NULL, NULL) != 0) {
+        bench_usage (&config, NULL);
+        return -1;
+    }
+
 #ifdef sun
     /*
      * On Solaris 2.5, threads are not timesliced. To ensure
      * that our threads can run concurrently, we need to
-     * increase the concurrency level to THREADS.
+     * increase the concurrency level to the number of threads.
      */
-    DPRINTF (("Setting concurrency level to %d\n", THREADS));
-    thr_setconcurrency (THREADS);
+    DPRINTF (("Setting concurrency level to %d\n", config.threads));
+    thr_setconcurrency (config.threads);
 #endif
 
+    threads = (thread_t*)calloc (config.threads, sizeof (thread_t));
+    data = (data_t*)calloc (config.keys, sizeof (data_t));
+    if (threads == NULL || data == NULL)
+        errno_abort ("Allocate arrays");
+
     /*
      * Initialize the shared data.
      */
-    for (data_count = 0; data_count < DATASIZE; data_count++) {
+    for (data_count = 0; data_count < config.keys; data_count++) {
         data[data_count].data = 0;
         data[data_count].updates = 0;
         rwl_init (&data[data_count].lock);
     }
 
     /*
-     * Create THREADS threads to access shared data.
+     * Create the threads to access shared data.
      */
-    for (count = 0; count < THREADS; count++) {
+    bench_start (&config);
+    for (count = 0; count < config.threads; count++) {
         threads[count].thread_num = count;
-        threads[count].r_collisions = 0;
-        threads[count].w_collisions = 0;
-        threads[count].updates = 0;
-        threads[count].interval = rand_r (&seed) % ITERATIONS;
+        bench_thread_init (&config, &threads[count].bench, count);
         status = pthread_create (&threads[count].thread_id,
             NULL, thread_routine, (void*)&threads[count]);
         if (status != 0)
             err_abort (status, "Create thread");
     }
+    bench_wait (&config);
 
     /*
      * Wait for all threads to complete, and collect
      * statistics.
      */
-    for (count = 0; count < THREADS; count++) {
+    for (count = 0; count < config.threads; count++) {
         status = pthread_join (threads[count].thread_id, NULL);
         if (status != 0)
             err_abort (status, "Join thread");
+    }
+    status = bench_result_init (&result, config.threads);
+    if (status != 0)
+        err_abort (status, "Init result");
+    for (count = 0; count < config.threads; count++) {
+        bench_result_add (&result, count, &threads[count].bench);
         thread_updates += threads[count].updates;
-        printf ("%02d: interval %d, updates %d, "
-                "r_collisions %d, w_collisions %d\n",
-            count, threads[count].interval,
-            threads[count].updates,
-            threads[count].r_collisions, threads[count].w_collisions);
+        r_collisions += threads[count].r_collisions;
+        w_collisions += threads[count].w_collisions;
     }
 
     /*
      * Collect statistics for the data.
      */
-    for (data_count = 0; data_count < DATASIZE; data_count++) {
+    for (data_count = 0; data_count < config.keys; data_count++) {
         data_updates += data[data_count].updates;
-        printf ("data %02d: value %d, %d updates\n",
-            data_count, data[data_count].data, data[data_count].updates);
         rwl_destroy (&data[data_count].lock);
     }
+    if (thread_updates != data_updates) {
+        fprintf (stderr, "%ld thread updates, %ld data updates\n",
+            thread_updates, data_updates);
+        abort ();
+    }
 
+    bench_result_extra (&result, "updates", thread_updates);
+    bench_result_extra (&result, "r_collisions", r_collisions);
+    bench_result_extra (&result, "w_collisions", w_collisions);
+    sprintf (label, "%s/trylock", LOCK_TYPE);
+    bench_report (&config, &result, label);
+    bench_result_free (&result);
+    free (threads);
+    free (data);
     return 0;
 }
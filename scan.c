@@ -0,0 +1,243 @@
+/*
+ * scan.c
+ *
+ * This file implements the substring scanner described in scan.h.
+ *
+ * The vector kernels follow the "first and last byte" filter: for
+ * each block of 16 (SSE2) or 32 (AVX2) candidate positions, one
+ * load is compared with the pattern's first byte and another,
+ * length-1 bytes further on, with its last byte. The AND of the
+ * two comparisons is nearly always zero in ordinary text, so most
+ * blocks cost two loads, two compares, and a test; each set bit
+ * is checked with memcmp(). Positions too close to the end of the
+ * buffer for a full block go to the scalar kernel.
+ */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "errors.h"
+#include "scan.h"
+
+#if defined (__i386__) || defined (__x86_64__)
+# include <immintrin.h>
+# define SCAN_X86
+#endif
+
+/*
+ * Check a candidate whose first and last bytes are known to match.
+ */
+static int scan_middle (const scan_t *scan, const char *candidate)
+{
+    return scan->length < 3
+        || memcmp (candidate + 1, scan->pattern + 1, scan->length - 2) == 0;
+}
+
+/*
+ * Find the pattern with memchr(), one first byte at a time.
+ */
+static const char *scan_scalar (
+    const scan_t *scan, const char *buffer, size_t size)
+{
+    const char *next, *end;
+    size_t last;
+
+    if (scan->length == 0)
+        return buffer;
+    if (size < scan->length)
+        return NULL;
+    last = scan->length - 1;
+    end = buffer + size - last;         /* end of candidates */
+    for (next = buffer; next < end; next++) {
+        next = (const char*)memchr (next, scan->pattern[0], end - next);
+        if (next == NULL)
+            break;
+        if (next[last] == scan->pattern[last] && scan_middle (scan, next))
+            return next;
+    }
+    return NULL;
+}
+
+#ifdef SCAN_X86
+/*
+ * Check 16 candidates at a time, with SSE2.
+ */
+__attribute__ ((target ("sse2")))
+static const char *scan_sse2 (
+    const scan_t *scan, const char *buffer, size_t size)
+{
+    __m128i first, last, block;
+    const char *found;
+    size_t offset = 0;
+    unsigned int mask;
+
+    if (scan->length == 0)
+        return buffer;
+    first = _mm_set1_epi8 (scan->pattern[0]);
+    last = _mm_set1_epi8 (scan->pattern[scan->length - 1]);
+    for (; offset + scan->length - 1 + 16 <= size; offset += 16) {
+        block = _mm_and_si128 (
+            _mm_cmpeq_epi8 (first,
+                _mm_loadu_si128 ((const __m128i*)(buffer + offset))),
+            _mm_cmpeq_epi8 (last,
+                _mm_loadu_si128 ((const __m128i*)
+                    (buffer + offset + scan->length - 1))));
+        mask = _mm_movemask_epi8 (block);
+        while (mask != 0) {
+            found = buffer + offset + __builtin_ctz (mask);
+            if (scan_middle (scan, found))
+                return found;
+            mask &= mask - 1;
+        }
+    }
+    return scan_scalar (scan, buffer + offset, size - offset);
+}
+
+/*
+ * Check 32 candidates at a time, with AVX2.
+ */
+__attribute__ ((target ("avx2")))
+static const char *scan_avx2 (
+    const scan_t *scan, const char *buffer, size_t size)
+{
+    __m256i first, last, block;
+    const char *found;
+    size_t offset = 0;
+    unsigned int mask;
+
+    if (scan->length == 0)
+        return buffer;
+    first = _mm256_set1_epi8 (scan->pattern[0]);
+    last = _mm256_set1_epi8 (scan->pattern[scan->length - 1]);
+    for (; offset + scan->length - 1 + 32 <= size; offset += 32) {
+        block = _mm256_and_si256 (
+            _mm256_cmpeq_epi8 (first,
+                _mm256_loadu_si256 ((const __m256i*)(buffer + offset))),
+            _mm256_cmpeq_epi8 (last,
+                _mm256_loadu_si256 ((const __m256i*)
+                    (buffer + offset + scan->length - 1))));
+        mask = (unsigned int)_mm256_movemask_epi8 (block);
+        while (mask != 0) {
+            found = buffer + offset + __builtin_ctz (mask);
+            if (scan_middle (scan, found))
+                return found;
+            mask &= mask - 1;
+        }
+    }
+    return scan_scalar (scan, buffer + offset, size - offset);
+}
+#endif
+
+/*
+ * Initialize a scanner for "length" bytes at "pattern", with the
+ * best kernel available.
+ */
+int scan_init (scan_t *scan, const char *pattern, size_t length)
+{
+    scan->pattern = pattern;
+    scan->length = length;
+    if (scan_use (scan, "avx2") == 0 || scan_use (scan, "sse2") == 0)
+        return 0;
+    return scan_use (scan, "scalar");
+}
+
+/*
+ * Choose a scanner's kernel by name: "scalar", "sse2", or "avx2".
+ * Return ENOSYS if the processor doesn't support it.
+ */
+int scan_use (scan_t *scan, const char *kernel)
+{
+    if (strcmp (kernel, "scalar") == 0) {
+        scan->find = scan_scalar;
+        scan->kernel = "scalar";
+        return 0;
+    }
+#ifdef SCAN_X86
+    __builtin_cpu_init ();
+    if (strcmp (kernel, "sse2") == 0 && __builtin_cpu_supports ("sse2")) {
+        scan->find = scan_sse2;
+        scan->kernel = "sse2";
+        return 0;
+    }
+    if (strcmp (kernel, "avx2") == 0 && __builtin_cpu_supports ("avx2")) {
+        scan->find = scan_avx2;
+        scan->kernel = "avx2";
+        return 0;
+    }
+#endif
+    return ENOSYS;
+}
+
+/*
+ * Return the first match in the buffer, or NULL.
+ */
+const char *scan_find (const scan_t *scan, const char *buffer, size_t size)
+{
+    return scan->find (scan, buffer, size);
+}
+
+/*
+ * Search the file open on "fd" (which must be positioned at its
+ * start), and return the offset of the first match (or -1, if
+ * there's none) in "*offset". Return 0, or an error number if the
+ * file can't be read.
+ */
+int scan_fd (const scan_t *scan, int fd, off_t *offset)
+{
+    struct stat filestat;
+    const char *found;
+    char *buffer;
+    size_t carry = 0, keep;
+    ssize_t bytes;
+    off_t base = 0;
+    int status;
+
+    *offset = -1;
+    if (fstat (fd, &filestat) == 0 && S_ISREG (filestat.st_mode)
+        && filestat.st_size > 0) {
+        buffer = (char*)mmap (
+            NULL, filestat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buffer != MAP_FAILED) {
+            madvise (buffer, filestat.st_size, MADV_SEQUENTIAL);
+            found = scan->find (scan, buffer, filestat.st_size);
+            if (found != NULL)
+                *offset = found - buffer;
+            munmap (buffer, filestat.st_size);
+            return 0;
+        }
+    }
+
+    /*
+     * Read the file in blocks. Each block is read in after the
+     * last length-1 bytes of the one before it; a match can't
+     * start any earlier than that and still need the new block.
+     */
+    keep = scan->length > 0 ? scan->length - 1 : 0;
+    buffer = (char*)malloc (keep + SCAN_BLOCK);
+    if (buffer == NULL)
+        return errno;
+    while (1) {
+        bytes = read (fd, buffer + carry, SCAN_BLOCK);
+        if (bytes < 0) {
+            if (errno == EINTR)
+                continue;
+            status = errno;
+            free (buffer);
+            return status;
+        }
+        if (bytes == 0)
+            break;
+        found = scan->find (scan, buffer, carry + bytes);
+        if (found != NULL) {
+            *offset = base + (found - buffer);
+            break;
+        }
+        carry += bytes;
+        if (carry > keep) {
+            memmove (buffer, buffer + carry - keep, keep);
+            base += carry - keep;
+            carry = keep;
+        }
+    }
+    free (buffer);
+    return 0;
+}
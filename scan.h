@@ -0,0 +1,53 @@
+/*
+ * scan.h
+ *
+ * This header file describes a substring scanner, used by the
+ * crew program to search files for a string.
+ *
+ * A scan_t holds a search pattern and the kernel chosen to find
+ * it. scan_init() picks the best kernel the processor supports:
+ * AVX2 or SSE2 on x86, and portable C elsewhere (scan_use()
+ * chooses one by name). The vector kernels compare a block of
+ * candidate positions at once against the pattern's first byte,
+ * and the block the pattern's length further on against its last
+ * byte; only positions where both bytes match are compared in
+ * full. The scalar kernel finds each occurrence of the first byte
+ * with memchr() and checks the last byte before comparing the
+ * rest.
+ *
+ * scan_find() searches a buffer. scan_fd() searches an open file:
+ * it maps a regular file and scans it in one piece, and reads
+ * anything else (or a file it can't map) in blocks of SCAN_BLOCK
+ * bytes, carrying the last length-1 bytes of each block over to
+ * the next, so that a match spanning two blocks is still found.
+ *
+ * A scan_t isn't changed by searching, so any number of threads
+ * may share one.
+ */
+#ifndef __scan_h
+#define __scan_h
+#include <sys/types.h>
+
+#define SCAN_BLOCK      (1024 * 1024)   /* bytes per read */
+
+/*
+ * Structure describing a scanner.
+ */
+typedef struct scan_tag {
+    const char          *pattern;       /* not copied */
+    size_t              length;
+    const char          *kernel;        /* name of the kernel */
+    const char          *(*find)(       /* the kernel */
+        const struct scan_tag *scan, const char *buffer, size_t size);
+} scan_t;
+
+/*
+ * Define scanner functions
+ */
+extern int scan_init (scan_t *scan, const char *pattern, size_t length);
+extern int scan_use (scan_t *scan, const char *kernel);
+extern const char *scan_find (
+    const scan_t *scan, const char *buffer, size_t size);
+extern int scan_fd (const scan_t *scan, int fd, off_t *offset);
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * scan_main.c
+ *
+ * Measure the throughput of the substring scanner in scan.c, in
+ * gigabytes per second, for each kernel the processor supports,
+ * against the C library's memmem().
+ *
+ * The buffer is filled with pseudo-random lower case "words",
+ * and the pattern is planted once, at the very end, so that each
+ * pass scans the whole buffer. A short pattern may turn up by
+ * chance before that; each pass then stops at its first match, so
+ * the throughput is reckoned from the bytes scanned up to the end
+ * of the match found, which is also reported. Each kernel's answer
+ * is checked against memmem()'s.
+ *
+ * Usage: scan_main [megabytes [pattern [passes]]]
+ *
+ * The vector kernels depend on the compiler to keep their values
+ * in registers, so build with optimization (for example, with
+ * CMAKE_BUILD_TYPE=Release) before comparing them with memmem().
+ */
+#define _GNU_SOURCE                     /* for memmem */
+#include <time.h>
+#include "errors.h"
+#include "scan.h"
+
+#define MEGABYTES       64
+#define PATTERN         "pthread_barrier_wait"
+#define PASSES          10
+
+static double now_sec (void)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Scan the buffer "passes" times with the named kernel (or with
+ * memmem(), if "kernel" is NULL), and report the throughput over
+ * the bytes it had to look at: up to the end of the match it found.
+ */
+static void run (const char *kernel, const scan_t *scan,
+    const char *buffer, size_t size, int passes, const char *expected)
+{
+    const char *found = NULL;
+    double start, elapsed;
+    size_t scanned;
+    int pass;
+
+    start = now_sec ();
+    for (pass = 0; pass < passes; pass++) {
+        if (kernel == NULL)
+            found = (const char*)memmem (
+                buffer, size, scan->pattern, scan->length);
+        else
+            found = scan_find (scan, buffer, size);
+    }
+    elapsed = now_sec () - start;
+    scanned = found == NULL ? size : (size_t)(found - buffer) + scan->length;
+    printf ("%-8s %8.2f GB/s%s\n", kernel == NULL ? "memmem" : kernel,
+        (double)scanned * passes / elapsed / 1e9,
+        found == expected ? "" : "  (wrong match)");
+}
+
+int main (int argc, char *argv[])
+{
+    static const char *kernels[] = {"scalar", "sse2", "avx2"};
+    const char *pattern = PATTERN, *expected;
+    unsigned long long seed = 88172645463325252ULL;
+    scan_t scan;
+    char *buffer;
+    size_t size, length, offset;
+    int megabytes = MEGABYTES, passes = PASSES, index;
+
+    if (argc > 1)
+        megabytes = atoi (argv[1]);
+    if (argc > 2)
+        pattern = argv[2];
+    if (argc > 3)
+        passes = atoi (argv[3]);
+    length = strlen (pattern);
+    size = (size_t)megabytes * 1024 * 1024;
+    if (megabytes < 1 || passes < 1 || length < 1 || length > size) {
+        fprintf (stderr, "Usage: %s [megabytes [pattern [passes]]]\n",
+            argv[0]);
+        return -1;
+    }
+
+    buffer = (char*)malloc (size);
+    if (buffer == NULL)
+        errno_abort ("Allocate buffer");
+    for (offset = 0; offset < size; offset++) {
+        seed ^= seed >> 12;
+        seed ^= seed << 25;
+        seed ^= seed >> 27;
+        buffer[offset] = (seed * 2685821657736338717ULL) % 7 == 0
+            ? ' ' : 'a' + (seed * 2685821657736338717ULL >> 32) % 26;
+    }
+    memcpy (buffer + size - length, pattern, length);
+
+    printf ("%d MB, pattern \"%s\", %d passes\n", megabytes, pattern, passes);
+    scan_init (&scan, pattern, length);
+    expected = (const char*)memmem (buffer, size, pattern, length);
+    if (expected != buffer + size - length)
+        printf ("pattern occurs by chance at byte %lu; "
+            "each pass scans only %lu bytes\n",
+            (unsigned long)(expected - buffer),
+            (unsigned long)(expected - buffer + length));
+    run (NULL, &scan, buffer, size, passes, expected);
+    for (index = 0; index < 3; index++) {
+        if (scan_use (&scan, kernels[index]) == 0)
+            run (kernels[index], &scan, buffer, size, passes, expected);
+    }
+    free (buffer);
+    return 0;
+}
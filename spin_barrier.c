@@ -0,0 +1,148 @@
+/*
+ * spin_barrier.c
+ *
+ * This file implements the "spin barrier" synchronization
+ * construct, a barrier for short computational phases.
+ *
+ * The spin_barrier_wait() function behaves like barrier_wait():
+ * one thread (the one that happens to arrive last) returns with
+ * the status -1, and the others with 0. Where barrier_wait() takes
+ * a mutex and sleeps on a condition variable, so that every cycle
+ * costs a trip through the kernel for each waiter, here arriving
+ * threads decrement an atomic counter and the waiters spin on the
+ * barrier's sense. When the last thread arrives it resets the
+ * counter and reverses the sense. A waiter parks on a futex only
+ * if its spin budget runs out first, and the last thread makes
+ * the wake system call only if some waiter has parked.
+ *
+ * Because a cycle can't complete until every thread has arrived,
+ * the sense a thread reads as it arrives is always the sense of
+ * its own cycle, and a parked thread can't miss its wakeup by
+ * sleeping through two reversals.
+ *
+ * Like barrier_wait(), spin_barrier_wait() is not a cancellation
+ * point.
+ */
+#include <pthread.h>
+#include "errors.h"
+#include "futex.h"
+#include "spin_barrier.h"
+
+/*
+ * Tell the processor that this is a spin loop.
+ */
+#if defined (__i386__) || defined (__x86_64__)
+# define SPIN_PAUSE()   __builtin_ia32_pause ()
+#elif defined (__aarch64__)
+# define SPIN_PAUSE()   __asm__ __volatile__ ("yield" ::: "memory")
+#else
+# define SPIN_PAUSE()   __asm__ __volatile__ ("" ::: "memory")
+#endif
+
+/*
+ * Initialize a spin barrier for use.
+ */
+int spin_barrier_init (spin_barrier_t *barrier, int count)
+{
+    if (count < 1)
+        return EINVAL;
+    barrier->threshold = barrier->counter = count;
+    barrier->sense = 0;
+    barrier->parked = 0;
+    barrier->spin = SPIN_BARRIER_SPIN_MIN;
+    barrier->valid = SPIN_BARRIER_VALID;
+    return 0;
+}
+
+/*
+ * Destroy a spin barrier when done using it.
+ */
+int spin_barrier_destroy (spin_barrier_t *barrier)
+{
+    if (barrier->valid != SPIN_BARRIER_VALID)
+        return EINVAL;
+
+    /*
+     * Check whether any threads are known to be waiting (or are
+     * still on their way out of a futex wait); report "BUSY" if
+     * so.
+     */
+    if (__atomic_load_n (&barrier->counter, __ATOMIC_ACQUIRE)
+            != (unsigned int)barrier->threshold
+        || __atomic_load_n (&barrier->parked, __ATOMIC_ACQUIRE) != 0)
+        return EBUSY;
+
+    barrier->valid = 0;
+    return 0;
+}
+
+/*
+ * Wait for all members of a spin barrier to reach the barrier.
+ */
+int spin_barrier_wait (spin_barrier_t *barrier)
+{
+    unsigned int sense;
+    int spin, poll, status;
+
+    if (barrier->valid != SPIN_BARRIER_VALID)
+        return EINVAL;
+
+    sense = __atomic_load_n (&barrier->sense, __ATOMIC_ACQUIRE);
+
+    if (__atomic_sub_fetch (&barrier->counter, 1, __ATOMIC_ACQ_REL) == 0) {
+        /*
+         * Reset the counter before reversing the sense: released
+         * threads may arrive at the next cycle at once. Then wake
+         * any waiters that gave up spinning. (The sense store and
+         * the load of "parked" are sequentially consistent, as
+         * are the waiter's increment of "parked" and its check of
+         * the sense, so at least one side sees the other.)
+         */
+        __atomic_store_n (
+            &barrier->counter, barrier->threshold, __ATOMIC_RELAXED);
+        __atomic_store_n (&barrier->sense, !sense, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n (&barrier->parked, __ATOMIC_SEQ_CST) != 0)
+            futex_wake (&barrier->sense, FUTEX_ALL);
+
+        /*
+         * The last thread into the barrier will return status
+         * -1 rather than 0, so that it can be used to perform
+         * some special serial code following the barrier.
+         */
+        return -1;
+    }
+
+    /*
+     * Spin, watching for the sense to change. If the barrier
+     * completed late in the spin, allow more spinning next time;
+     * if it didn't complete, allow less. The budget is shared by
+     * all the threads, and updated without synchronization,
+     * since it's only a hint.
+     */
+    spin = __atomic_load_n (&barrier->spin, __ATOMIC_RELAXED);
+    for (poll = 0; poll < spin; poll++) {
+        if (__atomic_load_n (&barrier->sense, __ATOMIC_ACQUIRE) != sense) {
+            if (poll > spin / 2 && spin < SPIN_BARRIER_SPIN_MAX)
+                __atomic_store_n (&barrier->spin, spin * 2, __ATOMIC_RELAXED);
+            return 0;
+        }
+        SPIN_PAUSE ();
+    }
+    if (spin > SPIN_BARRIER_SPIN_MIN)
+        __atomic_store_n (&barrier->spin, spin / 2, __ATOMIC_RELAXED);
+
+    /*
+     * Park until the sense changes. The futex wait returns at
+     * once (EAGAIN) if it already has.
+     */
+    __atomic_add_fetch (&barrier->parked, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n (&barrier->sense, __ATOMIC_SEQ_CST) == sense) {
+        status = futex_wait (&barrier->sense, sense, NULL);
+        if (status != 0 && status != EAGAIN && status != EINTR) {
+            __atomic_sub_fetch (&barrier->parked, 1, __ATOMIC_RELEASE);
+            return status;
+        }
+    }
+    __atomic_sub_fetch (&barrier->parked, 1, __ATOMIC_RELEASE);
+    return 0;
+}
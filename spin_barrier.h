@@ -0,0 +1,60 @@
+/*
+ * spin_barrier.h
+ *
+ * This header file describes a "spin barrier": the same
+ * synchronization construct as barrier.h, built on an atomic
+ * counter instead of a mutex and condition variable, for
+ * computations whose phases between barriers are very short.
+ *
+ * Arriving threads decrement the counter; the last one resets it
+ * and reverses the barrier's "sense", which releases the others.
+ * A waiting thread first spins, watching the sense, and only if
+ * the barrier isn't complete within its spin budget does it park
+ * on a futex. The spin budget adapts: it grows while spinning
+ * succeeds, and shrinks when threads end up parking anyway (as
+ * they must when there are more threads than processors).
+ */
+#ifndef __spin_barrier_h
+#define __spin_barrier_h
+#include <pthread.h>
+
+#define SPIN_BARRIER_CACHELINE  64
+
+/*
+ * Limits of the adaptive spin budget, in polls of the sense.
+ */
+#define SPIN_BARRIER_SPIN_MIN   64
+#define SPIN_BARRIER_SPIN_MAX   (64 * 1024)
+
+/*
+ * Structure describing a spin barrier. The counter, which every
+ * arriving thread writes, is kept out of the cache line that the
+ * waiters poll.
+ */
+typedef struct spin_barrier_tag {
+    unsigned int        counter         /* threads yet to arrive */
+        __attribute__ ((aligned (SPIN_BARRIER_CACHELINE)));
+    unsigned int        sense           /* flips each cycle (futex) */
+        __attribute__ ((aligned (SPIN_BARRIER_CACHELINE)));
+    unsigned int        parked;         /* threads parked on sense */
+    int                 spin;           /* current spin budget */
+    int                 valid;          /* set when valid */
+    int                 threshold;      /* number of threads required */
+} spin_barrier_t;
+
+#define SPIN_BARRIER_VALID      0x5b1a4e
+
+/*
+ * Support static initialization of spin barriers
+ */
+#define SPIN_BARRIER_INITIALIZER(cnt) \
+    {cnt, 0, 0, SPIN_BARRIER_SPIN_MIN, SPIN_BARRIER_VALID, cnt}
+
+/*
+ * Define spin barrier functions
+ */
+extern int spin_barrier_init (spin_barrier_t *barrier, int count);
+extern int spin_barrier_destroy (spin_barrier_t *barrier);
+extern int spin_barrier_wait (spin_barrier_t *barrier);
+
+#endif
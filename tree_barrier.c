@@ -0,0 +1,254 @@
+/*
+ * tree_barrier.c
+ *
+ * This file implements the "tree barrier" synchronization
+ * construct.
+ *
+ * A barrier built on a single counter (with a mutex, as in
+ * barrier.c, or atomic, as in spin_barrier.c) has every thread
+ * write the same cache line, so the time for a cycle grows
+ * linearly with the number of threads. Here each node of a
+ * combining tree sees at most TREE_BARRIER_FANIN arrivals, and
+ * only log(N) of them are in sequence.
+ *
+ * The tree_barrier_wait() function behaves like barrier_wait():
+ * one thread (the one that completes the root) returns with the
+ * status -1, and the others with 0. As in the spin barrier,
+ * waiting threads spin on their node's release flag for a while,
+ * and then park on it with a futex.
+ *
+ * Like barrier_wait(), tree_barrier_wait() is not a cancellation
+ * point.
+ */
+#include <pthread.h>
+#include "errors.h"
+#include "futex.h"
+#include "tree_barrier.h"
+
+/*
+ * Enough levels for any int thread count.
+ */
+#define TREE_BARRIER_MAX_DEPTH  16
+
+/*
+ * Tell the processor that this is a spin loop.
+ */
+#if defined (__i386__) || defined (__x86_64__)
+# define SPIN_PAUSE()   __builtin_ia32_pause ()
+#elif defined (__aarch64__)
+# define SPIN_PAUSE()   __asm__ __volatile__ ("yield" ::: "memory")
+#else
+# define SPIN_PAUSE()   __asm__ __volatile__ ("" ::: "memory")
+#endif
+
+/*
+ * Initialize a tree barrier for use.
+ */
+int tree_barrier_init (tree_barrier_t *barrier, int count)
+{
+    tree_barrier_node_t *nodes;
+    int level_count[TREE_BARRIER_MAX_DEPTH];
+    int depth, total, width, level, base, index, children;
+
+    if (count < 1)
+        return EINVAL;
+
+    /*
+     * Size each level: the leaves hold up to FANIN threads each,
+     * and each higher level up to FANIN nodes of the level below,
+     * up to a single root.
+     */
+    depth = total = 0;
+    width = count;
+    do {
+        width = (width + TREE_BARRIER_FANIN - 1) / TREE_BARRIER_FANIN;
+        level_count[depth++] = width;
+        total += width;
+    } while (width > 1);
+
+    if (posix_memalign ((void**)&nodes, TREE_BARRIER_CACHELINE,
+            total * sizeof (tree_barrier_node_t)) != 0)
+        return ENOMEM;
+    memset (nodes, 0, total * sizeof (tree_barrier_node_t));
+
+    children = count;
+    base = 0;
+    for (level = 0; level < depth; level++) {
+        for (index = 0; index < level_count[level]; index++) {
+            nodes[base + index].threshold =
+                children - index * TREE_BARRIER_FANIN < TREE_BARRIER_FANIN
+                ? children - index * TREE_BARRIER_FANIN
+                : TREE_BARRIER_FANIN;
+            nodes[base + index].counter = nodes[base + index].threshold;
+            nodes[base + index].parent = level + 1 < depth
+                ? &nodes[base + level_count[level]
+                    + index / TREE_BARRIER_FANIN]
+                : NULL;
+            nodes[base + index].child = index % TREE_BARRIER_FANIN;
+        }
+        children = level_count[level];
+        base += level_count[level];
+    }
+
+    barrier->nodes = nodes;
+    barrier->node_count = total;
+    barrier->depth = depth;
+    barrier->spin = TREE_BARRIER_SPIN_MIN;
+    barrier->threshold = count;
+    barrier->valid = TREE_BARRIER_VALID;
+    return 0;
+}
+
+/*
+ * Destroy a tree barrier when done using it.
+ */
+int tree_barrier_destroy (tree_barrier_t *barrier)
+{
+    tree_barrier_node_t *node;
+    int index;
+
+    if (barrier->valid != TREE_BARRIER_VALID)
+        return EINVAL;
+
+    /*
+     * Check whether any threads are known to be waiting (or are
+     * still on their way out of a futex wait); report "BUSY" if
+     * so.
+     */
+    for (index = 0; index < barrier->node_count; index++) {
+        node = &barrier->nodes[index];
+        if (__atomic_load_n (&node->counter, __ATOMIC_ACQUIRE)
+                != (unsigned int)node->threshold
+            || __atomic_load_n (&node->parked, __ATOMIC_ACQUIRE) != 0)
+            return EBUSY;
+    }
+
+    barrier->valid = 0;
+    free (barrier->nodes);
+    barrier->nodes = NULL;
+    return 0;
+}
+
+/*
+ * Wait for a node's release flag to move on from "gen": spin for
+ * the current budget, then park. The budget adapts as in
+ * spin_barrier_wait().
+ */
+static int tree_barrier_await (
+    tree_barrier_t *barrier, tree_barrier_node_t *node, unsigned int gen)
+{
+    int spin, poll, status;
+
+    spin = __atomic_load_n (&barrier->spin, __ATOMIC_RELAXED);
+    for (poll = 0; poll < spin; poll++) {
+        if (__atomic_load_n (&node->gen, __ATOMIC_ACQUIRE) != gen) {
+            if (poll > spin / 2 && spin < TREE_BARRIER_SPIN_MAX)
+                __atomic_store_n (&barrier->spin, spin * 2, __ATOMIC_RELAXED);
+            return 0;
+        }
+        SPIN_PAUSE ();
+    }
+    if (spin > TREE_BARRIER_SPIN_MIN)
+        __atomic_store_n (&barrier->spin, spin / 2, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch (&node->parked, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n (&node->gen, __ATOMIC_SEQ_CST) == gen) {
+        status = futex_wait (&node->gen, gen, NULL);
+        if (status != 0 && status != EAGAIN && status != EINTR) {
+            __atomic_sub_fetch (&node->parked, 1, __ATOMIC_RELEASE);
+            return status;
+        }
+    }
+    __atomic_sub_fetch (&node->parked, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * Wait for all members of a tree barrier to reach the barrier.
+ * "id" is the calling thread's index, from 0 to count-1; no two
+ * threads may use the same index in a cycle.
+ */
+int tree_barrier_wait (tree_barrier_t *barrier, int id)
+{
+    return tree_barrier_wait_reduce (barrier, id, 0.0, NULL, NULL);
+}
+
+/*
+ * Wait for all members of a tree barrier to reach the barrier,
+ * combining "value" into the reduction (unless "op" is NULL), and
+ * return the reduction in "result" (if not NULL).
+ */
+int tree_barrier_wait_reduce (
+    tree_barrier_t *barrier, int id,
+    double value, barrier_op_t op, double *result)
+{
+    tree_barrier_node_t *path[TREE_BARRIER_MAX_DEPTH];
+    tree_barrier_node_t *node;
+    unsigned int gen;
+    int climbed = 0, child, index, status;
+
+    if (barrier->valid != TREE_BARRIER_VALID)
+        return EINVAL;
+    if (id < 0 || id >= barrier->threshold)
+        return EINVAL;
+
+    /*
+     * Climb while we're the last child to arrive at each node,
+     * resetting the counters behind us. A node's release flag
+     * can't change until its cycle completes, which needs us, so
+     * the value read on arrival is our cycle's.
+     */
+    node = &barrier->nodes[id / TREE_BARRIER_FANIN];
+    child = id % TREE_BARRIER_FANIN;
+    for (;;) {
+        /*
+         * Leave our partial result in our slot; the decrement
+         * publishes it to the last child to arrive, which combines
+         * the slots in order.
+         */
+        if (op != NULL)
+            node->slot[child] = value;
+        gen = __atomic_load_n (&node->gen, __ATOMIC_ACQUIRE);
+        if (__atomic_sub_fetch (&node->counter, 1, __ATOMIC_ACQ_REL) != 0) {
+            status = tree_barrier_await (barrier, node, gen);
+            if (status <= 0)
+                value = node->result;
+            break;
+        }
+        __atomic_store_n (&node->counter, node->threshold, __ATOMIC_RELAXED);
+        if (op != NULL) {
+            value = node->slot[0];
+            for (index = 1; index < node->threshold; index++)
+                value = op (value, node->slot[index]);
+        }
+        child = node->child;
+        path[climbed++] = node;
+        if (node->parent == NULL) {
+            /*
+             * The thread that completes the root will return
+             * status -1 rather than 0, so that it can be used to
+             * perform some special serial code following the
+             * barrier.
+             */
+            status = -1;
+            break;
+        }
+        node = node->parent;
+    }
+
+    /*
+     * Release the nodes we climbed through, from the top down, so
+     * that the threads released first have the most nodes of their
+     * own to release.
+     */
+    while (climbed > 0) {
+        node = path[--climbed];
+        node->result = value;
+        __atomic_add_fetch (&node->gen, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n (&node->parked, __ATOMIC_SEQ_CST) != 0)
+            futex_wake (&node->gen, FUTEX_ALL);
+    }
+    if (result != NULL && status <= 0)
+        *result = value;
+    return status;
+}
@@ -0,0 +1,83 @@
+/*
+ * tree_barrier.h
+ *
+ * This header file describes a "tree barrier": a barrier for
+ * large numbers of threads, in which no cache line is written by
+ * more than a handful of them.
+ *
+ * The threads are the leaves of a combining tree of fan-in
+ * TREE_BARRIER_FANIN. A thread arriving at the barrier decrements
+ * the counter of its leaf node; the last of the node's children to
+ * arrive goes on to decrement the parent's counter, and so on, so
+ * that one thread reaches the root after log(N) rounds. The others
+ * wait, each on the release flag of the node where it stopped.
+ * The thread that completes the root releases the nodes on its
+ * path from the top down, and each released thread releases the
+ * nodes it climbed through in turn.
+ *
+ * Every node keeps its counter and its release flag in separate
+ * cache lines. Each thread passes its own index (0 through count-1)
+ * to tree_barrier_wait(), which determines its leaf.
+ *
+ * tree_barrier_wait_reduce() combines a value from each thread on
+ * the way up the tree: each child leaves its partial result in its
+ * slot of the node, and the last to arrive combines them and
+ * carries the result to the parent. The result is handed back
+ * down the tree with the release.
+ */
+#ifndef __tree_barrier_h
+#define __tree_barrier_h
+#include <pthread.h>
+#include "barrier.h"
+
+#define TREE_BARRIER_CACHELINE  64
+#define TREE_BARRIER_FANIN      4
+
+/*
+ * Limits of the adaptive spin budget, in polls of a release flag
+ * (as for the spin barrier).
+ */
+#define TREE_BARRIER_SPIN_MIN   64
+#define TREE_BARRIER_SPIN_MAX   (64 * 1024)
+
+/*
+ * A node of the combining tree.
+ */
+typedef struct tree_barrier_node_tag {
+    unsigned int        counter         /* children yet to arrive */
+        __attribute__ ((aligned (TREE_BARRIER_CACHELINE)));
+    int                 threshold;      /* number of children */
+    struct tree_barrier_node_tag *parent; /* NULL at the root */
+    int                 child;          /* our slot in the parent */
+    double              slot[TREE_BARRIER_FANIN]; /* partial results */
+    unsigned int        gen             /* release flag (futex) */
+        __attribute__ ((aligned (TREE_BARRIER_CACHELINE)));
+    unsigned int        parked;         /* threads parked on gen */
+    double              result;         /* reduction, on release */
+} tree_barrier_node_t;
+
+/*
+ * Structure describing a tree barrier.
+ */
+typedef struct tree_barrier_tag {
+    tree_barrier_node_t *nodes;         /* leaves first, root last */
+    int                 node_count;
+    int                 depth;          /* levels in the tree */
+    int                 spin;           /* current spin budget */
+    int                 valid;          /* set when valid */
+    int                 threshold;      /* number of threads required */
+} tree_barrier_t;
+
+#define TREE_BARRIER_VALID      0x7eeba5
+
+/*
+ * Define tree barrier functions
+ */
+extern int tree_barrier_init (tree_barrier_t *barrier, int count);
+extern int tree_barrier_destroy (tree_barrier_t *barrier);
+extern int tree_barrier_wait (tree_barrier_t *barrier, int id);
+extern int tree_barrier_wait_reduce (
+    tree_barrier_t *barrier, int id,
+    double value, barrier_op_t op, double *result);
+
+#endif
@@ -0,0 +1,724 @@
+/*
+ * trigram.c
+ *
+ * This file implements the trigram index described in trigram.h.
+ *
+ * trigram_write() inverts the files' trigram lists with a counting
+ * sort: one pass counts each trigram's files, a running sum turns
+ * the counts into each posting list's starting place, and a second
+ * pass drops each file's number into place. The files are visited
+ * in order, so each posting list comes out sorted, ready to be
+ * encoded. The counts take a 64 megabyte table, but only the parts
+ * of it for trigrams that appear are ever touched.
+ */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "errors.h"
+#include "trigram.h"
+
+/*
+ * Decode the next number of a posting list, or return -1 if the
+ * list runs off the end of the postings (a damaged index).
+ */
+static long posting_next (const unsigned char **next, const unsigned char *end)
+{
+    const unsigned char *byte = *next;
+    uint32_t value = 0;
+    int shift;
+
+    for (shift = 0; byte < end && shift < 35; shift += 7) {
+        value |= (uint32_t)(*byte & 0x7f) << shift;
+        if (!(*byte++ & 0x80)) {
+            *next = byte;
+            return value;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Open and map an index, and check that its parts fit. Return 0,
+ * an error number from opening it, or EINVAL if it isn't an index.
+ */
+int trigram_open (trigram_t *index, const char *path)
+{
+    struct stat filestat;
+    const trigram_header_t *header;
+    uint64_t size;
+    uint32_t file;
+    int fd, status;
+
+    memset (index, 0, sizeof (trigram_t));
+    fd = open (path, O_RDONLY);
+    if (fd < 0)
+        return errno;
+    if (fstat (fd, &filestat) == -1) {
+        status = errno;
+        close (fd);
+        return status;
+    }
+    if ((size_t)filestat.st_size < sizeof (trigram_header_t)) {
+        close (fd);
+        return EINVAL;
+    }
+    index->map = mmap (NULL, filestat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    status = errno;
+    close (fd);
+    if (index->map == MAP_FAILED)
+        return status;
+    index->map_size = filestat.st_size;
+
+    header = (const trigram_header_t*)index->map;
+    size = sizeof (trigram_header_t)
+        + (uint64_t)header->files * sizeof (trigram_file_t)
+        + (uint64_t)header->trigrams * sizeof (trigram_entry_t);
+    if (header->magic != TRIGRAM_MAGIC
+        || header->names_size > index->map_size
+        || header->postings_size > index->map_size
+        || header->names_size % 8 != 0
+        || size + header->names_size + header->postings_size
+            != index->map_size) {
+        munmap (index->map, index->map_size);
+        return EINVAL;
+    }
+    index->header = header;
+    index->file = (const trigram_file_t*)(header + 1);
+    index->entry = (const trigram_entry_t*)(index->file + header->files);
+    index->names = (const char*)(index->entry + header->trigrams);
+    index->postings = (const unsigned char*)index->names + header->names_size;
+
+    /*
+     * Each path must start within the names (which end in a null),
+     * and each posting list within the postings.
+     */
+    status = 0;
+    if (header->files > 0 && (header->names_size == 0
+            || index->names[header->names_size - 1] != '\0'))
+        status = EINVAL;
+    for (file = 0; status == 0 && file < header->files; file++) {
+        if (index->file[file].name >= header->names_size)
+            status = EINVAL;
+    }
+    for (file = 0; status == 0 && file < header->trigrams; file++) {
+        if (index->entry[file].offset > header->postings_size)
+            status = EINVAL;
+    }
+    if (status != 0) {
+        munmap (index->map, index->map_size);
+        return status;
+    }
+    index->valid = TRIGRAM_VALID;
+    return 0;
+}
+
+/*
+ * Unmap an index.
+ */
+int trigram_close (trigram_t *index)
+{
+    if (index->valid != TRIGRAM_VALID)
+        return EINVAL;
+    index->valid = 0;
+    if (munmap (index->map, index->map_size) == -1)
+        return errno;
+    return 0;
+}
+
+/*
+ * Return the number of the file "path" in the index, if it's there
+ * and has the size and modification time in "filestat", or else
+ * -1.
+ */
+long trigram_lookup (
+    const trigram_t *index, const char *path, const struct stat *filestat)
+{
+    const trigram_file_t *file;
+    long low = 0, high = (long)index->header->files - 1, middle;
+    int order;
+
+    while (low <= high) {
+        middle = low + (high - low) / 2;
+        file = &index->file[middle];
+        order = strcmp (path, index->names + file->name);
+        if (order == 0) {
+            if (file->size == (uint64_t)filestat->st_size
+                && file->mtime_sec == (int64_t)filestat->st_mtim.tv_sec
+                && file->mtime_nsec == (uint32_t)filestat->st_mtim.tv_nsec)
+                return middle;
+            return -1;
+        }
+        if (order < 0)
+            high = middle - 1;
+        else
+            low = middle + 1;
+    }
+    return -1;
+}
+
+static const trigram_entry_t *entry_find (
+    const trigram_t *index, uint32_t trigram)
+{
+    const trigram_entry_t *entry;
+    long low = 0, high = (long)index->header->trigrams - 1, middle;
+
+    while (low <= high) {
+        middle = low + (high - low) / 2;
+        entry = &index->entry[middle];
+        if (entry->trigram == trigram)
+            return entry;
+        if (entry->trigram > trigram)
+            high = middle - 1;
+        else
+            low = middle + 1;
+    }
+    return NULL;
+}
+
+static int trigram_compare (const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int entry_compare (const void *a, const void *b)
+{
+    uint32_t x = (*(const trigram_entry_t**)a)->count;
+    uint32_t y = (*(const trigram_entry_t**)b)->count;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Mark, in "candidate" (a flag for each file of the index), every
+ * file that may hold "string": those on the posting lists of all
+ * of its trigrams. Flags already set are left set, so that a file
+ * may be made a candidate by any of several strings. Return 0, or
+ * an error number.
+ */
+int trigram_query (const trigram_t *index,
+    const char *string, size_t length, unsigned char *candidate)
+{
+    const unsigned char *text = (const unsigned char*)string;
+    const unsigned char *next, *end;
+    const trigram_entry_t **entry = NULL;
+    uint32_t *want, *list = NULL;
+    size_t count, distinct, index_want, size, kept, pos, listed;
+    long delta;
+    uint32_t file;
+
+    if (length < 3) {
+        memset (candidate, 1, index->header->files);
+        return 0;
+    }
+
+    /*
+     * Find the posting list of each distinct trigram of the
+     * string; if any trigram is missing, no file can hold it.
+     */
+    count = length - 2;
+    want = (uint32_t*)malloc (count * sizeof (uint32_t));
+    if (want == NULL)
+        return ENOMEM;
+    for (index_want = 0; index_want < count; index_want++)
+        want[index_want] = (uint32_t)text[index_want] << 16
+            | (uint32_t)text[index_want + 1] << 8 | text[index_want + 2];
+    qsort (want, count, sizeof (uint32_t), trigram_compare);
+    for (distinct = 0, index_want = 0; index_want < count; index_want++)
+        if (distinct == 0 || want[distinct - 1] != want[index_want])
+            want[distinct++] = want[index_want];
+    entry = (const trigram_entry_t**)malloc (
+        distinct * sizeof (trigram_entry_t*));
+    if (entry == NULL) {
+        free (want);
+        return ENOMEM;
+    }
+    for (index_want = 0; index_want < distinct; index_want++) {
+        entry[index_want] = entry_find (index, want[index_want]);
+        if (entry[index_want] == NULL) {
+            free (entry);
+            free (want);
+            return 0;
+        }
+    }
+    free (want);
+
+    /*
+     * Start from the rarest trigram's files, and keep only those
+     * on each of the other lists in turn.
+     */
+    qsort (entry, distinct, sizeof (trigram_entry_t*), entry_compare);
+    end = index->postings + index->header->postings_size;
+    list = (uint32_t*)malloc (entry[0]->count * sizeof (uint32_t) + 1);
+    if (list == NULL) {
+        free (entry);
+        return ENOMEM;
+    }
+    size = 0;
+    file = 0;
+    next = index->postings + entry[0]->offset;
+    for (listed = 0; listed < entry[0]->count; listed++) {
+        delta = posting_next (&next, end);
+        if (delta < 0)
+            break;
+        file += delta;
+        list[size++] = file;
+    }
+    for (index_want = 1; index_want < distinct && size > 0; index_want++) {
+        next = index->postings + entry[index_want]->offset;
+        file = 0;
+        kept = pos = 0;
+        for (listed = 0;
+            listed < entry[index_want]->count && pos < size; listed++) {
+            delta = posting_next (&next, end);
+            if (delta < 0)
+                break;
+            file += delta;
+            while (pos < size && list[pos] < file)
+                pos++;
+            if (pos < size && list[pos] == file)
+                list[kept++] = list[pos++];
+        }
+        size = kept;
+    }
+    for (pos = 0; pos < size; pos++) {
+        if (list[pos] < index->header->files)
+            candidate[list[pos]] = 1;
+    }
+    free (list);
+    free (entry);
+    return 0;
+}
+
+/*
+ * Initialize an empty trigram set.
+ */
+int trigram_set_init (trigram_set_t *set)
+{
+    memset (set, 0, sizeof (trigram_set_t));
+    set->bits = (unsigned char*)calloc (TRIGRAM_SPACE / 8, 1);
+    if (set->bits == NULL)
+        return ENOMEM;
+    return 0;
+}
+
+void trigram_set_destroy (trigram_set_t *set)
+{
+    free (set->bits);
+    free (set->trigram);
+    memset (set, 0, sizeof (trigram_set_t));
+}
+
+/*
+ * Empty a set, clearing only the bits that were set.
+ */
+void trigram_set_reset (trigram_set_t *set)
+{
+    size_t index;
+
+    for (index = 0; index < set->count; index++)
+        set->bits[set->trigram[index] >> 3] = 0;
+    set->count = 0;
+    set->last = 0;
+    set->seen = 0;
+}
+
+/*
+ * Add the trigrams of the next "size" bytes of a file to its set.
+ * The last two bytes carry over to the next call, so that a file
+ * can be added in pieces of any size.
+ */
+int trigram_set_add (trigram_set_t *set, const char *buffer, size_t size)
+{
+    const unsigned char *text = (const unsigned char*)buffer;
+    uint32_t trigram = set->last, *list;
+    size_t offset;
+    int seen = set->seen;
+
+    for (offset = 0; offset < size; offset++) {
+        trigram = (trigram << 8 | text[offset]) & (TRIGRAM_SPACE - 1);
+        if (seen < 2) {
+            seen++;
+            continue;
+        }
+        if (set->bits[trigram >> 3] & (1 << (trigram & 7)))
+            continue;
+        if (set->count == set->allocated) {
+            set->allocated = set->allocated == 0 ? 4096 : set->allocated * 2;
+            list = (uint32_t*)realloc (
+                set->trigram, set->allocated * sizeof (uint32_t));
+            if (list == NULL)
+                return ENOMEM;
+            set->trigram = list;
+        }
+        set->bits[trigram >> 3] |= 1 << (trigram & 7);
+        set->trigram[set->count++] = trigram;
+    }
+    set->last = trigram;
+    set->seen = seen;
+    return 0;
+}
+
+/*
+ * Add the trigrams of the file open on "fd" (which must be
+ * positioned at its start): map a regular file, or read it in
+ * blocks. Return 0, or an error number.
+ */
+int trigram_set_fd (trigram_set_t *set, int fd)
+{
+    struct stat filestat;
+    char *buffer;
+    ssize_t bytes;
+    int status;
+
+    if (fstat (fd, &filestat) == 0 && S_ISREG (filestat.st_mode)
+        && filestat.st_size > 0) {
+        buffer = (char*)mmap (
+            NULL, filestat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buffer != MAP_FAILED) {
+            madvise (buffer, filestat.st_size, MADV_SEQUENTIAL);
+            status = trigram_set_add (set, buffer, filestat.st_size);
+            munmap (buffer, filestat.st_size);
+            return status;
+        }
+    }
+
+    buffer = (char*)malloc (TRIGRAM_BLOCK);
+    if (buffer == NULL)
+        return errno;
+    status = 0;
+    while (status == 0) {
+        bytes = read (fd, buffer, TRIGRAM_BLOCK);
+        if (bytes < 0) {
+            if (errno == EINTR)
+                continue;
+            status = errno;
+            break;
+        }
+        if (bytes == 0)
+            break;
+        status = trigram_set_add (set, buffer, bytes);
+    }
+    free (buffer);
+    return status;
+}
+
+/*
+ * Fill in a record of the file "path": with the trigrams of "set",
+ * sorted, or, if "old" isn't negative, with the number of the
+ * unchanged file in the older index. Return 0, or an error number.
+ */
+int trigram_record (trigram_set_t *set, long old,
+    trigram_record_t *record, const char *path, const struct stat *filestat)
+{
+    memset (record, 0, sizeof (trigram_record_t));
+    record->path = strdup (path);
+    if (record->path == NULL)
+        return ENOMEM;
+    record->size = filestat->st_size;
+    record->mtime_sec = filestat->st_mtim.tv_sec;
+    record->mtime_nsec = filestat->st_mtim.tv_nsec;
+    record->old = old;
+    if (old >= 0 || set->count == 0)
+        return 0;
+    qsort (set->trigram, set->count, sizeof (uint32_t), trigram_compare);
+    record->trigram = (uint32_t*)malloc (set->count * sizeof (uint32_t));
+    if (record->trigram == NULL) {
+        free (record->path);
+        return ENOMEM;
+    }
+    memcpy (record->trigram, set->trigram, set->count * sizeof (uint32_t));
+    record->count = set->count;
+    return 0;
+}
+
+void trigram_record_destroy (trigram_record_t *record)
+{
+    free (record->path);
+    free (record->trigram);
+    record->path = NULL;
+    record->trigram = NULL;
+}
+
+static int record_compare (const void *a, const void *b)
+{
+    return strcmp (((const trigram_record_t*)a)->path,
+        ((const trigram_record_t*)b)->path);
+}
+
+/*
+ * Write all of a buffer to a file.
+ */
+static int write_all (int fd, const void *data, size_t size)
+{
+    const char *next = (const char*)data;
+    ssize_t bytes;
+
+    while (size > 0) {
+        bytes = write (fd, next, size);
+        if (bytes < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        next += bytes;
+        size -= bytes;
+    }
+    return 0;
+}
+
+/*
+ * Give each record that names a file of the older index "old" the
+ * trigrams of that file, gathered from its posting lists (in order
+ * of trigram, so they come out sorted).
+ */
+static int trigram_recover (
+    const trigram_t *old, trigram_record_t *records, size_t count)
+{
+    const unsigned char *next, *end;
+    const trigram_entry_t *entry;
+    trigram_record_t *record;
+    long *owner, delta;
+    uint32_t file, listed, trigram;
+    size_t index;
+
+    owner = (long*)malloc ((old->header->files + 1) * sizeof (long));
+    if (owner == NULL)
+        return ENOMEM;
+    for (file = 0; file < old->header->files; file++)
+        owner[file] = -1;
+    for (index = 0; index < count; index++) {
+        record = &records[index];
+        if (record->old < 0)
+            continue;
+        if (record->old >= old->header->files) {
+            free (owner);
+            return EINVAL;
+        }
+        owner[record->old] = index;
+        record->trigram = (uint32_t*)malloc (
+            old->file[record->old].trigrams * sizeof (uint32_t) + 1);
+        if (record->trigram == NULL) {
+            free (owner);
+            return ENOMEM;
+        }
+        record->count = 0;
+    }
+
+    end = old->postings + old->header->postings_size;
+    for (trigram = 0; trigram < old->header->trigrams; trigram++) {
+        entry = &old->entry[trigram];
+        next = old->postings + entry->offset;
+        file = 0;
+        for (listed = 0; listed < entry->count; listed++) {
+            delta = posting_next (&next, end);
+            if (delta < 0)
+                break;
+            file += delta;
+            if (file >= old->header->files || owner[file] < 0)
+                continue;
+            record = &records[owner[file]];
+            if (record->count < old->file[file].trigrams)
+                record->trigram[record->count++] = entry->trigram;
+        }
+    }
+    free (owner);
+    return 0;
+}
+
+/*
+ * Write an index of the files in "records" to "path", sorting the
+ * records by path. Those that name files of the older index "old"
+ * (which may be NULL if none do) take their trigrams from it.
+ * Return 0, or an error number.
+ */
+int trigram_write (const char *path, const trigram_t *old,
+    trigram_record_t *records, size_t count)
+{
+    trigram_header_t header;
+    trigram_file_t *files = NULL;
+    trigram_entry_t *entries = NULL;
+    uint32_t *place = NULL, *posted = NULL, value;
+    unsigned char *postings = NULL, *grown;
+    char *names = NULL, *temp = NULL;
+    size_t index, listed, total, distinct, used, allocated, length;
+    uint64_t names_size;
+    uint32_t trigram, begin, end, previous;
+    int fd = -1, status = 0;
+
+    qsort (records, count, sizeof (trigram_record_t), record_compare);
+    for (index = 0; index < count; index++) {
+        if (records[index].old >= 0 && old == NULL)
+            return EINVAL;
+    }
+    if (count > UINT32_MAX)
+        return EFBIG;
+    if (old != NULL) {
+        status = trigram_recover (old, records, count);
+        if (status != 0)
+            return status;
+    }
+
+    /*
+     * The file table, and their paths.
+     */
+    files = (trigram_file_t*)calloc (count + 1, sizeof (trigram_file_t));
+    if (files == NULL)
+        return ENOMEM;
+    names_size = 0;
+    for (index = 0; index < count; index++)
+        names_size += strlen (records[index].path) + 1;
+    names_size = (names_size + 7) & ~(uint64_t)7;
+    if (names_size > UINT32_MAX) {
+        status = EFBIG;
+        goto done;
+    }
+    names = (char*)calloc (names_size + 1, 1);
+    if (names == NULL) {
+        status = ENOMEM;
+        goto done;
+    }
+    used = 0;
+    for (index = 0; index < count; index++) {
+        length = strlen (records[index].path) + 1;
+        memcpy (names + used, records[index].path, length);
+        files[index].name = used;
+        files[index].size = records[index].size;
+        files[index].mtime_sec = records[index].mtime_sec;
+        files[index].mtime_nsec = records[index].mtime_nsec;
+        files[index].trigrams = records[index].count;
+        used += length;
+    }
+
+    /*
+     * Count each trigram's files, and turn the counts into the
+     * places their lists start; then drop each file's number into
+     * place. Afterwards, each trigram's place is where its list
+     * ends (and the next one's starts).
+     */
+    place = (uint32_t*)calloc (TRIGRAM_SPACE, sizeof (uint32_t));
+    if (place == NULL) {
+        status = ENOMEM;
+        goto done;
+    }
+    total = 0;
+    for (index = 0; index < count; index++) {
+        for (listed = 0; listed < records[index].count; listed++)
+            place[records[index].trigram[listed]]++;
+        total += records[index].count;
+    }
+    if (total > UINT32_MAX) {
+        status = EFBIG;
+        goto done;
+    }
+    distinct = 0;
+    previous = 0;
+    for (trigram = 0; trigram < TRIGRAM_SPACE; trigram++) {
+        value = place[trigram];
+        if (value > 0)
+            distinct++;
+        place[trigram] = previous;
+        previous += value;
+    }
+    posted = (uint32_t*)malloc (total * sizeof (uint32_t) + 1);
+    entries = (trigram_entry_t*)malloc (
+        distinct * sizeof (trigram_entry_t) + 1);
+    if (posted == NULL || entries == NULL) {
+        status = ENOMEM;
+        goto done;
+    }
+    for (index = 0; index < count; index++) {
+        for (listed = 0; listed < records[index].count; listed++)
+            posted[place[records[index].trigram[listed]]++] = index;
+    }
+
+    /*
+     * Encode the lists.
+     */
+    allocated = total + 64;
+    postings = (unsigned char*)malloc (allocated);
+    if (postings == NULL) {
+        status = ENOMEM;
+        goto done;
+    }
+    used = 0;
+    distinct = 0;
+    begin = 0;
+    for (trigram = 0; trigram < TRIGRAM_SPACE; trigram++) {
+        end = place[trigram];
+        if (end == begin)
+            continue;
+        entries[distinct].trigram = trigram;
+        entries[distinct].count = end - begin;
+        entries[distinct].offset = used;
+        distinct++;
+        previous = 0;
+        for (; begin < end; begin++) {
+            if (used + 5 > allocated) {
+                allocated *= 2;
+                grown = (unsigned char*)realloc (postings, allocated);
+                if (grown == NULL) {
+                    status = ENOMEM;
+                    goto done;
+                }
+                postings = grown;
+            }
+            value = posted[begin] - previous;
+            previous = posted[begin];
+            while (value >= 0x80) {
+                postings[used++] = (value & 0x7f) | 0x80;
+                value >>= 7;
+            }
+            postings[used++] = value;
+        }
+    }
+
+    /*
+     * Write it all to a temporary file, and put that in place.
+     */
+    memset (&header, 0, sizeof (header));
+    header.magic = TRIGRAM_MAGIC;
+    header.files = count;
+    header.trigrams = distinct;
+    header.names_size = names_size;
+    header.postings_size = used;
+    temp = (char*)malloc (strlen (path) + 8);
+    if (temp == NULL) {
+        status = ENOMEM;
+        goto done;
+    }
+    sprintf (temp, "%s.XXXXXX", path);
+    fd = mkstemp (temp);
+    if (fd < 0) {
+        status = errno;
+        goto done;
+    }
+    status = write_all (fd, &header, sizeof (header));
+    if (status == 0)
+        status = write_all (fd, files, count * sizeof (trigram_file_t));
+    if (status == 0)
+        status = write_all (fd, entries, distinct * sizeof (trigram_entry_t));
+    if (status == 0)
+        status = write_all (fd, names, names_size);
+    if (status == 0)
+        status = write_all (fd, postings, used);
+    if (close (fd) == -1 && status == 0)
+        status = errno;
+    if (status == 0 && rename (temp, path) == -1)
+        status = errno;
+    if (status != 0)
+        unlink (temp);
+
+  done:
+    free (temp);
+    free (postings);
+    free (entries);
+    free (posted);
+    free (place);
+    free (names);
+    free (files);
+    return status;
+}
@@ -0,0 +1,150 @@
+/*
+ * trigram.h
+ *
+ * This header file describes a trigram index of a directory tree,
+ * used by the crew program to avoid reading files that can't hold
+ * what it's searching for.
+ *
+ * A trigram is three consecutive bytes of a file. The index lists,
+ * for each trigram that appears anywhere in the tree, the files
+ * it appears in (its "posting list"). A string of three bytes or
+ * more can appear only in the files on the posting lists of all
+ * of its trigrams, so a query intersects those lists (rarest
+ * first) and marks the files that survive as candidates; every
+ * other indexed file is known not to hold the string. (A shorter
+ * string makes every file a candidate.) The candidates still have
+ * to be searched, since their trigrams may not be adjacent.
+ *
+ * The index is one file, mapped when it's opened, and used in
+ * place:
+ *
+ *      trigram_header_t
+ *      trigram_file_t[files]           sorted by path
+ *      trigram_entry_t[trigrams]       sorted by trigram
+ *      names                           null-terminated paths
+ *      postings                        for each entry, its files
+ *
+ * A posting list is the sorted numbers of its files, each stored
+ * as the difference from the one before, in 7-bit groups with the
+ * high bit set on all but the last ("varint" encoding), so that
+ * the list for a common trigram costs a byte or so per file. Each
+ * file's entry records its size and modification time when it was
+ * indexed; trigram_lookup() finds a file by its path, and returns
+ * its number only if it hasn't changed since, so that a stale
+ * index never hides a match. The index is written in the byte
+ * order of the machine that writes it.
+ *
+ * To build an index, the trigrams of each file are gathered in a
+ * trigram_set_t, and then copied into a trigram_record_t for the
+ * file; trigram_write() sorts the records, inverts them into
+ * posting lists, and writes the index. A record may instead name
+ * an unchanged file of an older index, whose trigrams are then
+ * recovered from that index's posting lists, so that updating an
+ * index reads only the files that changed. The index is written
+ * to a temporary file and renamed, so that a reader never sees it
+ * half written.
+ */
+#ifndef __trigram_h
+#define __trigram_h
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+
+#define TRIGRAM_MAGIC   0x33697274U     /* "tri3" */
+#define TRIGRAM_SPACE   (1 << 24)       /* possible trigrams */
+#define TRIGRAM_BLOCK   (1024 * 1024)   /* bytes per read */
+
+/*
+ * The layout of the index file.
+ */
+typedef struct trigram_header_tag {
+    uint32_t            magic;          /* TRIGRAM_MAGIC */
+    uint32_t            files;
+    uint32_t            trigrams;       /* distinct trigrams */
+    uint32_t            reserved;
+    uint64_t            names_size;     /* bytes, a multiple of 8 */
+    uint64_t            postings_size;  /* bytes */
+} trigram_header_t;
+
+typedef struct trigram_file_tag {
+    uint64_t            size;
+    int64_t             mtime_sec;      /* modification time */
+    uint32_t            mtime_nsec;
+    uint32_t            name;           /* offset of its path */
+    uint32_t            trigrams;       /* distinct trigrams in it */
+    uint32_t            reserved;
+} trigram_file_t;
+
+typedef struct trigram_entry_tag {
+    uint32_t            trigram;
+    uint32_t            count;          /* files it's in */
+    uint64_t            offset;         /* of its posting list */
+} trigram_entry_t;
+
+/*
+ * Structure describing an open index.
+ */
+typedef struct trigram_tag {
+    int                 valid;          /* set when valid */
+    void                *map;
+    size_t              map_size;
+    const trigram_header_t *header;
+    const trigram_file_t *file;
+    const trigram_entry_t *entry;
+    const char          *names;
+    const unsigned char *postings;
+} trigram_t;
+
+#define TRIGRAM_VALID   0x7a13
+
+/*
+ * The distinct trigrams of one file, gathered in a bitmap (of 2
+ * megabytes, so that a builder keeps one and reuses it), with a
+ * list of those found so that it can be cleared quickly.
+ */
+typedef struct trigram_set_tag {
+    unsigned char       *bits;          /* TRIGRAM_SPACE bits */
+    uint32_t            *trigram;       /* those set */
+    size_t              count;
+    size_t              allocated;
+    uint32_t            last;           /* the bytes before the next */
+    int                 seen;           /* how many (up to 2) */
+} trigram_set_t;
+
+/*
+ * A file to be written to an index: its trigrams, sorted, or (if
+ * "old" isn't negative) its number in the older index passed to
+ * trigram_write(), from which they're to be copied.
+ */
+typedef struct trigram_record_tag {
+    char                *path;
+    uint64_t            size;
+    int64_t             mtime_sec;
+    uint32_t            mtime_nsec;
+    long                old;            /* file in older index, or -1 */
+    uint32_t            *trigram;
+    uint32_t            count;
+} trigram_record_t;
+
+/*
+ * Define trigram index functions
+ */
+extern int trigram_open (trigram_t *index, const char *path);
+extern int trigram_close (trigram_t *index);
+extern long trigram_lookup (
+    const trigram_t *index, const char *path, const struct stat *filestat);
+extern int trigram_query (const trigram_t *index,
+    const char *string, size_t length, unsigned char *candidate);
+extern int trigram_set_init (trigram_set_t *set);
+extern void trigram_set_destroy (trigram_set_t *set);
+extern void trigram_set_reset (trigram_set_t *set);
+extern int trigram_set_add (
+    trigram_set_t *set, const char *buffer, size_t size);
+extern int trigram_set_fd (trigram_set_t *set, int fd);
+extern int trigram_record (trigram_set_t *set, long old,
+    trigram_record_t *record, const char *path, const struct stat *filestat);
+extern void trigram_record_destroy (trigram_record_t *record);
+extern int trigram_write (const char *path, const trigram_t *old,
+    trigram_record_t *records, size_t count);
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ * uring.c
+ *
+ * This file implements the io_uring wrapper described in uring.h.
+ *
+ * The kernel shares three regions with us: the submission queue
+ * ring (head, tail, and an array of indexes into the entries), the
+ * submission queue entries, and the completion queue ring. On
+ * kernels with IORING_FEAT_SINGLE_MMAP the two rings are one
+ * mapping. The head and tail each side advances are stored with
+ * release semantics, and the other side's are loaded with acquire
+ * semantics, so that an entry is complete before its index is
+ * published.
+ *
+ * io_uring is Linux's own, so elsewhere this file compiles to
+ * nothing, and crew.c reads files as it always did.
+ */
+#ifdef __linux__
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "errors.h"
+#include "uring.h"
+
+/*
+ * Create a ring with (at least) "entries" submission queue entries,
+ * and twice as many completion queue entries.
+ */
+int uring_init (uring_t *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    char *sq, *cq;
+    int status;
+
+    memset (ring, 0, sizeof (uring_t));
+    memset (&params, 0, sizeof (params));
+    ring->fd = syscall (__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        status = errno;
+        return (status == ENOSYS || status == EPERM) ? ENOSYS : status;
+    }
+
+    ring->sq_ring_size = params.sq_off.array
+        + params.sq_entries * sizeof (unsigned);
+    ring->cq_ring_size = params.cq_off.cqes
+        + params.cq_entries * sizeof (struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = 0;
+    }
+    ring->sq_ring = mmap (NULL, ring->sq_ring_size,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        status = errno;
+        close (ring->fd);
+        return status;
+    }
+    if (ring->cq_ring_size == 0)
+        ring->cq_ring = ring->sq_ring;
+    else {
+        ring->cq_ring = mmap (NULL, ring->cq_ring_size,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            status = errno;
+            munmap (ring->sq_ring, ring->sq_ring_size);
+            close (ring->fd);
+            return status;
+        }
+    }
+    ring->sqes = (struct io_uring_sqe*)mmap (NULL,
+        params.sq_entries * sizeof (struct io_uring_sqe),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        status = errno;
+        if (ring->cq_ring_size != 0)
+            munmap (ring->cq_ring, ring->cq_ring_size);
+        munmap (ring->sq_ring, ring->sq_ring_size);
+        close (ring->fd);
+        return status;
+    }
+
+    sq = (char*)ring->sq_ring;
+    cq = (char*)ring->cq_ring;
+    ring->entries = params.sq_entries;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->sqe_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+/*
+ * Unmap and close a ring.
+ */
+int uring_destroy (uring_t *ring)
+{
+    munmap (ring->sqes, ring->entries * sizeof (struct io_uring_sqe));
+    if (ring->cq_ring_size != 0)
+        munmap (ring->cq_ring, ring->cq_ring_size);
+    munmap (ring->sq_ring, ring->sq_ring_size);
+    if (close (ring->fd) == -1)
+        return errno;
+    return 0;
+}
+
+/*
+ * Return 0 if the kernel supports each of the "count" operations
+ * (IORING_OP_ values) in "ops", or ENOSYS if not (or if it's too
+ * old to say).
+ */
+int uring_supports (uring_t *ring, const int *ops, int count)
+{
+    struct io_uring_probe *probe;
+    size_t size;
+    int index, status = 0;
+
+    size = sizeof (struct io_uring_probe)
+        + 256 * sizeof (struct io_uring_probe_op);
+    probe = (struct io_uring_probe*)calloc (1, size);
+    if (probe == NULL)
+        return ENOMEM;
+    if (syscall (__NR_io_uring_register,
+            ring->fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+        status = ENOSYS;
+    for (index = 0; status == 0 && index < count; index++) {
+        if (ops[index] > probe->last_op
+            || !(probe->ops[ops[index]].flags & IO_URING_OP_SUPPORTED))
+            status = ENOSYS;
+    }
+    free (probe);
+    return status;
+}
+
+/*
+ * Return the next submission queue entry, cleared, or NULL if all
+ * of them have been prepared and not yet taken by the kernel.
+ */
+struct io_uring_sqe *uring_sqe (uring_t *ring)
+{
+    struct io_uring_sqe *sqe;
+    unsigned index;
+
+    if (ring->sqe_tail - __atomic_load_n (ring->sq_head, __ATOMIC_ACQUIRE)
+        >= ring->entries)
+        return NULL;
+    index = ring->sqe_tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset (sqe, 0, sizeof (struct io_uring_sqe));
+    ring->sq_array[index] = index;
+    ring->sqe_tail++;
+    return sqe;
+}
+
+/*
+ * Submit the prepared entries, and wait until at least "wait"
+ * completions are available. Return 0, or an error number.
+ */
+int uring_submit (uring_t *ring, unsigned wait)
+{
+    unsigned submit;
+    int done;
+
+    __atomic_store_n (ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    submit = ring->sqe_tail
+        - __atomic_load_n (ring->sq_head, __ATOMIC_ACQUIRE);
+    while (submit > 0 || wait > 0) {
+        done = syscall (__NR_io_uring_enter, ring->fd, submit, wait,
+            wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        if (done == 0 && wait == 0)
+            break;
+        submit -= done;
+        wait = 0;
+    }
+    return 0;
+}
+
+/*
+ * Return the oldest completion not yet consumed, or NULL.
+ */
+struct io_uring_cqe *uring_cqe (uring_t *ring)
+{
+    unsigned head = *ring->cq_head;
+
+    if (head == __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+void uring_cqe_seen (uring_t *ring)
+{
+    __atomic_store_n (ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif
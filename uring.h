@@ -0,0 +1,61 @@
+/*
+ * uring.h
+ *
+ * This header file describes a minimal wrapper for Linux io_uring,
+ * made directly with the system calls (there's no liburing to
+ * depend on), used by the crew program to keep many file reads
+ * in flight from each worker.
+ *
+ * uring_init() creates a ring and maps its queues; it returns
+ * ENOSYS if the kernel has no io_uring, or doesn't let this
+ * process use it. uring_supports() checks that the kernel
+ * implements each of a list of operations.
+ *
+ * Submissions are prepared in place: uring_sqe() returns the next
+ * free (and zeroed) submission queue entry, or NULL if the queue
+ * is full, and uring_submit() hands all prepared entries to the
+ * kernel at once, and can wait for completions. uring_cqe()
+ * returns the oldest completion not yet consumed (or NULL), which
+ * uring_cqe_seen() then consumes.
+ *
+ * A ring isn't locked; only one thread at a time may use it.
+ */
+#ifndef __uring_h
+#define __uring_h
+#include <sys/types.h>
+#include <linux/io_uring.h>
+
+/*
+ * Structure describing a ring.
+ */
+typedef struct uring_tag {
+    int                 fd;             /* from io_uring_setup */
+    unsigned            entries;        /* submission queue size */
+    unsigned            *sq_head;       /* advanced by the kernel */
+    unsigned            *sq_tail;       /* advanced by us */
+    unsigned            *sq_mask;
+    unsigned            *sq_array;
+    unsigned            sqe_tail;       /* entries prepared */
+    unsigned            *cq_head;       /* advanced by us */
+    unsigned            *cq_tail;       /* advanced by the kernel */
+    unsigned            *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void                *sq_ring;       /* mappings */
+    size_t              sq_ring_size;
+    void                *cq_ring;
+    size_t              cq_ring_size;
+} uring_t;
+
+/*
+ * Define io_uring functions
+ */
+extern int uring_init (uring_t *ring, unsigned entries);
+extern int uring_destroy (uring_t *ring);
+extern int uring_supports (uring_t *ring, const int *ops, int count);
+extern struct io_uring_sqe *uring_sqe (uring_t *ring);
+extern int uring_submit (uring_t *ring, unsigned wait);
+extern struct io_uring_cqe *uring_cqe (uring_t *ring);
+extern void uring_cqe_seen (uring_t *ring);
+
+#endif